@@ -30,6 +30,7 @@
 #include "qemu/timer.h"
 #include "qemu/rcu.h"
 #include "exec/log.h"
+#include "exec/gdbstub.h"
 #include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
@@ -232,6 +233,7 @@ static bool check_for_breakpoints(CPUState *cpu, target_ulong pc,
 {
     CPUBreakpoint *bp;
     bool match_page = false;
+    bool bp_check = false;
 
     if (likely(QTAILQ_EMPTY(&cpu->breakpoints))) {
         return false;
@@ -259,7 +261,17 @@ static bool check_for_breakpoints(CPUState *cpu, target_ulong pc,
             bool match_bp = false;
 
             if (bp->flags & BP_GDB) {
-                match_bp = true;
+                /*
+                 * gdb conditions and tracepoints are evaluated by the
+                 * TB, in the vCPU thread, so that they run exactly once
+                 * each time the instruction is reached: a TB may still
+                 * be left at its start after being looked up.
+                 */
+                if (gdb_breakpoint_is_conditional(pc)) {
+                    bp_check = true;
+                } else {
+                    match_bp = true;
+                }
             } else if (bp->flags & BP_CPU) {
 #ifdef CONFIG_USER_ONLY
                 g_assert_not_reached();
@@ -291,12 +303,44 @@ static bool check_for_breakpoints(CPUState *cpu, target_ulong pc,
      * invalidated, nor would any TB need to be invalidated as
      * breakpoints are removed.
      */
-    if (match_page) {
+    if (match_page || bp_check) {
         *cflags = (*cflags & ~CF_COUNT_MASK) | CF_NO_GOTO_TB | 1;
     }
+    /* Evaluate the gdb breakpoint with helper_gdb_bp_check.  */
+    if (bp_check) {
+        *cflags |= CF_BP_CHECK;
+    }
     return false;
 }
 
+/*
+ * Number of lookups of the same idle-loop TB, without leaving the loop
+ * in between, after which the vCPU is considered idle.  This keeps short
+ * waits (e.g. for a device that answers within a few iterations)
+ * spinning.  A lookup of another TB restarts the count, and so do the
+ * chained exits of the loop, which clear cpu->idle_spins inline (see
+ * translator_use_goto_tb).
+ */
+#define TB_IDLE_SPINS 1024
+
+/*
+ * Return true if @cpu has been going round the idle loop @tb long enough
+ * to be parked with EXCP_IDLE.
+ */
+static inline bool tb_idle_spin(CPUState *cpu, TranslationBlock *tb)
+{
+    if (tb != cpu->idle_tb || !tb->idle_loop) {
+        cpu->idle_tb = tb;
+        cpu->idle_spins = 0;
+        return false;
+    }
+    if (++cpu->idle_spins < TB_IDLE_SPINS) {
+        return false;
+    }
+    cpu->idle_spins = 0;
+    return true;
+}
+
 /**
  * helper_lookup_tb_ptr: quick check for next tb
  * @env: current cpu state
@@ -324,6 +368,11 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
         return tcg_code_gen_epilogue;
     }
 
+    if (unlikely(tb_idle_detect) && tb_idle_spin(cpu, tb)) {
+        cpu->exception_index = EXCP_IDLE;
+        cpu_loop_exit(cpu);
+    }
+
     log_cpu_exec(pc, cpu, tb);
 
     return tb->tc.ptr;
@@ -586,6 +635,118 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * Speculative translation of static successors.
+ *
+ * With "-accel tcg,pretranslate=on", translator_use_goto_tb() queues each
+ * same-page direct branch target it sees.  While the vCPU is halted, the
+ * queued targets that are not yet in the TB cache are translated ahead of
+ * time, so that the first jump to them does not have to stop for codegen.
+ */
+bool tb_pretranslate_enabled;
+
+void tb_pretranslate_note(CPUState *cpu, const TranslationBlock *tb,
+                          target_ulong pc)
+{
+    TBPretranslateQueue *q = cpu->tb_pretranslate;
+    TBPretranslateEntry *e;
+    unsigned i;
+
+    if (q == NULL) {
+        q = cpu->tb_pretranslate = g_new0(TBPretranslateQueue, 1);
+    }
+
+    for (i = 0; i < q->count; i++) {
+        e = &q->entry[(q->head + i) % TB_PRETRANSLATE_QUEUE_SIZE];
+        if (e->pc == pc && e->cs_base == tb->cs_base && e->flags == tb->flags) {
+            return;
+        }
+    }
+
+    /* When full, drop the oldest hint in favour of the most recent one. */
+    if (q->count == TB_PRETRANSLATE_QUEUE_SIZE) {
+        q->head = (q->head + 1) % TB_PRETRANSLATE_QUEUE_SIZE;
+        q->count--;
+    }
+    e = &q->entry[(q->head + q->count) % TB_PRETRANSLATE_QUEUE_SIZE];
+    e->pc = pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    q->count++;
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Translation happens on the vCPU's own thread while it is halted, so it
+ * only helps guests that idle with WFI/HLT between bursts of work.  Code
+ * is only fetched from RAM pages that are already in the TLB: with
+ * cpu->tb_pretranslating set, a code TLB miss or a code fetch from MMIO
+ * exits through cpu_loop_exit() before any guest-visible state changes,
+ * and the hint is dropped.
+ */
+static void tb_pretranslate_idle(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TBPretranslateQueue *q = cpu->tb_pretranslate;
+    target_ulong cs_base, pc;
+    uint32_t flags, cflags;
+
+    if (q == NULL || q->count == 0 || cpu->singlestep_enabled) {
+        return;
+    }
+
+    /*
+     * The MMU index used for fetching comes from the current cpu state,
+     * so only the hints that were queued in the same state are usable.
+     */
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    cflags = curr_cflags(cpu);
+
+    rcu_read_lock();
+    cpu->tb_pretranslating = true;
+    while (q->count && !cpu_has_work(cpu)
+           && !qatomic_read(&cpu->exit_request)) {
+        TBPretranslateEntry e = q->entry[q->head];
+
+        q->head = (q->head + 1) % TB_PRETRANSLATE_QUEUE_SIZE;
+        q->count--;
+
+        if (e.cs_base != cs_base || e.flags != flags ||
+            tb_lookup(cpu, e.pc, e.cs_base, e.flags, cflags)) {
+            continue;
+        }
+
+        if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+            /* A TB outside of RAM would not be cached anyway.  */
+            if (get_page_addr_code(env, e.pc) == -1) {
+                continue;
+            }
+            mmap_lock();
+            tb_gen_code(cpu, e.pc, e.cs_base, e.flags, cflags);
+            mmap_unlock();
+            qatomic_inc(&tb_ctx.tb_pretranslate_count);
+        } else {
+            if (qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
+            assert_no_pages_locked();
+            /*
+             * Either fetching the code was refused, which only drops this
+             * hint, or tb_gen_code ran out of space and scheduled a flush,
+             * which makes the remaining hints stale.  The exit request the
+             * latter left behind is of no interest to a halted cpu.
+             */
+            if (cpu->exception_index == EXCP_INTERRUPT) {
+                q->count = 0;
+            }
+            cpu->exception_index = -1;
+        }
+    }
+    cpu->tb_pretranslating = false;
+    rcu_read_unlock();
+}
+#endif
+
 static inline bool cpu_handle_halt(CPUState *cpu)
 {
     if (cpu->halted) {
@@ -810,6 +971,13 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
     trace_exec_tb(tb, tb->pc);
     tb = cpu_tb_exec(cpu, tb, tb_exit);
+    if (unlikely(tb && tb->prof)) {
+        if (*tb_exit <= TB_EXIT_IDX1) {
+            tb->prof->chain_misses++;
+        } else if (*tb_exit == TB_EXIT_REQUESTED) {
+            tb->prof->requested_exits++;
+        }
+    }
     if (*tb_exit != TB_EXIT_REQUESTED) {
         *last_tb = tb;
         return;
@@ -862,6 +1030,11 @@ int cpu_exec(CPUState *cpu)
     current_cpu = cpu;
 
     if (cpu_handle_halt(cpu)) {
+#ifndef CONFIG_USER_ONLY
+        if (tb_pretranslate_enabled) {
+            tb_pretranslate_idle(cpu);
+        }
+#endif
         return EXCP_HALTED;
     }
 
@@ -951,6 +1124,11 @@ int cpu_exec(CPUState *cpu)
                 qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
             }
 
+            if (unlikely(tb_idle_detect) && tb_idle_spin(cpu, tb)) {
+                cpu->exception_index = EXCP_IDLE;
+                break;
+            }
+
 #ifndef CONFIG_USER_ONLY
             /*
              * We don't take care of direct jumps when address mapping
@@ -1007,6 +1185,8 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 
     qemu_plugin_vcpu_exit_hook(cpu);
     tlb_destroy(cpu);
+    g_free(cpu->tb_pretranslate);
+    cpu->tb_pretranslate = NULL;
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -37,6 +37,9 @@
 #include "trace/mem.h"
 #include "tb-hash.h"
 #include "internal.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "sysemu/tcg.h"
 #ifdef CONFIG_PLUGIN
 #include "qemu/plugin-memory.h"
 #endif
@@ -235,7 +238,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -339,6 +342,66 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_victim_counts(size_t *phit, size_t *pmiss, size_t *pfill)
+{
+    CPUState *cpu;
+    size_t hit = 0, miss = 0, fill = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        int mmu_idx;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+
+            hit += qatomic_read(&desc->vtlb_hit_count);
+            miss += qatomic_read(&desc->vtlb_miss_count);
+            fill += qatomic_read(&desc->fill_count);
+        }
+    }
+    *phit = hit;
+    *pmiss = miss;
+    *pfill = fill;
+}
+
+TlbStatsInfoList *qmp_x_query_tlb_stats(Error **errp)
+{
+    TlbStatsInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TLB statistics are only available with accel=tcg");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        int mmu_idx;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+            CPUTLBDescFast *fast = &env_tlb(env)->f[mmu_idx];
+            TlbStatsInfo *info;
+
+            /* Skip the modes that the guest never used.  */
+            if (!qatomic_read(&desc->fill_count)) {
+                continue;
+            }
+
+            info = g_new0(TlbStatsInfo, 1);
+            info->cpu_index = cpu->cpu_index;
+            info->mmu_idx = mmu_idx;
+            info->size = (qatomic_read(&fast->mask) >> CPU_TLB_ENTRY_BITS) + 1;
+            info->used = qatomic_read(&desc->n_used_entries);
+            info->victim_hits = qatomic_read(&desc->vtlb_hit_count);
+            info->victim_misses = qatomic_read(&desc->vtlb_miss_count);
+            info->fills = qatomic_read(&desc->fill_count);
+            QAPI_LIST_APPEND(tail, info);
+        }
+    }
+    return head;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -444,6 +507,13 @@ static inline bool tlb_hit_page_anyprot(CPUTLBEntry *tlb_entry,
     return tlb_hit_page_mask_anyprot(tlb_entry, page, -1);
 }
 
+/* Return the set of the victim tlb that may hold @page.  */
+static inline size_t vtlb_set(target_ulong page)
+{
+    QEMU_BUILD_BUG_ON(CPU_VTLB_SETS & (CPU_VTLB_SETS - 1));
+    return (page >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1);
+}
+
 /**
  * tlb_entry_is_empty - return true if the entry is not in use
  * @te: pointer to CPUTLBEntry
@@ -999,6 +1069,45 @@ static inline void copy_tlb_helper_locked(CPUTLBEntry *d, const CPUTLBEntry *s)
     *d = *s;
 }
 
+/* Return the page mapped by the non-empty entry @te.  */
+static inline target_ulong tlb_entry_page(const CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = tlb_addr_write(te);
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
+/*
+ * Move @te, with its iotlb entry @io, into its set of the victim tlb.
+ * Prefer a free way, otherwise replace the ways in turn.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_vtable_insert_locked(CPUTLBDesc *desc, const CPUTLBEntry *te,
+                                     const CPUIOTLBEntry *io)
+{
+    size_t set = vtlb_set(tlb_entry_page(te));
+    size_t vidx = set * CPU_VTLB_WAYS;
+    size_t way;
+
+    for (way = 0; way < CPU_VTLB_WAYS; way++) {
+        if (tlb_entry_is_empty(&desc->vtable[vidx + way])) {
+            break;
+        }
+    }
+    if (way == CPU_VTLB_WAYS) {
+        way = desc->vindex[set]++ % CPU_VTLB_WAYS;
+    }
+
+    copy_tlb_helper_locked(&desc->vtable[vidx + way], te);
+    desc->viotlb[vidx + way] = *io;
+}
+
 /* This is a cross vCPU call (i.e. another vCPU resetting the flags of
  * the target vCPU).
  * We must take tlb_c.lock to avoid racing with another vCPU update. The only
@@ -1205,14 +1314,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
-        CPUTLBEntry *tv = &desc->vtable[vidx];
-
         /* Evict the old entry into the victim tlb.  */
-        copy_tlb_helper_locked(tv, te);
-        desc->viotlb[vidx] = desc->iotlb[index];
+        tlb_vtable_insert_locked(desc, te, &desc->iotlb[index]);
         tlb_n_used_entries_dec(env, mmu_idx);
     }
+    qatomic_set(&desc->fill_count, desc->fill_count + 1);
 
     /* refill the tlb */
     /*
@@ -1291,12 +1397,29 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
  * caller's prior references to the TLB table (e.g. CPUTLBEntry pointers) must
  * be discarded and looked up again (e.g. via tlb_entry()).
  */
+/*
+ * tb_pretranslate_idle() fetches code that the guest has not reached and
+ * may never reach.  Walking the page tables or reading a device on its
+ * behalf could change guest-visible state, e.g. the fault address
+ * registers, so give up on the translation instead.
+ */
+static inline void tb_pretranslate_check(CPUState *cpu)
+{
+    if (unlikely(cpu->tb_pretranslating)) {
+        cpu_loop_exit(cpu);
+    }
+}
+
 static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (access_type == MMU_INST_FETCH) {
+        tb_pretranslate_check(cpu);
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1447,11 +1570,14 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set(page);
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
+    for (vidx = set * CPU_VTLB_WAYS;
+         vidx < (set + 1) * CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         target_ulong cmp;
 
         /* elt_ofs might correspond to .addr_write, so use qatomic_read */
@@ -1462,21 +1588,29 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
 #endif
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb, swap tlb and iotlb.  The entry
+             * displaced from the tlb goes to the set of its own page.
+             */
             CPUTLBEntry tmptlb, *tlb = &env_tlb(env)->f[mmu_idx].table[index];
+            CPUIOTLBEntry tmpio, *io = &desc->iotlb[index];
 
             qemu_spin_lock(&env_tlb(env)->c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            memset(vtlb, -1, sizeof(*vtlb));
+            tmpio = *io;
+            *io = desc->viotlb[vidx];
+            if (!tlb_entry_is_empty(&tmptlb)) {
+                tlb_vtable_insert_locked(desc, &tmptlb, &tmpio);
+            }
             qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-            CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
-            CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
-            tmpio = *io; *io = *vio; *vio = tmpio;
+            qatomic_set(&desc->vtlb_hit_count, desc->vtlb_hit_count + 1);
             return true;
         }
     }
+    qatomic_set(&desc->vtlb_miss_count, desc->vtlb_miss_count + 1);
     return false;
 }
 
@@ -1540,6 +1674,13 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     return get_page_addr_code_hostp(env, addr, NULL);
 }
 
+/*
+ * Every store to a page that holds TBs comes here, because TLB_NOTDIRTY
+ * is a property of the whole TLB entry and the inline fast path of each
+ * TCG backend only compares page tags.  The code bitmap checked by
+ * tb_page_range_has_code() saves the invalidation for stores that miss
+ * the translated bytes, but not the trip through the slow path.
+ */
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUIOTLBEntry *iotlbentry, uintptr_t retaddr)
 {
@@ -1547,7 +1688,8 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
 
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
 
-    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE) &&
+        tb_page_range_has_code(ram_addr, size)) {
         struct page_collection *pages
             = page_collection_lock(ram_addr, ram_addr + size);
         tb_invalidate_phys_page_fast(pages, ram_addr, size, retaddr);
@@ -1935,6 +2077,9 @@ load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
 
         /* Handle I/O access.  */
         if (likely(tlb_addr & TLB_MMIO)) {
+            if (code_read) {
+                tb_pretranslate_check(env_cpu(env));
+            }
             return io_readx(env, iotlbentry, mmu_idx, addr, retaddr,
                             access_type, op ^ (need_swap * MO_BSWAP));
         }
@@ -2713,7 +2858,7 @@ void cpu_stq_le_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 #include "atomic_template.h"
 #endif
 
-#if HAVE_CMPXCHG128 || HAVE_ATOMIC128
+#if HAVE_CMPXCHG128_MAYBE || HAVE_ATOMIC128_MAYBE
 #define DATA_SIZE 16
 #include "atomic_template.h"
 #endif
@@ -2,6 +2,10 @@
 #include "qemu/error-report.h"
 #include "exec/exec-all.h"
 #include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
 #include "sysemu/tcg.h"
 
 static void hmp_info_jit(Monitor *mon, const QDict *qdict)
@@ -20,10 +24,39 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
     dump_opcount_info();
 }
 
+static void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+    TbProfileInfoList *list, *elem;
+    Error *err = NULL;
+
+    list = qmp_x_query_tb_profile(true, max, &err);
+    if (err) {
+        hmp_handle_error(mon, err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %14s %10s %10s %5s %10s %6s %6s\n",
+                   "guest pc", "executions", "chain-miss", "req-exit",
+                   "xlat", "xlat-ns", "host", "guest");
+    for (elem = list; elem; elem = elem->next) {
+        TbProfileInfo *info = elem->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " %14" PRIu64 " %10" PRIu64
+                       " %10" PRIu64 " %5" PRIu64 " %10" PRIu64
+                       " %6" PRIu32 " %6" PRIu32 "\n",
+                       info->pc, info->exec_count, info->chain_misses,
+                       info->requested_exits, info->translations,
+                       info->translate_ns, info->host_size, info->guest_size);
+    }
+    qapi_free_TbProfileInfoList(list);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp("jit", true, hmp_info_jit);
     monitor_register_hmp("opcount", true, hmp_info_opcount);
+    monitor_register_hmp("tb-profile", true, hmp_info_tb_profile);
 }
 
 type_init(hmp_tcg_register);
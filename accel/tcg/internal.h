@@ -19,4 +19,57 @@ void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
 
+/*
+ * Static successors of recently translated TBs, queued by
+ * translator_use_goto_tb() for translation while the vCPU is idle.
+ */
+#define TB_PRETRANSLATE_QUEUE_SIZE 32
+
+typedef struct TBPretranslateEntry {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+} TBPretranslateEntry;
+
+typedef struct TBPretranslateQueue {
+    TBPretranslateEntry entry[TB_PRETRANSLATE_QUEUE_SIZE];
+    unsigned head;
+    unsigned count;
+} TBPretranslateQueue;
+
+extern bool tb_pretranslate_enabled;
+extern unsigned tb_follow_branches;
+extern bool tb_idle_detect;
+extern uint32_t tcg_icount_quantum;
+
+void tb_pretranslate_note(CPUState *cpu, const TranslationBlock *tb,
+                          target_ulong pc);
+
+/*
+ * Execution profile of the TBs translated for one guest pc/cs_base/flags,
+ * accumulated across retranslations.  @exec_count is incremented by
+ * generated code at the start of the TB; the other counters are updated
+ * when the TB returns to the main loop.  Updates are not atomic, so counts
+ * from concurrently running vCPUs may be slightly low.
+ */
+typedef struct TBProfile {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+
+    uint64_t exec_count;
+    uint64_t chain_misses;
+    uint64_t requested_exits;
+    uint64_t translations;
+    uint64_t translate_ns;
+    uint32_t host_size;
+    uint32_t guest_size;
+} TBProfile;
+
+extern bool tb_profile_enabled;
+
+void tb_profile_init(void);
+TBProfile *tb_profile_get(const TranslationBlock *tb);
+void tb_profile_translated(const TranslationBlock *tb, int64_t ns);
+
 #endif /* ACCEL_TCG_INTERNAL_H */
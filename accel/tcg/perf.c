@@ -0,0 +1,356 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * Every TB is reported as one symbol covering its host code, named after
+ * the guest function it was translated from (when a symbol table is known)
+ * and its guest PC, so that "perf report" attributes host cycles to guest
+ * code.  The jitdump format is described in
+ * tools/perf/Documentation/jitdump-specification.txt in the Linux tree.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "elf.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "perf.h"
+
+static QemuMutex perf_lock;
+static bool perf_lock_initialized;
+
+static void perf_init_lock(void)
+{
+    if (!perf_lock_initialized) {
+        qemu_mutex_init(&perf_lock);
+        perf_lock_initialized = true;
+        atexit(perf_exit);
+    }
+}
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+/* Guest symbol map */
+
+#ifdef CONFIG_USER_ONLY
+typedef target_ulong symmap_addr_t;
+#else
+typedef hwaddr symmap_addr_t;
+#endif
+
+typedef struct SymMapEntry {
+    target_ulong addr;
+    char *name;
+} SymMapEntry;
+
+static SymMapEntry *symmap;
+static size_t symmap_len;
+
+static gint symmap_cmp(gconstpointer a, gconstpointer b)
+{
+    const SymMapEntry *ea = a, *eb = b;
+
+    return ea->addr < eb->addr ? -1 : ea->addr > eb->addr;
+}
+
+/* A symbol extends up to the next one. */
+static const char *symmap_lookup(struct syminfo *s, symmap_addr_t orig_addr)
+{
+    size_t lo = 0, hi = symmap_len;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (symmap[mid].addr <= orig_addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? symmap[lo - 1].name : "";
+}
+
+bool perf_load_symbols(const char *filename, Error **errp)
+{
+    struct syminfo *s;
+    GArray *syms;
+    char line[512];
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (f == NULL) {
+        error_setg_errno(errp, errno, "Could not open symbol map %s",
+                         filename);
+        return false;
+    }
+
+    syms = g_array_new(false, false, sizeof(SymMapEntry));
+    while (fgets(line, sizeof(line), f)) {
+        char name[256], type[8];
+        uint64_t addr;
+        SymMapEntry e;
+
+        if (sscanf(line, "%" SCNx64 " %7s %255s", &addr, type, name) != 3 &&
+            sscanf(line, "%" SCNx64 " %255s", &addr, name) != 2) {
+            continue;
+        }
+        e.addr = addr;
+        e.name = g_strdup(name);
+        g_array_append_val(syms, e);
+    }
+    fclose(f);
+
+    g_array_sort(syms, symmap_cmp);
+    symmap_len = syms->len;
+    symmap = (SymMapEntry *)g_array_free(syms, false);
+
+    s = g_new0(struct syminfo, 1);
+    s->lookup_symbol = symmap_lookup;
+    s->disas_num_syms = symmap_len;
+    s->next = syminfos;
+    syminfos = s;
+    return true;
+}
+
+static char *perf_tb_name(const TranslationBlock *tb)
+{
+    const char *sym = lookup_symbol(tb->pc);
+
+    if (sym[0] != '\0') {
+        return g_strdup_printf("%s [guest 0x" TARGET_FMT_lx "]", sym, tb->pc);
+    }
+    return g_strdup_printf("guest 0x" TARGET_FMT_lx, tb->pc);
+}
+
+/* perf-<pid>.map */
+
+static FILE *perfmap;
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    perf_init_lock();
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+    }
+}
+
+/* jit-<pid>.dump */
+
+static FILE *jitdump;
+static size_t perf_marker_size;
+static void *perf_marker = MAP_FAILED;
+static uint64_t jitdump_code_index;
+
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+static uint32_t get_e_machine(void)
+{
+    Elf64_Ehdr elf_header;
+    FILE *exe;
+    size_t n;
+
+    QEMU_BUILD_BUG_ON(offsetof(Elf32_Ehdr, e_machine) !=
+                      offsetof(Elf64_Ehdr, e_machine));
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return EM_NONE;
+    }
+
+    n = fread(&elf_header, sizeof(elf_header), 1, exe);
+    fclose(exe);
+    if (n != 1) {
+        return EM_NONE;
+    }
+
+    return elf_header.e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+
+    if (!use_rt_clock) {
+        warn_report("CLOCK_MONOTONIC is not available, "
+                    "proceeding without jitdump");
+        return;
+    }
+
+    perf_init_lock();
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * "perf inject" will see that the mapped file name in the corresponding
+     * PERF_RECORD_MMAP or PERF_RECORD_MMAP2 event is of the form jit-%d.dump
+     * and will process it as a jitdump file.
+     */
+    perf_marker_size = qemu_real_host_page_size;
+    perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE, fileno(jitdump), 0);
+    if (perf_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header.magic = JITHEADER_MAGIC;
+    header.version = JITHEADER_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pad1 = 0;
+    header.pid = getpid();
+    header.timestamp = get_clock();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap) {
+        qemu_mutex_lock(&perf_lock);
+        fprintf(perfmap, "%"PRIxPTR" %zx tcg-prologue-buffer\n",
+                (uintptr_t)start, size);
+        qemu_mutex_unlock(&perf_lock);
+    }
+}
+
+static void write_jr_code_load(const void *start, size_t host_size,
+                               const char *name)
+{
+    struct jr_code_load rec;
+    size_t len = strlen(name);
+
+    rec.p.id = JIT_CODE_LOAD;
+    rec.p.total_size = sizeof(rec) + len + 1 + host_size;
+    rec.p.timestamp = get_clock();
+    rec.pid = getpid();
+    rec.tid = qemu_get_thread_id();
+    rec.vma = (uintptr_t)start;
+    rec.code_addr = (uintptr_t)start;
+    rec.code_size = host_size;
+    rec.code_index = jitdump_code_index++;
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+    fwrite(name, len + 1, 1, jitdump);
+    fwrite(start, host_size, 1, jitdump);
+}
+
+void perf_report_code(TranslationBlock *tb, const void *start)
+{
+    char *name;
+
+    if (likely(!perfmap && !jitdump)) {
+        return;
+    }
+
+    name = perf_tb_name(tb);
+    qemu_mutex_lock(&perf_lock);
+    if (perfmap) {
+        fprintf(perfmap, "%"PRIxPTR" %zx %s\n",
+                (uintptr_t)start, tb->tc.size, name);
+    }
+    if (jitdump) {
+        write_jr_code_load(start, tb->tc.size, name);
+    }
+    qemu_mutex_unlock(&perf_lock);
+    g_free(name);
+}
+
+void perf_exit(void)
+{
+    if (!perf_lock_initialized) {
+        return;
+    }
+
+    qemu_mutex_lock(&perf_lock);
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+
+    if (perf_marker != MAP_FAILED) {
+        munmap(perf_marker, perf_marker_size);
+        perf_marker = MAP_FAILED;
+    }
+
+    if (jitdump) {
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+    qemu_mutex_unlock(&perf_lock);
+}
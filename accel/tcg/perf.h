@@ -0,0 +1,43 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_PERF_H
+#define ACCEL_TCG_PERF_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_POSIX
+/* Start writing perf-<pid>.map. */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump. */
+void perf_enable_jitdump(void);
+
+/*
+ * Load a guest symbol map ("ADDRESS [TYPE] NAME" per line, as printed by
+ * nm), so that TBs can be named after the guest function they belong to.
+ */
+bool perf_load_symbols(const char *filename, Error **errp);
+
+/* Add information about TCG prologue to profiler maps. */
+void perf_report_prologue(const void *start, size_t size);
+
+/* Add information about JITted guest code to profiler maps. */
+void perf_report_code(TranslationBlock *tb, const void *start);
+
+/* Stop writing perf-<pid>.map and jit-<pid>.dump. */
+void perf_exit(void);
+#else
+static inline void perf_report_prologue(const void *start, size_t size)
+{
+}
+
+static inline void perf_report_code(TranslationBlock *tb, const void *start)
+{
+}
+#endif
+
+#endif /* ACCEL_TCG_PERF_H */
@@ -61,6 +61,8 @@
  * 0: enum plugin_gen_from
  * 1: enum plugin_gen_cb
  * 2: set to 1 for mem callback that is a write, 0 otherwise.
+ * 3: for PLUGIN_GEN_CB_MEM, the temp holding the accessed address.
+ * 4: for PLUGIN_GEN_CB_MEM, the memory info.
  */
 
 enum plugin_gen_from {
@@ -92,6 +94,21 @@ void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 void *userdata)
 { }
 
+/*
+ * Memory callback with an address filter, where the filter could not be
+ * tested inline; see gen_mem_range_cb().
+ */
+void HELPER(plugin_vcpu_mem_range_cb)(unsigned int vcpu_index,
+                                      qemu_plugin_meminfo_t info,
+                                      uint64_t vaddr, void *data)
+{
+    struct qemu_plugin_dyn_cb *cb = data;
+
+    if (qemu_plugin_dyn_cb_in_range(cb, vaddr)) {
+        cb->f.vcpu_mem(vcpu_index, info, vaddr, cb->userp);
+    }
+}
+
 static void do_gen_mem_cb(TCGv vaddr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_new_i32();
@@ -125,20 +142,11 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Inline ops and conditional callbacks are generated in place when they
+ * are injected, see inject_inline_cb(), so their placeholder is empty.
  */
 static void gen_empty_inline_cb(void)
 {
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -160,14 +168,15 @@ static void gen_empty_mem_helper(void)
     tcg_temp_free_ptr(ptr);
 }
 
-static void gen_plugin_cb_start(enum plugin_gen_from from,
-                                enum plugin_gen_cb type, unsigned wr)
+static TCGOp *gen_plugin_cb_start(enum plugin_gen_from from,
+                                  enum plugin_gen_cb type, unsigned wr)
 {
     TCGOp *op;
 
     tcg_gen_plugin_cb_start(from, type, wr);
     op = tcg_last_op();
     QSIMPLEQ_INSERT_TAIL(&tcg_ctx->plugin_ops, op, plugin_link);
+    return op;
 }
 
 static void gen_wrapped(enum plugin_gen_from from,
@@ -212,8 +221,15 @@ static void gen_mem_wrapped(enum plugin_gen_cb type,
                             uint32_t info, bool is_mem)
 {
     int wr = !!(info & TRACE_MEM_ST);
+    TCGOp *op;
 
-    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, type, wr);
+    op = gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, type, wr);
+#if TARGET_LONG_BITS == 32
+    op->args[3] = tcgv_i32_arg(addr);
+#else
+    op->args[3] = tcgv_i64_arg(addr);
+#endif
+    op->args[4] = info;
     if (is_mem) {
         f->mem_fn(addr, info);
     } else {
@@ -226,11 +242,15 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
 {
     union mem_gen_fn fn;
 
+    /*
+     * Inline ops come first: they read @addr, which does not survive the
+     * branches that filtered callbacks may insert after their placeholder.
+     */
+    fn.inline_fn = gen_empty_inline_cb;
+    gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, addr, info, false);
+
     fn.mem_fn = gen_empty_mem_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_MEM, &fn, addr, info, true);
-
-    fn.inline_fn = gen_empty_inline_cb;
-    gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -330,19 +350,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -356,21 +363,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -443,25 +435,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -547,16 +520,411 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+/*
+ * Compute the address of the vCPU's slot in @entry. The scoreboard data
+ * may move when vCPUs are added, so it is loaded at run-time.
+ */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry)
+{
+    struct qemu_plugin_scoreboard *score = entry.score;
+    TCGv_ptr data = tcg_const_ptr(&score->data);
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_ptr offset = tcg_temp_new_ptr();
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+
+    tcg_gen_ld_ptr(ptr, data, 0);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, score->element_size);
+    tcg_gen_ext_i32_ptr(offset, cpu_index);
+    tcg_gen_add_ptr(ptr, ptr, offset);
+
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_ptr(offset);
+    tcg_temp_free_ptr(data);
+    return ptr;
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
+{
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
+    TCGv_ptr ptr;
+    TCGv_i64 val;
+
+    if (entry.score) {
+        ptr = gen_plugin_u64_ptr(entry);
+    } else {
+        ptr = tcg_const_ptr(cb->userp);
+    }
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_new_i64();
+        tcg_gen_ld_i64(val, ptr, entry.offset);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, entry.offset);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr,
+                       entry.offset);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * As in copy_call(), make the call just emitted to @empty_func, one of
+ * the empty helpers, call the plugin's @func instead.
+ */
+static void redirect_last_call(void *empty_func, void *func)
+{
+    TCGOp *op = QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    int i;
+
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    for (i = 0; i < MAX_OPC_PARAM_ARGS; i++) {
+        if ((uintptr_t)op->args[i] == (uintptr_t)empty_func) {
+            op->args[i] = (uintptr_t)func;
+            return;
+        }
+    }
+    g_assert_not_reached();
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER are handled at registration */
+        g_assert_not_reached();
+    }
+}
+
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry);
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_i32 cpu_index;
+    TCGv_ptr udata;
+
+    tcg_gen_ld_i64(val, ptr, cb->cond.entry.offset);
+    tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+
+    cpu_index = tcg_temp_new_i32();
+    udata = tcg_const_ptr(cb->userp);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+    redirect_last_call(HELPER(plugin_vcpu_udata_cb), cb->f.vcpu_udata);
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(cpu_index);
+
+    gen_set_label(skip);
+}
+
+/*
+ * Append the address of the access, which is in @addr, and the tag to
+ * the vCPU's log. The index wraps around instead of being tested, so
+ * that no branch is needed after the guest's access.
+ */
+static void gen_mem_log(const struct qemu_plugin_dyn_cb *cb, TCGTemp *addr)
+{
+    qemu_plugin_u64 count = cb->log.count;
+    TCGv_ptr slot = gen_plugin_u64_ptr(count);
+    TCGv_ptr rec = tcg_temp_new_ptr();
+    TCGv_i64 n = tcg_temp_new_i64();
+    TCGv_i64 idx = tcg_temp_new_i64();
+    TCGv_i64 vaddr = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(n, slot, count.offset);
+    tcg_gen_andi_i64(idx, n, cb->log.mask);
+    tcg_gen_addi_i64(n, n, 1);
+    tcg_gen_st_i64(n, slot, count.offset);
+
+    tcg_gen_shli_i64(idx, idx, ctz32(sizeof(qemu_plugin_mem_record)));
+    tcg_gen_trunc_i64_ptr(rec, idx);
+    tcg_gen_add_ptr(rec, rec, slot);
+#if TARGET_LONG_BITS == 32
+    tcg_gen_extu_i32_i64(vaddr, temp_tcgv_i32(addr));
+#else
+    tcg_gen_mov_i64(vaddr, temp_tcgv_i64(addr));
+#endif
+    tcg_gen_st_i64(vaddr, rec,
+                   cb->log.offset + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->log.tag), rec,
+                   cb->log.offset + offsetof(qemu_plugin_mem_record, tag));
+
+    tcg_temp_free_i64(vaddr);
+    tcg_temp_free_i64(idx);
+    tcg_temp_free_i64(n);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(slot);
+}
+
+/*
+ * Unlike the other callbacks, which are copied from the ops of the
+ * empty placeholder, inline ops are generated directly: they can need
+ * branches and more temps than a template could describe. The ops are
+ * emitted before @begin_op, so that removing the placeholder leaves them.
+ */
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    int i;
+
+    if (cbs) {
+        tcg_ctx->emit_before_op = begin_op;
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (!ok(begin_op, cb)) {
+                continue;
+            }
+            switch (cb->type) {
+            case PLUGIN_CB_INLINE:
+                gen_inline_op(cb);
+                break;
+            case PLUGIN_CB_COND:
+                gen_cond_cb(cb);
+                break;
+            case PLUGIN_CB_LOG:
+                /* only registered on memory accesses */
+                gen_mem_log(cb, arg_temp(begin_op->args[3]));
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+    rm_ops(begin_op);
+}
+
+/*
+ * Find the address of the access of a PLUGIN_GEN_CB_MEM placeholder if
+ * it is a translation-time constant, i.e. the address temp was last set,
+ * possibly through a chain of moves, from a constant in this TB.
+ */
+static bool plugin_gen_static_addr(const TCGOp *begin_op, uint64_t *vaddr)
+{
+#if TCG_TARGET_REG_BITS == 32 && TARGET_LONG_BITS == 64
+    /* the address is split in two temps, do not bother */
+    return false;
+#else
+    TCGTemp *ts = arg_temp(begin_op->args[3]);
+    TCGOp *op;
+    int i;
+
+    for (op = QTAILQ_PREV(begin_op, link); op; op = QTAILQ_PREV(op, link)) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+        int nb_oargs;
+
+        if (ts->kind == TEMP_CONST) {
+            break;
+        }
+        if (op->opc == INDEX_op_set_label) {
+            /* other definitions may reach the access */
+            return false;
+        }
+        nb_oargs = op->opc == INDEX_op_call ? TCGOP_CALLO(op) : def->nb_oargs;
+        for (i = 0; i < nb_oargs; i++) {
+            if (arg_temp(op->args[i]) == ts) {
+                break;
+            }
+        }
+        if (i == nb_oargs) {
+            continue;
+        }
+        if (op->opc != INDEX_op_mov_i32 && op->opc != INDEX_op_mov_i64) {
+            return false;
+        }
+        ts = arg_temp(op->args[1]);
+    }
+    if (ts->kind != TEMP_CONST) {
+        return false;
+    }
+    *vaddr = (target_ulong)ts->val;
+    return true;
+#endif
+}
+
+/*
+ * A conditional branch ends a basic block in TCG, and normal temps do
+ * not survive it. Check that no normal temp is live across @op, i.e.
+ * read from @op onwards before being written, up to the end of the
+ * basic block, so that a branch can be inserted before @op.
+ */
+static bool plugin_gen_can_branch_before(TCGOp *op)
+{
+    TCGTempSet written;
+    int i;
+
+    memset(&written, 0, sizeof(written));
+    for (; op; op = QTAILQ_NEXT(op, link)) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+        int nb_oargs, nb_iargs;
+
+        if (op->opc == INDEX_op_call) {
+            nb_oargs = TCGOP_CALLO(op);
+            nb_iargs = TCGOP_CALLI(op);
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+        }
+        for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+
+            if (ts && ts->kind == TEMP_NORMAL &&
+                !test_bit(temp_idx(ts), written.l)) {
+                return false;
+            }
+        }
+        if (op->opc == INDEX_op_set_label || (def->flags & TCG_OPF_BB_END)) {
+            return true;
+        }
+        for (i = 0; i < nb_oargs; i++) {
+            set_bit(temp_idx(arg_temp(op->args[i])), written.l);
+        }
+    }
+    return true;
+}
+
+/* Callbacks that can be copied from the placeholder */
+static bool op_mem_static(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
+{
+    uint64_t vaddr;
+
+    if (!op_rw(op, cb)) {
+        return false;
+    }
+    if (!qemu_plugin_dyn_cb_filtered(cb)) {
+        return true;
+    }
+    /* a constant address is filtered now, at translation time */
+    return plugin_gen_static_addr(op, &vaddr) &&
+           qemu_plugin_dyn_cb_in_range(cb, vaddr);
+}
+
+/*
+ * Generate a callback whose address filter is tested inline, branching
+ * over the call. If a branch cannot be inserted here, fall back to
+ * testing the filter in a helper.
+ */
+static void gen_mem_range_cb(const struct qemu_plugin_dyn_cb *cb,
+                             TCGv_i64 vaddr, uint32_t info, bool can_branch)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_i32 meminfo = tcg_const_i32(info);
+    TCGLabel *skip = NULL;
+    TCGv_ptr udata;
+
+    if (can_branch) {
+        TCGv_i64 offset = tcg_temp_new_i64();
+
+        skip = gen_new_label();
+        tcg_gen_subi_i64(offset, vaddr, cb->range.start);
+        tcg_gen_brcondi_i64(TCG_COND_GTU, offset,
+                            cb->range.last - cb->range.start, skip);
+        tcg_temp_free_i64(offset);
+        udata = tcg_const_ptr(cb->userp);
+    } else {
+        /* the helper gets a copy of @cb, which must outlive this TB */
+        GArray *arr = g_array_sized_new(false, false,
+                                        sizeof(struct qemu_plugin_dyn_cb), 1);
+
+        g_array_append_vals(arr, cb, 1);
+        qemu_plugin_add_dyn_cb_arr(arr);
+        udata = tcg_const_ptr(arr->data);
+    }
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    if (can_branch) {
+        gen_helper_plugin_vcpu_mem_cb(cpu_index, meminfo, vaddr, udata);
+        redirect_last_call(HELPER(plugin_vcpu_mem_cb), cb->f.vcpu_mem);
+    } else {
+        gen_helper_plugin_vcpu_mem_range_cb(cpu_index, meminfo, vaddr, udata);
+    }
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(meminfo);
+    tcg_temp_free_i32(cpu_index);
+
+    if (skip) {
+        gen_set_label(skip);
+    }
 }
 
 static void
 inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
 {
-    inject_cb_type(cbs, begin_op, append_mem_cb, op_rw);
+    TCGTemp *addr = arg_temp(begin_op->args[3]);
+    uint32_t info = begin_op->args[4];
+    int w = begin_op->args[2];
+    TCGv_i64 vaddr = NULL;
+    TCGOp *end_op, *next_op;
+    bool can_branch = false;
+    uint64_t static_vaddr;
+    bool is_static;
+    int i;
+
+    end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(end_op);
+    next_op = QTAILQ_NEXT(end_op, link);
+    /* begin_op is freed, and may be reused, once the callbacks are copied */
+    is_static = plugin_gen_static_addr(begin_op, &static_vaddr);
+
+    /* unfiltered callbacks and constant addresses are copied as usual */
+    inject_cb_type(cbs, begin_op, append_mem_cb, op_mem_static);
+
+    /*
+     * Callbacks with address filters come after them, so that the copied
+     * ops do not read the guest's address temp across our branches.
+     */
+    for (i = 0; cbs && i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (!(cb->rw & (w + 1)) || !qemu_plugin_dyn_cb_filtered(cb) ||
+            is_static) {
+            continue;
+        }
+        tcg_ctx->emit_before_op = next_op;
+        if (vaddr == NULL) {
+            can_branch = plugin_gen_can_branch_before(next_op);
+            /* the address is read after our branches, keep it in a local */
+            vaddr = can_branch ? tcg_temp_local_new_i64() : tcg_temp_new_i64();
+#if TARGET_LONG_BITS == 32
+            tcg_gen_extu_i32_i64(vaddr, temp_tcgv_i32(addr));
+#else
+            tcg_gen_mov_i64(vaddr, temp_tcgv_i64(addr));
+#endif
+        }
+        gen_mem_range_cb(cb, vaddr, info, can_branch);
+        tcg_ctx->emit_before_op = NULL;
+    }
+    if (vaddr) {
+        tcg_temp_free_i64(vaddr);
+    }
 }
 
 /* we could change the ops in place, but we can reuse more code by copying */
@@ -35,6 +35,9 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_pretranslate_count;
+    unsigned tb_followed_branch_count;
+    unsigned tb_idle_park_count;
 };
 
 extern TBContext tb_ctx;
@@ -0,0 +1,142 @@
+/*
+ * Per-TB execution profiling
+ *
+ * Profiles are keyed by guest pc/cs_base/flags rather than by TB, so that
+ * they survive tb_flush() and accumulate across retranslations.  They are
+ * never freed: the generated code of every live TB points to its profile.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/xxhash.h"
+#include "exec/exec-all.h"
+#include "internal.h"
+#ifndef CONFIG_USER_ONLY
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "sysemu/tcg.h"
+#endif
+
+bool tb_profile_enabled;
+
+static QemuMutex tb_profile_lock;
+static GHashTable *tb_profiles;
+
+static guint tb_profile_hash(gconstpointer p)
+{
+    const TBProfile *prof = p;
+
+    return qemu_xxhash5(prof->pc, prof->cs_base, prof->flags);
+}
+
+static gboolean tb_profile_equal(gconstpointer a, gconstpointer b)
+{
+    const TBProfile *pa = a, *pb = b;
+
+    return pa->pc == pb->pc && pa->cs_base == pb->cs_base &&
+           pa->flags == pb->flags;
+}
+
+void tb_profile_init(void)
+{
+    qemu_mutex_init(&tb_profile_lock);
+    tb_profiles = g_hash_table_new(tb_profile_hash, tb_profile_equal);
+    tb_profile_enabled = true;
+}
+
+TBProfile *tb_profile_get(const TranslationBlock *tb)
+{
+    TBProfile key = {
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+    };
+    TBProfile *prof;
+
+    qemu_mutex_lock(&tb_profile_lock);
+    prof = g_hash_table_lookup(tb_profiles, &key);
+    if (prof == NULL) {
+        prof = g_memdup(&key, sizeof(key));
+        g_hash_table_add(tb_profiles, prof);
+    }
+    qemu_mutex_unlock(&tb_profile_lock);
+    return prof;
+}
+
+void tb_profile_translated(const TranslationBlock *tb, int64_t ns)
+{
+    TBProfile *prof = tb->prof;
+
+    qemu_mutex_lock(&tb_profile_lock);
+    prof->translations++;
+    prof->translate_ns += ns;
+    prof->host_size = tb->tc.size;
+    prof->guest_size = tb->size;
+    qemu_mutex_unlock(&tb_profile_lock);
+}
+
+#ifndef CONFIG_USER_ONLY
+
+static gint tb_profile_cmp_exec(gconstpointer a, gconstpointer b)
+{
+    const TBProfile *pa = *(const TBProfile **)a;
+    const TBProfile *pb = *(const TBProfile **)b;
+
+    return pa->exec_count < pb->exec_count ? 1 :
+           pa->exec_count > pb->exec_count ? -1 : 0;
+}
+
+TbProfileInfoList *qmp_x_query_tb_profile(bool has_max, int64_t max,
+                                          Error **errp)
+{
+    TbProfileInfoList *head = NULL, **tail = &head;
+    GHashTableIter iter;
+    GPtrArray *sorted;
+    TBProfile *prof;
+    guint i;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return NULL;
+    }
+    if (!tb_profile_enabled) {
+        error_setg(errp, "TB profiling is not enabled, "
+                   "use -accel tcg,tb-profile=on");
+        return NULL;
+    }
+    if (!has_max) {
+        max = 10;
+    }
+
+    qemu_mutex_lock(&tb_profile_lock);
+    sorted = g_ptr_array_sized_new(g_hash_table_size(tb_profiles));
+    g_hash_table_iter_init(&iter, tb_profiles);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&prof, NULL)) {
+        g_ptr_array_add(sorted, prof);
+    }
+    g_ptr_array_sort(sorted, tb_profile_cmp_exec);
+
+    for (i = 0; i < sorted->len && i < max; i++) {
+        TbProfileInfo *info = g_new0(TbProfileInfo, 1);
+
+        prof = g_ptr_array_index(sorted, i);
+        info->pc = prof->pc;
+        info->flags = prof->flags;
+        info->exec_count = prof->exec_count;
+        info->chain_misses = prof->chain_misses;
+        info->requested_exits = prof->requested_exits;
+        info->translations = prof->translations;
+        info->translate_ns = prof->translate_ns;
+        info->host_size = prof->host_size;
+        info->guest_size = prof->guest_size;
+        QAPI_LIST_APPEND(tail, info);
+    }
+    qemu_mutex_unlock(&tb_profile_lock);
+
+    g_ptr_array_free(sorted, true);
+    return head;
+}
+
+#endif /* !CONFIG_USER_ONLY */
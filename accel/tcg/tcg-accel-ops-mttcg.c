@@ -30,11 +30,15 @@
 #include "qemu/main-loop.h"
 #include "qemu/notify.h"
 #include "qemu/guest-random.h"
+#include "sysemu/cpu-timers.h"
+#include "sysemu/runstate.h"
 #include "exec/exec-all.h"
 #include "hw/boards.h"
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
+#include "tcg-accel-ops-icount.h"
+#include "internal.h"
 
 typedef struct MttcgForceRcuNotifier {
     Notifier notifier;
@@ -113,6 +117,10 @@ static void *mttcg_cpu_thread_fn(void *arg)
                 qemu_mutex_unlock_iothread();
                 cpu_exec_step_atomic(cpu);
                 qemu_mutex_lock_iothread();
+                break;
+            case EXCP_IDLE:
+                tcg_cpu_idle_wait(cpu);
+                break;
             default:
                 /* Ignore everything else? */
                 break;
@@ -130,6 +138,344 @@ static void *mttcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+/*
+ * MTTCG with icount.
+ *
+ * The vCPUs run in rounds.  In the parallel phase of a round each vCPU
+ * thread executes at most its instruction budget without the BQL.  A vCPU
+ * that reaches an I/O instruction or a guest atomic (CF_QUANTUM makes the
+ * translator emit helper_quantum_serial in front of them) stops there with
+ * EXCP_QUANTUM.  Once every vCPU has stopped, the serial phase gives each
+ * waiting vCPU a turn, in cpu_index order, to execute up to and including
+ * that instruction while all the others are stopped.  When no vCPU has
+ * budget left, the virtual clock is up to date: timers are run and a new
+ * budget is handed out, up to the next timer deadline.
+ *
+ * Since every vCPU stops at a point that only depends on its own
+ * instruction stream, and everything observable by other vCPUs or
+ * devices (except plain memory accesses) happens in the serial phase in
+ * a fixed order, a run is reproducible as long as the guest communicates
+ * through atomics and devices only.
+ *
+ * All of the state below is protected by the BQL.
+ */
+
+uint32_t tcg_icount_quantum;
+
+typedef enum {
+    QUANTUM_PARALLEL,
+    QUANTUM_SERIAL,
+} QuantumPhase;
+
+static QuantumPhase quantum_phase;
+static unsigned quantum_round;
+static unsigned quantum_arrived;
+static unsigned quantum_threads;
+static CPUState *quantum_owner;
+static int64_t quantum_budget;
+static bool quantum_idle;
+
+static int64_t quantum_left(CPUState *cpu)
+{
+    return cpu_neg(cpu)->icount_decr.u16.low + cpu->icount_extra;
+}
+
+static void quantum_set_budget(CPUState *cpu, int64_t budget)
+{
+    int insns_left = MIN(0xffff, budget);
+
+    cpu->icount_budget = budget;
+    cpu_neg(cpu)->icount_decr.u16.low = insns_left;
+    cpu->icount_extra = budget - insns_left;
+}
+
+static bool quantum_cpu_idle(CPUState *cpu)
+{
+    return cpu->halted && !cpu_has_work(cpu);
+}
+
+static void quantum_wake_all(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->created) {
+            qemu_cond_broadcast(cpu->halt_cond);
+        }
+    }
+}
+
+/*
+ * All vCPUs are stopped and have used up their budget: run the expired
+ * timers and split the time until the next deadline between the vCPUs
+ * that can run.  Returns false if every vCPU is idle and no timer is
+ * pending, in which case only an external event can wake the guest.
+ */
+static bool quantum_end(void)
+{
+    int64_t deadline, budget;
+    unsigned running = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        quantum_set_budget(cpu, 0);
+        running += !quantum_cpu_idle(cpu);
+    }
+
+    if (!running) {
+        if (!runstate_is_running() || !icount_warp_idle()) {
+            quantum_idle = true;
+            return false;
+        }
+    }
+    icount_handle_deadline();
+
+    running = 0;
+    CPU_FOREACH(cpu) {
+        running += !quantum_cpu_idle(cpu);
+    }
+
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          QEMU_TIMER_ATTR_ALL);
+    if (deadline < 0 || deadline > INT32_MAX) {
+        deadline = INT32_MAX;
+    }
+    budget = icount_round(deadline) / MAX(running, 1);
+    quantum_budget = MIN(MAX(budget, 1), tcg_icount_quantum);
+
+    CPU_FOREACH(cpu) {
+        quantum_set_budget(cpu, quantum_budget);
+    }
+    return true;
+}
+
+static void quantum_start_parallel(void)
+{
+    bool more = false;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        more |= quantum_left(cpu) > 0 && !quantum_cpu_idle(cpu);
+    }
+    if (!more && !quantum_end()) {
+        return;
+    }
+
+    quantum_phase = QUANTUM_PARALLEL;
+    quantum_round++;
+    quantum_wake_all();
+}
+
+/*
+ * Hand the serial turn to the next waiting vCPU after @cpu, or start a
+ * new parallel phase if there is none.
+ */
+static void quantum_next_turn(CPUState *cpu)
+{
+    for (cpu = cpu ? CPU_NEXT(cpu) : first_cpu; cpu; cpu = CPU_NEXT(cpu)) {
+        if (cpu->quantum_wait) {
+            quantum_owner = cpu;
+            quantum_wake_all();
+            return;
+        }
+    }
+    quantum_owner = NULL;
+    quantum_start_parallel();
+}
+
+/* Called by the last vCPU to stop in the parallel phase. */
+static void quantum_end_parallel(void)
+{
+    quantum_arrived = 0;
+    quantum_phase = QUANTUM_SERIAL;
+    quantum_next_turn(NULL);
+}
+
+/*
+ * Wait for the VM to run.  Unlike qemu_wait_io_event, this does not also
+ * wait for a halted vCPU to get work: the other vCPUs may be waiting for
+ * this one to finish its quantum.
+ */
+static void quantum_wait_can_run(CPUState *cpu)
+{
+    qemu_wait_io_event_common(cpu);
+    while (!cpu_can_run(cpu) && !cpu->unplug) {
+        qemu_cond_wait_iothread(cpu->halt_cond);
+        qemu_wait_io_event_common(cpu);
+    }
+}
+
+/* Parallel phase: run until the budget is gone or a serial turn is needed. */
+static void quantum_run(CPUState *cpu)
+{
+    while (quantum_left(cpu) > 0 && !cpu->quantum_wait &&
+           !quantum_cpu_idle(cpu)) {
+        int r;
+
+        if (!cpu_can_run(cpu)) {
+            quantum_wait_can_run(cpu);
+            if (!cpu_can_run(cpu)) {
+                break;
+            }
+            continue;
+        }
+
+        qemu_mutex_unlock_iothread();
+        r = tcg_cpus_exec(cpu);
+        qemu_mutex_lock_iothread();
+        /*
+         * Account for the executed instructions now, as
+         * icount_process_data() does for rr: quantum_end() drops what
+         * is left of the budget of vCPUs that stopped early.
+         */
+        icount_update(cpu);
+        switch (r) {
+        case EXCP_DEBUG:
+            cpu_handle_guest_debug(cpu);
+            break;
+        case EXCP_QUANTUM:
+        case EXCP_ATOMIC:
+            cpu->quantum_wait = r;
+            break;
+        default:
+            break;
+        }
+
+        qatomic_mb_set(&cpu->exit_request, 0);
+        qemu_wait_io_event_common(cpu);
+    }
+}
+
+/*
+ * Serial phase: run the instruction that stopped the vCPU, with all other
+ * vCPUs stopped.  helper_quantum_serial clears quantum_wait and kicks the
+ * vCPU out once it is past the helper.
+ */
+static void quantum_serial_step(CPUState *cpu)
+{
+    while (cpu->quantum_wait && quantum_left(cpu) > 0 &&
+           !quantum_cpu_idle(cpu)) {
+        int r;
+
+        if (!cpu_can_run(cpu)) {
+            quantum_wait_can_run(cpu);
+            if (!cpu_can_run(cpu)) {
+                break;
+            }
+            continue;
+        }
+
+        cpu->quantum_turn = true;
+        qemu_mutex_unlock_iothread();
+        if (cpu->quantum_wait == EXCP_ATOMIC) {
+            cpu_exec_step_atomic(cpu);
+            cpu->quantum_wait = 0;
+            r = 0;
+        } else {
+            r = tcg_cpus_exec(cpu);
+            if (r == EXCP_ATOMIC) {
+                cpu_exec_step_atomic(cpu);
+                cpu->quantum_wait = 0;
+            }
+        }
+        qemu_mutex_lock_iothread();
+        cpu->quantum_turn = false;
+        icount_update(cpu);
+
+        if (r == EXCP_DEBUG) {
+            cpu_handle_guest_debug(cpu);
+        }
+        qatomic_mb_set(&cpu->exit_request, 0);
+        qemu_wait_io_event_common(cpu);
+    }
+    cpu->quantum_wait = 0;
+}
+
+static void *mttcg_icount_cpu_thread_fn(void *arg)
+{
+    MttcgForceRcuNotifier force_rcu;
+    CPUState *cpu = arg;
+    unsigned round;
+    bool arrived;
+
+    assert(tcg_enabled());
+    g_assert(icount_quanta_enabled());
+
+    rcu_register_thread();
+    force_rcu.notifier.notify = mttcg_force_rcu;
+    force_rcu.cpu = cpu;
+    rcu_add_force_rcu_notifier(&force_rcu.notifier);
+    tcg_register_thread();
+
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->can_do_io = 1;
+    current_cpu = cpu;
+    cpu_thread_signal_created(cpu);
+    qemu_guest_random_seed_thread_part2(cpu->random_seed);
+
+    /*
+     * quantum_threads already counts this vCPU, so no round ends before
+     * it takes part; wait for the VM to start so that all vCPUs do.
+     */
+    quantum_wait_can_run(cpu);
+
+    /* When joining during a serial phase, sit it out until the next round. */
+    round = quantum_round;
+    arrived = quantum_phase == QUANTUM_SERIAL;
+
+    while (!cpu->unplug || cpu_can_run(cpu)) {
+        if (!arrived) {
+            quantum_run(cpu);
+            arrived = true;
+            if (++quantum_arrived == quantum_threads) {
+                quantum_end_parallel();
+            }
+        }
+
+        qemu_wait_io_event_common(cpu);
+        if (round != quantum_round) {
+            round = quantum_round;
+            arrived = false;
+        } else if (quantum_owner == cpu) {
+            quantum_serial_step(cpu);
+            quantum_next_turn(cpu);
+        } else if (cpu->unplug && !cpu_can_run(cpu)) {
+            break;
+        } else {
+            qemu_cond_wait_iothread(cpu->halt_cond);
+            /* An interrupt or a new timer may have ended the idle period. */
+            if (quantum_idle) {
+                quantum_idle = false;
+                quantum_start_parallel();
+            }
+        }
+    }
+
+    icount_update(cpu);
+    quantum_set_budget(cpu, 0);
+    cpu->quantum_wait = 0;
+    quantum_threads--;
+    if (quantum_phase == QUANTUM_PARALLEL) {
+        if (arrived && round == quantum_round) {
+            quantum_arrived--;
+        }
+        if (quantum_threads && quantum_arrived == quantum_threads) {
+            quantum_end_parallel();
+        }
+    } else if (quantum_owner == cpu) {
+        quantum_next_turn(cpu);
+    }
+
+    tcg_cpus_destroy(cpu);
+    qemu_mutex_unlock_iothread();
+    rcu_remove_force_rcu_notifier(&force_rcu.notifier);
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void mttcg_kick_vcpu_thread(CPUState *cpu)
 {
     cpu_exit(cpu);
@@ -150,8 +496,15 @@ void mttcg_start_vcpu_thread(CPUState *cpu)
     snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
              cpu->cpu_index);
 
-    qemu_thread_create(cpu->thread, thread_name, mttcg_cpu_thread_fn,
-                       cpu, QEMU_THREAD_JOINABLE);
+    if (icount_quanta_enabled()) {
+        quantum_threads++;
+        qemu_thread_create(cpu->thread, thread_name,
+                           mttcg_icount_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(cpu->thread, thread_name, mttcg_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+    }
 
 #ifdef _WIN32
     cpu->hThread = qemu_thread_get_handle(cpu->thread);
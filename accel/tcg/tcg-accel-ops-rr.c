@@ -236,6 +236,12 @@ static void *rr_cpu_thread_fn(void *arg)
                     cpu_exec_step_atomic(cpu);
                     qemu_mutex_lock_iothread();
                     break;
+                } else if (r == EXCP_IDLE && !CPU_NEXT(first_cpu)) {
+                    /*
+                     * With several vCPUs an idle one just yields to the
+                     * next; the thread sleeps once all of them are halted.
+                     */
+                    tcg_cpu_idle_wait(cpu);
                 }
             } else if (cpu->stop) {
                 if (cpu->unplug) {
@@ -31,9 +31,11 @@
 #include "sysemu/replay.h"
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
+#include "qemu/timer.h"
 #include "exec/exec-all.h"
 
 #include "tcg-accel-ops.h"
+#include "tb-context.h"
 #include "tcg-accel-ops-mttcg.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
@@ -45,6 +47,7 @@ void tcg_cpu_init_cflags(CPUState *cpu, bool parallel)
     uint32_t cflags = cpu->cluster_index << CF_CLUSTER_SHIFT;
     cflags |= parallel ? CF_PARALLEL : 0;
     cflags |= icount_enabled() ? CF_USE_ICOUNT : 0;
+    cflags |= parallel && icount_enabled() ? CF_QUANTUM : 0;
     cpu->tcg_cflags = cflags;
 }
 
@@ -73,6 +76,35 @@ int tcg_cpus_exec(CPUState *cpu)
     return ret;
 }
 
+/*
+ * Longest time a vCPU that left an idle loop with EXCP_IDLE is parked.
+ * Interrupts and timers kick it earlier, but a store to the polled
+ * location by another vCPU, or a device register that changes without
+ * raising an interrupt, is only seen when the wait times out.
+ */
+#define TCG_IDLE_WAIT_MS 1
+
+/*
+ * Park @cpu after it returned EXCP_IDLE, until it is kicked, the wait
+ * times out, or the next virtual clock timer is due.  Called with the
+ * BQL held.
+ */
+void tcg_cpu_idle_wait(CPUState *cpu)
+{
+    int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                                  QEMU_TIMER_ATTR_ALL);
+
+    if (deadline >= 0 && deadline < TCG_IDLE_WAIT_MS * SCALE_MS) {
+        return;
+    }
+    if (cpu->stop || !cpu_work_list_empty(cpu) || cpu_has_work(cpu) ||
+        qatomic_read(&cpu->exit_request)) {
+        return;
+    }
+    qatomic_inc(&tb_ctx.tb_idle_park_count);
+    qemu_cond_timedwait_iothread(cpu->halt_cond, TCG_IDLE_WAIT_MS);
+}
+
 /* mask must never be zero, except for A20 change call */
 void tcg_handle_interrupt(CPUState *cpu, int mask)
 {
@@ -93,7 +125,13 @@ void tcg_handle_interrupt(CPUState *cpu, int mask)
 
 static void tcg_accel_ops_init(AccelOpsClass *ops)
 {
-    if (qemu_tcg_mttcg_enabled()) {
+    if (qemu_tcg_mttcg_enabled() && icount_enabled()) {
+        ops->create_vcpu_thread = mttcg_start_vcpu_thread;
+        ops->kick_vcpu_thread = mttcg_kick_vcpu_thread;
+        ops->handle_interrupt = icount_handle_interrupt;
+        ops->get_virtual_clock = icount_get;
+        ops->get_elapsed_ticks = icount_get;
+    } else if (qemu_tcg_mttcg_enabled()) {
         ops->create_vcpu_thread = mttcg_start_vcpu_thread;
         ops->kick_vcpu_thread = mttcg_kick_vcpu_thread;
         ops->handle_interrupt = tcg_handle_interrupt;
@@ -18,5 +18,6 @@ void tcg_cpus_destroy(CPUState *cpu);
 int tcg_cpus_exec(CPUState *cpu);
 void tcg_handle_interrupt(CPUState *cpu, int mask);
 void tcg_cpu_init_cflags(CPUState *cpu, bool parallel);
+void tcg_cpu_idle_wait(CPUState *cpu);
 
 #endif /* TCG_CPUS_H */
@@ -35,15 +35,25 @@
 #include "qemu/units.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
+#include "sysemu/replay.h"
 #endif
 #include "internal.h"
+#include "perf.h"
 
 struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
+    bool pretranslate;
+    bool tb_profile;
+    bool idle_detect;
+    bool perfmap;
+    bool jitdump;
+    char *perf_symbols;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t follow_branches;
+    uint32_t icount_quantum;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +109,7 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->icount_quantum = 10000;
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -121,6 +132,37 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_pretranslate_enabled = s->pretranslate;
+    tb_follow_branches = s->follow_branches;
+    if (s->tb_profile) {
+        tb_profile_init();
+    }
+#ifndef CONFIG_USER_ONLY
+    tb_idle_detect = s->idle_detect && !icount_enabled();
+    use_icount_quanta = mttcg_enabled && icount_enabled();
+    tcg_icount_quantum = s->icount_quantum;
+    if (use_icount_quanta && replay_mode != REPLAY_MODE_NONE) {
+        error_report("Record/replay requires thread=single");
+        return -1;
+    }
+#endif
+
+#ifdef CONFIG_POSIX
+    if (s->perf_symbols) {
+        Error *local_err = NULL;
+
+        if (!perf_load_symbols(s->perf_symbols, &local_err)) {
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+    if (s->perfmap) {
+        perf_enable_perfmap();
+    }
+    if (s->jitdump) {
+        perf_enable_jitdump();
+    }
+#endif
 
     page_init();
     tb_htable_init();
@@ -151,8 +193,8 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     if (strcmp(value, "multi") == 0) {
         if (TCG_OVERSIZED_GUEST) {
             error_setg(errp, "No MTTCG when guest word size > hosts");
-        } else if (icount_enabled()) {
-            error_setg(errp, "No MTTCG when icount is enabled");
+        } else if (icount_enabled() == 2) {
+            error_setg(errp, "No MTTCG when icount shift is auto");
         } else {
 #ifndef TARGET_SUPPORTS_MTTCG
             warn_report("Guest not yet converted to MTTCG - "
@@ -196,6 +238,58 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_follow_branches(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->follow_branches;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_follow_branches(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->follow_branches = value;
+}
+
+static void tcg_get_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->icount_quantum;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "icount-quantum must be at least 1");
+        return;
+    }
+
+    s->icount_quantum = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -208,6 +302,82 @@ static void tcg_set_splitwx(Object *obj, bool value, Error **errp)
     s->splitwx_enabled = value;
 }
 
+static bool tcg_get_pretranslate(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->pretranslate;
+}
+
+static void tcg_set_pretranslate(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->pretranslate = value;
+}
+
+static bool tcg_get_tb_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_profile;
+}
+
+static void tcg_set_tb_profile(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_profile = value;
+}
+
+static bool tcg_get_idle_detect(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->idle_detect;
+}
+
+static void tcg_set_idle_detect(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->idle_detect = value;
+}
+
+#ifdef CONFIG_POSIX
+static bool tcg_get_perfmap(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->perfmap;
+}
+
+static void tcg_set_perfmap(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->perfmap = value;
+}
+
+static bool tcg_get_jitdump(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->jitdump;
+}
+
+static void tcg_set_jitdump(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->jitdump = value;
+}
+
+static char *tcg_get_perf_symbols(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return g_strdup(s->perf_symbols);
+}
+
+static void tcg_set_perf_symbols(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->perf_symbols);
+    s->perf_symbols = g_strdup(value);
+}
+#endif
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -225,10 +395,55 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "follow-branches", "int",
+        tcg_get_follow_branches, tcg_set_follow_branches,
+        NULL, NULL);
+    object_class_property_set_description(oc, "follow-branches",
+        "Max. number of direct branches translated through per TB");
+
+    object_class_property_add(oc, "icount-quantum", "int",
+        tcg_get_icount_quantum, tcg_set_icount_quantum,
+        NULL, NULL);
+    object_class_property_set_description(oc, "icount-quantum",
+        "Instructions each vCPU runs between synchronizations "
+        "with icount and thread=multi");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
         "Map jit pages into separate RW and RX regions");
+
+    object_class_property_add_bool(oc, "pretranslate",
+        tcg_get_pretranslate, tcg_set_pretranslate);
+    object_class_property_set_description(oc, "pretranslate",
+        "Translate direct branch targets ahead of time while idle");
+
+    object_class_property_add_bool(oc, "tb-profile",
+        tcg_get_tb_profile, tcg_set_tb_profile);
+    object_class_property_set_description(oc, "tb-profile",
+        "Count executions and exits of each translation block");
+
+    object_class_property_add_bool(oc, "idle-detect",
+        tcg_get_idle_detect, tcg_set_idle_detect);
+    object_class_property_set_description(oc, "idle-detect",
+        "Put vCPUs spinning in polling loops to sleep");
+
+#ifdef CONFIG_POSIX
+    object_class_property_add_bool(oc, "perfmap",
+        tcg_get_perfmap, tcg_set_perfmap);
+    object_class_property_set_description(oc, "perfmap",
+        "Write /tmp/perf-<pid>.map describing translated code");
+
+    object_class_property_add_bool(oc, "jitdump",
+        tcg_get_jitdump, tcg_set_jitdump);
+    object_class_property_set_description(oc, "jitdump",
+        "Write jit-<pid>.dump for use with 'perf inject -j'");
+
+    object_class_property_add_str(oc, "perf-symbols",
+        tcg_get_perf_symbols, tcg_set_perf_symbols);
+    object_class_property_set_description(oc, "perf-symbols",
+        "Guest symbol map used to name translated code");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
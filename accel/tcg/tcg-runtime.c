@@ -27,6 +27,7 @@
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
 #include "exec/exec-all.h"
+#include "exec/gdbstub.h"
 #include "disas/disas.h"
 #include "exec/log.h"
 #include "tcg/tcg.h"
@@ -148,3 +149,31 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(env_cpu(env), GETPC());
 }
+
+void HELPER(quantum_serial)(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+
+    if (!cpu->quantum_turn) {
+        cpu->exception_index = EXCP_QUANTUM;
+        cpu_loop_exit_restore(cpu, GETPC());
+    }
+    /* Done; end the turn at the end of this TB.  */
+    cpu->quantum_wait = 0;
+    cpu_exit(cpu);
+}
+
+void HELPER(gdb_bp_check)(CPUArchState *env, target_ulong pc)
+{
+    CPUState *cpu = env_cpu(env);
+
+    /*
+     * When the TB was entered by chaining, some targets have not yet
+     * stored the new pc: sync it for conditions and tracepoint frames.
+     */
+    cpu_restore_state(cpu, GETPC(), false);
+    if (gdb_breakpoint_hit(cpu, pc)) {
+        cpu->exception_index = EXCP_DEBUG;
+        cpu_loop_exit_restore(cpu, GETPC());
+    }
+}
@@ -27,6 +27,8 @@ DEF_HELPER_FLAGS_1(ctpop_i64, TCG_CALL_NO_RWG_SE, i64, i64)
 DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, cptr, env)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
+DEF_HELPER_FLAGS_1(quantum_serial, TCG_CALL_NO_WG, void, env)
+DEF_HELPER_FLAGS_2(gdb_bp_check, TCG_CALL_NO_WG, void, env, tl)
 
 #ifndef IN_HELPER_PROTO
 /*
@@ -60,6 +60,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "perf.h"
 
 /* #define DEBUG_TB_INVALIDATE */
 /* #define DEBUG_TB_FLUSH */
@@ -101,16 +102,13 @@
 #define assert_memory_lock() tcg_debug_assert(have_mmap_lock())
 #endif
 
-#define SMC_BITMAP_USE_THRESHOLD 10
-
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
 #ifdef CONFIG_SOFTMMU
-    /* in order to optimize self modifying code, we count the number
-       of lookups we do to a given page to use a bitmap */
+    /* bytes of the page covered by TBs, so that writes to data next to
+       code need not invalidate anything; built on the first write */
     unsigned long *code_bitmap;
-    unsigned int code_write_count;
 #else
     unsigned long flags;
     void *target_data;
@@ -913,7 +911,6 @@ static inline void invalidate_page_bitmap(PageDesc *p)
 #ifdef CONFIG_SOFTMMU
     g_free(p->code_bitmap);
     p->code_bitmap = NULL;
-    p->code_write_count = 0;
 #endif
 }
 
@@ -1246,31 +1243,53 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 }
 
 #ifdef CONFIG_SOFTMMU
+/* Mark the bytes of page @n of @tb in the page's code bitmap */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
     assert_page_locked(p);
     p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
 
     PAGE_FOR_EACH_TB(p, tb, n) {
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-             }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
+    }
+}
+
+/*
+ * Return true if any byte in [@start, @start + @len[ belongs to a TB.
+ * The range must not cross a page boundary.  Call with @p->lock held.
+ */
+static bool page_bitmap_overlaps(PageDesc *p, tb_page_addr_t start, int len)
+{
+    unsigned long nr = start & ~TARGET_PAGE_MASK;
+
+    if (!p->code_bitmap) {
+        build_page_bitmap(p);
     }
+    return find_next_bit(p->code_bitmap, nr + len, nr) < nr + len;
 }
 #endif
 
@@ -1294,7 +1313,12 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
     p->first_tb = (uintptr_t)tb | n;
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    /* keep an existing bitmap up to date rather than rebuilding it */
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
     if (p->flags & PAGE_WRITE) {
@@ -1411,6 +1435,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
+    int64_t tb_profile_start = 0;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1450,6 +1475,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->prof = NULL;
+    if (tb_profile_enabled) {
+        tb->prof = tb_profile_get(tb);
+        tb_profile_start = get_clock();
+    }
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1539,6 +1569,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    perf_report_code(tb, tb->tc.ptr);
+    if (tb->prof) {
+        tb_profile_translated(tb, get_clock() - tb_profile_start);
+    }
 
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
@@ -1829,7 +1863,7 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end)
 }
 
 #ifdef CONFIG_SOFTMMU
-/* len must be <= 8 and start must be a multiple of len.
+/* [start, start + len[ must not cross a page boundary.
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  *
@@ -1849,24 +1883,42 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
     }
 
     assert_page_locked(p);
-    if (!p->code_bitmap &&
-        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
-        build_page_bitmap(p);
+    /* with no TB left, the call below unprotects the page */
+    if (!p->first_tb || page_bitmap_overlaps(p, start, len)) {
+        tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
+                                              retaddr);
     }
-    if (p->code_bitmap) {
-        unsigned int nr;
-        unsigned long b;
+}
 
-        nr = start & ~TARGET_PAGE_MASK;
-        b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
-        }
+/*
+ * Return true if a write to [@start, @start + @len[ may modify translated
+ * code, i.e. if it needs to go through tb_invalidate_phys_page_fast().
+ * This only takes the lock of the page concerned, so that stores to data
+ * that shares a page with code do not pay for a page_collection.
+ * If no TB is left on the page, e.g. after tb_flush(), the page is
+ * unprotected so that further writes no longer take the slow path.
+ * The range must not cross a page boundary.
+ */
+bool tb_page_range_has_code(tb_page_addr_t start, int len)
+{
+    PageDesc *p;
+    bool ret;
+
+    p = page_find(start >> TARGET_PAGE_BITS);
+    if (!p) {
+        return false;
+    }
+
+    page_lock(p);
+    if (p->first_tb) {
+        ret = page_bitmap_overlaps(p, start, len);
     } else {
-    do_invalidate:
-        tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
-                                              retaddr);
+        invalidate_page_bitmap(p);
+        tlb_unprotect_code(start & TARGET_PAGE_MASK);
+        ret = false;
     }
+    page_unlock(p);
+    return ret;
 }
 #else
 /* Called with mmap_lock held. If pc is not 0 then it indicates the
@@ -2089,6 +2141,7 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t vtlb_hit, vtlb_miss, tlb_fill;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2125,11 +2178,21 @@ void dump_exec_info(void)
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %u\n",
                 qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    qemu_printf("TB pretranslated    %u\n",
+                qatomic_read(&tb_ctx.tb_pretranslate_count));
+    qemu_printf("TB followed jumps   %u\n",
+                qatomic_read(&tb_ctx.tb_followed_branch_count));
+    qemu_printf("TB idle parks       %u\n",
+                qatomic_read(&tb_ctx.tb_idle_park_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    tlb_victim_counts(&vtlb_hit, &vtlb_miss, &tlb_fill);
+    qemu_printf("TLB victim hits     %zu\n", vtlb_hit);
+    qemu_printf("TLB victim misses   %zu\n", vtlb_miss);
+    qemu_printf("TLB fills           %zu\n", tlb_fill);
     tcg_dump_info();
 }
 
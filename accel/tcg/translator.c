@@ -17,6 +17,8 @@
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
 #include "sysemu/replay.h"
+#include "internal.h"
+#include "tb-context.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -31,6 +33,116 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool tb_idle_detect;
+
+/*
+ * Check whether the ops generated so far for the current TB, from the
+ * first insn_start on, can be repeated without changing anything but the
+ * temporaries of a single iteration: there must be no guest or host
+ * stores, no helper calls, and no global that is read before it is
+ * written (i.e. no loop counter).  A global written after a branch may
+ * not be written on every iteration, so a later read of it counts as a
+ * read of the previous iteration's value.
+ */
+static bool translator_is_idle_loop(void)
+{
+    TCGTempSet written = { }, defined = { };
+    bool started, uncond;
+    TCGOp *op;
+    int i;
+
+    started = false;
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+        switch (op->opc) {
+        case INDEX_op_insn_start:
+            started = true;
+            continue;
+        case INDEX_op_call:
+        case INDEX_op_st8_i32:
+        case INDEX_op_st16_i32:
+        case INDEX_op_st_i32:
+        case INDEX_op_st8_i64:
+        case INDEX_op_st16_i64:
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i64:
+        case INDEX_op_st_vec:
+        case INDEX_op_qemu_st_i32:
+        case INDEX_op_qemu_st_i64:
+        case INDEX_op_qemu_st8_i32:
+            if (started) {
+                return false;
+            }
+            continue;
+        default:
+            break;
+        }
+        for (i = 0; started && i < def->nb_oargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+
+            if (ts->kind == TEMP_GLOBAL) {
+                set_bit(temp_idx(ts), written.l);
+            }
+        }
+    }
+
+    started = false;
+    uncond = true;
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+        if (op->opc == INDEX_op_insn_start) {
+            started = true;
+            continue;
+        }
+        if (!started) {
+            continue;
+        }
+        for (i = def->nb_oargs; i < def->nb_oargs + def->nb_iargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+            size_t idx = temp_idx(ts);
+
+            if (ts->kind == TEMP_GLOBAL && test_bit(idx, written.l)
+                && !test_bit(idx, defined.l)) {
+                return false;
+            }
+        }
+        for (i = 0; uncond && i < def->nb_oargs; i++) {
+            set_bit(temp_idx(arg_temp(op->args[i])), defined.l);
+        }
+        if (def->flags & TCG_OPF_BB_END) {
+            uncond = false;
+        }
+    }
+    return started;
+}
+
+/*
+ * translator_is_idle_loop() for the current insn, computed only once:
+ * the reset emitted by gen_idle_spins_reset() on one exit must not be
+ * seen as a store when the next exit of the same insn is checked.
+ */
+static bool translator_idle_body(DisasContextBase *db)
+{
+    if (db->idle_checked != db->num_insns) {
+        db->idle_checked = db->num_insns;
+        db->idle_body = translator_is_idle_loop();
+    }
+    return db->idle_body;
+}
+
+/* Clear cpu->idle_spins when a possible polling loop is left */
+static void gen_idle_spins_reset(void)
+{
+    TCGv_i32 zero = tcg_const_i32(0);
+
+    tcg_gen_st_i32(zero, cpu_env,
+                   offsetof(ArchCPU, parent_obj.idle_spins) -
+                   offsetof(ArchCPU, env));
+    tcg_temp_free_i32(zero);
+}
+
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
 {
     /* Suppress goto_tb if requested. */
@@ -38,8 +150,66 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
         return false;
     }
 
+    /*
+     * A TB that jumps back to its own start without side effects is a
+     * polling loop; leave it unchained so that helper_lookup_tb_ptr can
+     * count iterations and park the vCPU.  Its other exits may be
+     * chained, so they restart the count: otherwise the spins of
+     * separate runs of a short loop would add up.
+     */
+    if (tb_idle_detect && translator_idle_body(db)) {
+        if (dest == db->pc_first) {
+            db->idle_loop = true;
+            return false;
+        }
+        gen_idle_spins_reset();
+    }
+
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if (((db->pc_first ^ dest) & TARGET_PAGE_MASK) != 0) {
+        return false;
+    }
+
+    /* Remember the successor so that it can be translated ahead of time. */
+    if (tb_pretranslate_enabled && dest != db->pc_first) {
+        tb_pretranslate_note(tcg_ctx->cpu, db->tb, dest);
+    }
+    return true;
+}
+
+unsigned tb_follow_branches;
+
+bool translator_follow_branch(DisasContextBase *db, target_ulong dest)
+{
+    if (db->num_followed >= tb_follow_branches
+        || (tb_cflags(db->tb) & (CF_NO_GOTO_TB | CF_SINGLE_STEP))) {
+        return false;
+    }
+    if (dest < db->pc_next || ((db->pc_first ^ dest) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    /* Leave room for at least one insn at the destination.  */
+    if (db->num_insns >= db->max_insns || tcg_op_buf_full()) {
+        return false;
+    }
+
+    db->num_followed++;
+    qatomic_inc(&tb_ctx.tb_followed_branch_count);
+    return true;
+}
+
+/* Count executions of the TB with an inline increment, for "info tb-profile" */
+static void gen_tb_exec_count(const TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_const_ptr(&tb->prof->exec_count);
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, 0);
+
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
 }
 
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
@@ -55,7 +225,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
     db->max_insns = max_insns;
+    db->num_followed = 0;
     db->singlestep_enabled = cflags & CF_SINGLE_STEP;
+    db->idle_loop = false;
+    db->idle_checked = 0;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -65,6 +238,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    if (tb->prof) {
+        gen_tb_exec_count(tb);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -75,6 +251,15 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
+        /*
+         * Evaluate the gdb breakpoint conditions and tracepoints at the
+         * start of the TB.  This comes after insn_start, so that the
+         * helper can restore the state if the breakpoint stops.
+         */
+        if (db->num_insns == 1 && (cflags & CF_BP_CHECK)) {
+            gen_helper_gdb_bp_check(cpu_env, tcg_constant_tl(db->pc_first));
+        }
+
         if (plugin_enabled) {
             plugin_gen_insn_start(cpu, db);
         }
@@ -125,6 +310,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     /* The disas_log hook may use these values rather than recompute.  */
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
+    tb->idle_loop = db->idle_loop;
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
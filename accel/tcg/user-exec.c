@@ -1265,7 +1265,7 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
 #include "atomic_template.h"
 #endif
 
-#if HAVE_ATOMIC128 || HAVE_CMPXCHG128
+#if HAVE_ATOMIC128_MAYBE || HAVE_CMPXCHG128_MAYBE
 #define DATA_SIZE 16
 #include "atomic_template.h"
 #endif
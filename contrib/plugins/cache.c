@@ -17,22 +17,17 @@ static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
 static GHashTable *miss_ht;
 
-static GMutex mtx;
+static GMutex hashtable_lock;
 static GRand *rng;
 
 static int limit;
 static bool sys;
 
-static uint64_t dmem_accesses;
-static uint64_t dmisses;
-
-static uint64_t imem_accesses;
-static uint64_t imisses;
-
 enum EvictionPolicy {
     LRU,
     FIFO,
     RAND,
+    PLRU,
 };
 
 enum EvictionPolicy policy;
@@ -42,13 +37,11 @@ enum EvictionPolicy policy;
  * put in any of the blocks inside the set. The number of block per set is
  * called the associativity (assoc).
  *
- * Each block contains the the stored tag and a valid bit. Since this is not
- * a functional simulator, the data itself is not stored. We only identify
- * whether a block is in the cache or not by searching for its tag.
- *
- * In order to search for memory data in the cache, the set identifier and tag
- * are extracted from the address and the set is probed to see whether a tag
- * match occur.
+ * Each block is represented by the address of the memory block it holds,
+ * with its valid and dirty bits folded into the low bits, which are always
+ * zero in a block address. Since this is not a functional simulator, the
+ * data itself is not stored. The blocks of a set are contiguous so that
+ * probing a set only touches one or two host cache lines.
  *
  * An address is logically divided into three portions: The block offset,
  * the set number, and the tag.
@@ -60,16 +53,18 @@ enum EvictionPolicy policy;
  * The CacheSet also contains bookkeaping information about eviction details.
  */
 
-typedef struct {
-    uint64_t tag;
-    bool valid;
-} CacheBlock;
+#define BLOCK_VALID 1
+#define BLOCK_DIRTY 2
+#define BLOCK_FLAGS (BLOCK_VALID | BLOCK_DIRTY)
 
 typedef struct {
-    CacheBlock *blocks;
-    uint64_t *lru_priorities;
+    uint64_t *blocks;
+    union {
+        uint64_t *lru_priorities;   /* LRU */
+        uint64_t plru_bits;         /* PLRU, one bit per tree node */
+        int fifo_next;              /* FIFO */
+    };
     uint64_t lru_gen_counter;
-    GQueue *fifo_queue;
 } CacheSet;
 
 typedef struct {
@@ -79,24 +74,76 @@ typedef struct {
     int assoc;
     int blksize_shift;
     uint64_t set_mask;
-    uint64_t tag_mask;
+    uint64_t blk_mask;
+
+    /* shared between cores, and protected by lock */
+    bool shared;
+    GMutex lock;
+
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t writebacks;
 } Cache;
 
 typedef struct {
     char *disas_str;
     const char *symbol;
     uint64_t addr;
-    uint64_t dmisses;
-    uint64_t imisses;
+    uint64_t l1_dmisses;
+    uint64_t l1_imisses;
+    uint64_t l2_misses;
 } InsnData;
 
-void (*update_hit)(Cache *cache, int set, int blk);
-void (*update_miss)(Cache *cache, int set, int blk);
+/*
+ * The private caches of a core. Each vCPU is simulated by core
+ * vcpu_index % cores, so in system emulation, where there is a core per
+ * vCPU, the lock is uncontended.
+ */
+typedef struct {
+    GMutex lock;
+    Cache *l1_icache;
+    Cache *l1_dcache;
+    Cache *l2_ucache;
+} Core;
 
-void (*metadata_init)(Cache *cache);
-void (*metadata_destroy)(Cache *cache);
+static Core *cores;
+static int num_cores;
+static Cache *l3_ucache;
 
-Cache *dcache, *icache;
+/* The instructions of a translation block, for its fetch simulation */
+typedef struct {
+    size_t n_insns;
+    struct {
+        InsnData *data;
+        uint64_t vaddr;
+    } insns[];
+} BlockData;
+
+/*
+ * Nothing is simulated while a block runs. The translated code logs the
+ * data accesses inline, tagged with their instruction, and stores the
+ * index of each instruction it starts. A single callback at the start of
+ * the next block then simulates the fetches of the instructions that did
+ * run, which may be fewer than the block has, and the logged accesses.
+ * The log only has virtual addresses, so the caches are virtually
+ * indexed and tagged, and accesses to I/O are simulated like any other.
+ */
+#define MEM_LOG_SIZE 4096
+#define MEM_TAG_STORE 1
+
+typedef struct {
+    uint64_t n_logged;
+    uint64_t last_insn;
+    BlockData *block;
+    qemu_plugin_mem_record log[MEM_LOG_SIZE];
+} VcpuState;
+
+static struct qemu_plugin_scoreboard *vcpu_state;
+static GMutex vcpus_lock;
+static unsigned int n_vcpus;
+static uint64_t lost_accesses;
+
+static GPtrArray *blocks;
 
 static int pow_of_two(int num)
 {
@@ -141,7 +188,8 @@ static void lru_update_blk(Cache *cache, int set_idx, int blk_idx)
 
 static int lru_get_lru_block(Cache *cache, int set_idx)
 {
-    int i, min_idx, min_priority;
+    int i, min_idx;
+    uint64_t min_priority;
 
     min_priority = cache->sets[set_idx].lru_priorities[0];
     min_idx = 0;
@@ -165,49 +213,85 @@ static void lru_priorities_destroy(Cache *cache)
 }
 
 /*
- * FIFO eviction policy: a FIFO queue is maintained for each CacheSet that
- * stores accesses to the cache.
+ * Tree pseudo-LRU eviction policy: the ways of a set are the leaves of a
+ * binary tree, and each inner node has a bit pointing to the half of the
+ * subtree that was used least recently. This needs assoc - 1 bits per set
+ * and no scan to find a victim.
  *
- * On a compulsory miss: The block index is enqueued to the fifo_queue to
- * indicate that it's the latest cached block.
+ * On an access: The bits on the path to the block are set to point away
+ * from it.
  *
- * On a conflict miss: The first-in block is removed from the cache and the new
- * block is put in its place and enqueued to the FIFO queue.
+ * On a conflict miss: The bits are followed from the root to the victim.
  */
 
-static void fifo_init(Cache *cache)
+static void plru_update_blk(Cache *cache, int set_idx, int blk_idx)
 {
-    int i;
+    CacheSet *set = &cache->sets[set_idx];
+    int levels = pow_of_two(cache->assoc);
+    int node = 0;
+    int l;
 
-    for (i = 0; i < cache->num_sets; i++) {
-        cache->sets[i].fifo_queue = g_queue_new();
+    for (l = levels - 1; l >= 0; l--) {
+        int right = (blk_idx >> l) & 1;
+
+        if (right) {
+            set->plru_bits &= ~(1ull << node);
+        } else {
+            set->plru_bits |= 1ull << node;
+        }
+        node = 2 * node + 1 + right;
     }
 }
 
+static int plru_get_victim(Cache *cache, int set_idx)
+{
+    uint64_t bits = cache->sets[set_idx].plru_bits;
+    int levels = pow_of_two(cache->assoc);
+    int node = 0, blk = 0;
+    int l;
+
+    for (l = 0; l < levels; l++) {
+        int right = (bits >> node) & 1;
+
+        blk = (blk << 1) | right;
+        node = 2 * node + 1 + right;
+    }
+    return blk;
+}
+
+/*
+ * FIFO eviction policy: blocks are filled in order, so the first-in block
+ * of a set is the one after the block filled last.
+ *
+ * On a compulsory miss: The invalid block is filled, which keeps the order.
+ *
+ * On a conflict miss: The first-in block is removed from the cache and the new
+ * block is put in its place.
+ */
+
 static int fifo_get_first_block(Cache *cache, int set)
 {
-    GQueue *q = cache->sets[set].fifo_queue;
-    return GPOINTER_TO_INT(g_queue_pop_tail(q));
+    CacheSet *s = &cache->sets[set];
+    int blk = s->fifo_next;
+
+    s->fifo_next = (blk + 1) % cache->assoc;
+    return blk;
 }
 
 static void fifo_update_on_miss(Cache *cache, int set, int blk_idx)
 {
-    GQueue *q = cache->sets[set].fifo_queue;
-    g_queue_push_head(q, GINT_TO_POINTER(blk_idx));
+    cache->sets[set].fifo_next = (blk_idx + 1) % cache->assoc;
 }
 
-static void fifo_destroy(Cache *cache)
-{
-    int i;
+static void (*update_hit)(Cache *cache, int set, int blk);
+static void (*update_miss)(Cache *cache, int set, int blk);
 
-    for (i = 0; i < cache->num_sets; i++) {
-        g_queue_free(cache->sets[i].fifo_queue);
-    }
-}
+static void (*metadata_init)(Cache *cache);
+static void (*metadata_destroy)(Cache *cache);
 
-static inline uint64_t extract_tag(Cache *cache, uint64_t addr)
+static inline uint64_t extract_block(Cache *cache, uint64_t addr)
 {
-    return addr & cache->tag_mask;
+    return addr & ~cache->blk_mask;
 }
 
 static inline uint64_t extract_set(Cache *cache, uint64_t addr)
@@ -217,10 +301,17 @@ static inline uint64_t extract_set(Cache *cache, uint64_t addr)
 
 static const char *cache_config_error(int blksize, int assoc, int cachesize)
 {
-    if (cachesize % blksize != 0) {
+    if (blksize < 4 || (blksize & (blksize - 1))) {
+        return "block size must be a power of two, and at least 4";
+    } else if (cachesize % blksize != 0) {
         return "cache size must be divisible by block size";
     } else if (cachesize % (blksize * assoc) != 0) {
         return "cache size must be divisible by set size (assoc * block size)";
+    } else if ((cachesize / (blksize * assoc)) &
+               (cachesize / (blksize * assoc) - 1)) {
+        return "number of sets must be a power of two";
+    } else if (policy == PLRU && (assoc > 64 || (assoc & (assoc - 1)))) {
+        return "pseudo-LRU needs a power of two associativity, up to 64";
     } else {
         return NULL;
     }
@@ -228,7 +319,7 @@ static const char *cache_config_error(int blksize, int assoc, int cachesize)
 
 static bool bad_cache_params(int blksize, int assoc, int cachesize)
 {
-    return (cachesize % blksize) != 0 || (cachesize % (blksize * assoc) != 0);
+    return cache_config_error(blksize, assoc, cachesize) != NULL;
 }
 
 static Cache *cache_init(int blksize, int assoc, int cachesize)
@@ -239,22 +330,21 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
 
     Cache *cache;
     int i;
-    uint64_t blk_mask;
 
-    cache = g_new(Cache, 1);
+    cache = g_new0(Cache, 1);
     cache->assoc = assoc;
     cache->cachesize = cachesize;
     cache->num_sets = cachesize / (blksize * assoc);
-    cache->sets = g_new(CacheSet, cache->num_sets);
+    cache->sets = g_new0(CacheSet, cache->num_sets);
     cache->blksize_shift = pow_of_two(blksize);
+    g_mutex_init(&cache->lock);
 
     for (i = 0; i < cache->num_sets; i++) {
-        cache->sets[i].blocks = g_new0(CacheBlock, assoc);
+        cache->sets[i].blocks = g_new0(uint64_t, assoc);
     }
 
-    blk_mask = blksize - 1;
-    cache->set_mask = ((cache->num_sets - 1) << cache->blksize_shift);
-    cache->tag_mask = ~(cache->set_mask | blk_mask);
+    cache->blk_mask = blksize - 1;
+    cache->set_mask = ((uint64_t)(cache->num_sets - 1) << cache->blksize_shift);
 
     if (metadata_init) {
         metadata_init(cache);
@@ -268,7 +358,7 @@ static int get_invalid_block(Cache *cache, uint64_t set)
     int i;
 
     for (i = 0; i < cache->assoc; i++) {
-        if (!cache->sets[set].blocks[i].valid) {
+        if (!(cache->sets[set].blocks[i] & BLOCK_VALID)) {
             return i;
         }
     }
@@ -285,6 +375,8 @@ static int get_replaced_block(Cache *cache, int set)
         return lru_get_lru_block(cache, set);
     case FIFO:
         return fifo_get_first_block(cache, set);
+    case PLRU:
+        return plru_get_victim(cache, set);
     default:
         g_assert_not_reached();
     }
@@ -292,15 +384,12 @@ static int get_replaced_block(Cache *cache, int set)
 
 static int in_cache(Cache *cache, uint64_t addr)
 {
+    uint64_t *blocks = cache->sets[extract_set(cache, addr)].blocks;
+    uint64_t blk = extract_block(cache, addr) | BLOCK_VALID;
     int i;
-    uint64_t tag, set;
-
-    tag = extract_tag(cache, addr);
-    set = extract_set(cache, addr);
 
     for (i = 0; i < cache->assoc; i++) {
-        if (cache->sets[set].blocks[i].tag == tag &&
-                cache->sets[set].blocks[i].valid) {
+        if ((blocks[i] & ~BLOCK_DIRTY) == blk) {
             return i;
         }
     }
@@ -312,26 +401,36 @@ static int in_cache(Cache *cache, uint64_t addr)
  * access_cache(): Simulate a cache access
  * @cache: The cache under simulation
  * @addr: The address of the requested memory location
+ * @store: whether the access writes the block
+ * @writeback: set to the address of the block to write back, if any
  *
  * Returns true if the requsted data is hit in the cache and false when missed.
- * The cache is updated on miss for the next access.
+ * The cache is updated on miss for the next access. Caches are write-back
+ * and write-allocate: if a dirty block is evicted, true is returned in
+ * @writeback and the caller must write it back to the next level.
  */
-static bool access_cache(Cache *cache, uint64_t addr)
+static bool access_cache(Cache *cache, uint64_t addr, bool store,
+                         uint64_t *writeback, bool *has_writeback)
 {
     int hit_blk, replaced_blk;
-    uint64_t tag, set;
+    uint64_t set, *blk;
 
-    tag = extract_tag(cache, addr);
     set = extract_set(cache, addr);
+    *has_writeback = false;
+    cache->accesses++;
 
     hit_blk = in_cache(cache, addr);
     if (hit_blk != -1) {
         if (update_hit) {
             update_hit(cache, set, hit_blk);
         }
+        if (store) {
+            cache->sets[set].blocks[hit_blk] |= BLOCK_DIRTY;
+        }
         return true;
     }
 
+    cache->misses++;
     replaced_blk = get_invalid_block(cache, set);
 
     if (replaced_blk == -1) {
@@ -342,60 +441,177 @@ static bool access_cache(Cache *cache, uint64_t addr)
         update_miss(cache, set, replaced_blk);
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    blk = &cache->sets[set].blocks[replaced_blk];
+    if (*blk & BLOCK_DIRTY) {
+        cache->writebacks++;
+        *writeback = *blk & ~BLOCK_FLAGS;
+        *has_writeback = true;
+    }
+    *blk = extract_block(cache, addr) | BLOCK_VALID | (store ? BLOCK_DIRTY : 0);
 
     return false;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+/*
+ * Access @addr through @levels, from the first one down to memory.
+ * Returns the index of the level that hit, or @n if all of them missed.
+ * Blocks evicted dirty from a level are written to the one below.
+ */
+static int access_levels(Cache **levels, int n, uint64_t addr, bool store)
 {
-    uint64_t effective_addr;
-    struct qemu_plugin_hwaddr *hwaddr;
-    InsnData *insn;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        Cache *cache = levels[i];
+        uint64_t victim;
+        bool has_victim, hit;
+
+        if (cache->shared) {
+            g_mutex_lock(&cache->lock);
+        }
+        hit = access_cache(cache, addr, store, &victim, &has_victim);
+        if (cache->shared) {
+            g_mutex_unlock(&cache->lock);
+        }
 
-    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-        return;
+        if (has_victim && i + 1 < n) {
+            access_levels(levels + i + 1, n - i - 1, victim, true);
+        }
+        if (hit) {
+            break;
+        }
+        /* lower levels see the fill of the block, not the store */
+        store = false;
     }
+    return i;
+}
 
-    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+static int core_levels(Core *core, Cache *l1, Cache **levels)
+{
+    int n = 0;
 
-    g_mutex_lock(&mtx);
-    if (!access_cache(dcache, effective_addr)) {
-        insn = (InsnData *) userdata;
-        insn->dmisses++;
-        dmisses++;
+    levels[n++] = l1;
+    if (core->l2_ucache) {
+        levels[n++] = core->l2_ucache;
     }
-    dmem_accesses++;
-    g_mutex_unlock(&mtx);
+    if (l3_ucache) {
+        levels[n++] = l3_ucache;
+    }
+    return n;
 }
 
-static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+static void count_miss(uint64_t *counter)
 {
-    uint64_t insn_addr;
-    InsnData *insn;
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
 
-    g_mutex_lock(&mtx);
-    insn_addr = ((InsnData *) userdata)->addr;
+static Core *vcpu_core(unsigned int vcpu_index)
+{
+    return &cores[vcpu_index % num_cores];
+}
 
-    if (!access_cache(icache, insn_addr)) {
-        insn = (InsnData *) userdata;
-        insn->imisses++;
-        imisses++;
+/*
+ * Simulate the fetches of the first @n instructions of @bd. Instruction
+ * fetches only go to the L1 icache, so consecutive instructions in the
+ * same block hit without a lookup.
+ */
+static void simulate_fetches(Core *core, BlockData *bd, size_t n)
+{
+    Cache *levels[3];
+    int n_levels = core_levels(core, core->l1_icache, levels);
+    uint64_t last_blk = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        InsnData *insn = bd->insns[i].data;
+        uint64_t vaddr = bd->insns[i].vaddr;
+        uint64_t blk = extract_block(core->l1_icache, vaddr);
+        int hit;
+
+        if (i && blk == last_blk) {
+            core->l1_icache->accesses++;
+            continue;
+        }
+        last_blk = blk;
+
+        hit = access_levels(levels, n_levels, vaddr, false);
+        if (hit > 0) {
+            count_miss(&insn->l1_imisses);
+        }
+        if (hit > 1 && core->l2_ucache) {
+            count_miss(&insn->l2_misses);
+        }
+    }
+}
+
+static void simulate_mem_log(Core *core, VcpuState *vs)
+{
+    Cache *levels[3];
+    int n_levels = core_levels(core, core->l1_dcache, levels);
+    uint64_t i = 0;
+
+    /* the oldest records were overwritten */
+    if (vs->n_logged > MEM_LOG_SIZE) {
+        i = vs->n_logged - MEM_LOG_SIZE;
+        __atomic_fetch_add(&lost_accesses, i, __ATOMIC_RELAXED);
+    }
+
+    for (; i < vs->n_logged; i++) {
+        qemu_plugin_mem_record *rec = &vs->log[i & (MEM_LOG_SIZE - 1)];
+        InsnData *insn = (InsnData *)(uintptr_t)(rec->tag & ~MEM_TAG_STORE);
+        int hit;
+
+        hit = access_levels(levels, n_levels, rec->vaddr,
+                            rec->tag & MEM_TAG_STORE);
+        if (hit > 0) {
+            count_miss(&insn->l1_dmisses);
+        }
+        if (hit > 1 && core->l2_ucache) {
+            count_miss(&insn->l2_misses);
+        }
     }
-    imem_accesses++;
-    g_mutex_unlock(&mtx);
+    vs->n_logged = 0;
+}
+
+/* Simulate what the vCPU did since its last block started */
+static void vcpu_flush(unsigned int vcpu_index, VcpuState *vs)
+{
+    Core *core = vcpu_core(vcpu_index);
+
+    g_mutex_lock(&core->lock);
+    if (vs->block) {
+        simulate_fetches(core, vs->block, vs->last_insn + 1);
+    }
+    simulate_mem_log(core, vs);
+    g_mutex_unlock(&core->lock);
+}
+
+static void vcpu_tb_exec(unsigned int vcpu_index, void *userdata)
+{
+    VcpuState *vs = qemu_plugin_scoreboard_find(vcpu_state, vcpu_index);
+
+    vcpu_flush(vcpu_index, vs);
+    vs->block = userdata;
+    vs->last_insn = 0;
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
+    qemu_plugin_u64 n_logged =
+        qemu_plugin_scoreboard_u64_in_struct(vcpu_state, VcpuState, n_logged);
+    qemu_plugin_u64 last_insn =
+        qemu_plugin_scoreboard_u64_in_struct(vcpu_state, VcpuState, last_insn);
+    qemu_plugin_u64 log =
+        qemu_plugin_scoreboard_u64_in_struct(vcpu_state, VcpuState, log);
     size_t n_insns;
     size_t i;
     InsnData *data;
+    BlockData *bd;
 
     n_insns = qemu_plugin_tb_n_insns(tb);
+    bd = g_malloc(sizeof(*bd) + n_insns * sizeof(bd->insns[0]));
+    bd->n_insns = n_insns;
+
     for (i = 0; i < n_insns; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
         uint64_t effective_addr;
@@ -411,7 +627,7 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
          * new entries for those instructions. Instead, we fetch the same
          * entry from the hash table and register it for the callback again.
          */
-        g_mutex_lock(&mtx);
+        g_mutex_lock(&hashtable_lock);
         data = g_hash_table_lookup(miss_ht, GUINT_TO_POINTER(effective_addr));
         if (data == NULL) {
             data = g_new0(InsnData, 1);
@@ -421,15 +637,34 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             g_hash_table_insert(miss_ht, GUINT_TO_POINTER(effective_addr),
                                (gpointer) data);
         }
-        g_mutex_unlock(&mtx);
+        g_mutex_unlock(&hashtable_lock);
+        bd->insns[i].data = data;
+        bd->insns[i].vaddr = qemu_plugin_insn_vaddr(insn);
+
+        /* the block's callback sets it to 0 */
+        if (i) {
+            qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+                insn, QEMU_PLUGIN_INLINE_STORE_U64, last_insn, i);
+        }
+        if (rw & QEMU_PLUGIN_MEM_R) {
+            qemu_plugin_register_vcpu_mem_inline_log(
+                insn, QEMU_PLUGIN_MEM_R, n_logged, log, MEM_LOG_SIZE,
+                (uintptr_t)data);
+        }
+        if (rw & QEMU_PLUGIN_MEM_W) {
+            qemu_plugin_register_vcpu_mem_inline_log(
+                insn, QEMU_PLUGIN_MEM_W, n_logged, log, MEM_LOG_SIZE,
+                (uintptr_t)data | MEM_TAG_STORE);
+        }
+    }
 
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
+    /* the block data lives as long as the plugin: blocks may be retranslated */
+    g_mutex_lock(&hashtable_lock);
+    g_ptr_array_add(blocks, bd);
+    g_mutex_unlock(&hashtable_lock);
 
-        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, data);
-    }
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, bd);
 }
 
 static void insn_free(gpointer data)
@@ -458,7 +693,7 @@ static int dcmp(gconstpointer a, gconstpointer b)
     InsnData *insn_a = (InsnData *) a;
     InsnData *insn_b = (InsnData *) b;
 
-    return insn_a->dmisses < insn_b->dmisses ? 1 : -1;
+    return insn_a->l1_dmisses < insn_b->l1_dmisses ? 1 : -1;
 }
 
 static int icmp(gconstpointer a, gconstpointer b)
@@ -466,59 +701,126 @@ static int icmp(gconstpointer a, gconstpointer b)
     InsnData *insn_a = (InsnData *) a;
     InsnData *insn_b = (InsnData *) b;
 
-    return insn_a->imisses < insn_b->imisses ? 1 : -1;
+    return insn_a->l1_imisses < insn_b->l1_imisses ? 1 : -1;
+}
+
+static int l2_cmp(gconstpointer a, gconstpointer b)
+{
+    InsnData *insn_a = (InsnData *) a;
+    InsnData *insn_b = (InsnData *) b;
+
+    return insn_a->l2_misses < insn_b->l2_misses ? 1 : -1;
+}
+
+static void append_stats_line(GString *line, const char *name, Cache *cache)
+{
+    g_string_append_printf(line, "%-8s %12" PRIu64 " %12" PRIu64
+                           " %10.4lf%% %12" PRIu64 "\n", name,
+                           cache->accesses, cache->misses,
+                           cache->accesses ? cache->misses * 100.0 /
+                                             cache->accesses : 0.0,
+                           cache->writebacks);
+}
+
+/* Sum the statistics of the per-core caches at @offset in Core */
+static void sum_stats(Cache *sum, size_t offset)
+{
+    int i;
+
+    for (i = 0; i < num_cores; i++) {
+        Cache *cache = *(Cache **)((char *)&cores[i] + offset);
+
+        sum->accesses += cache->accesses;
+        sum->misses += cache->misses;
+        sum->writebacks += cache->writebacks;
+    }
 }
 
 static void log_stats(void)
 {
     g_autoptr(GString) rep = g_string_new("");
-    g_string_append_printf(rep,
-        "Data accesses: %lu, Misses: %lu\nMiss rate: %lf%%\n\n",
-        dmem_accesses,
-        dmisses,
-        ((double) dmisses / (double) dmem_accesses) * 100.0);
-
-    g_string_append_printf(rep,
-        "Instruction accesses: %lu, Misses: %lu\nMiss rate: %lf%%\n\n",
-        imem_accesses,
-        imisses,
-        ((double) imisses / (double) imem_accesses) * 100.0);
+    Cache l1i = { 0 }, l1d = { 0 }, l2 = { 0 };
+    int i;
+
+    g_string_append_printf(rep, "%-8s %12s %12s %11s %12s\n", "cache",
+                           "accesses", "misses", "miss rate", "writebacks");
+
+    if (num_cores > 1) {
+        for (i = 0; i < num_cores; i++) {
+            g_autofree gchar *l1d_name = g_strdup_printf("core%d-L1D", i);
+            g_autofree gchar *l1i_name = g_strdup_printf("core%d-L1I", i);
+            g_autofree gchar *l2_name = g_strdup_printf("core%d-L2", i);
+
+            append_stats_line(rep, l1d_name, cores[i].l1_dcache);
+            append_stats_line(rep, l1i_name, cores[i].l1_icache);
+            if (cores[i].l2_ucache) {
+                append_stats_line(rep, l2_name, cores[i].l2_ucache);
+            }
+        }
+    }
+
+    sum_stats(&l1d, offsetof(Core, l1_dcache));
+    sum_stats(&l1i, offsetof(Core, l1_icache));
+    append_stats_line(rep, "L1D", &l1d);
+    append_stats_line(rep, "L1I", &l1i);
+    if (cores[0].l2_ucache) {
+        sum_stats(&l2, offsetof(Core, l2_ucache));
+        append_stats_line(rep, "L2", &l2);
+    }
+    if (l3_ucache) {
+        append_stats_line(rep, "L3", l3_ucache);
+    }
+    if (lost_accesses) {
+        g_string_append_printf(rep, "%" PRIu64 " data accesses were not "
+                               "simulated: the log overflowed\n",
+                               lost_accesses);
+    }
+    g_string_append_c(rep, '\n');
 
     qemu_plugin_outs(rep->str);
 }
 
-static void log_top_insns(void)
+static void append_top_insns(GString *rep, GList *insns, const char *what,
+                             size_t offset)
 {
+    GList *curr;
     int i;
-    GList *curr, *miss_insns;
-    InsnData *insn;
 
-    miss_insns = g_hash_table_get_values(miss_ht);
-    miss_insns = g_list_sort(miss_insns, dcmp);
-    g_autoptr(GString) rep = g_string_new("");
-    g_string_append_printf(rep, "%s", "address, data misses, instruction\n");
+    g_string_append_printf(rep, "address, %s, instruction\n", what);
+
+    for (curr = insns, i = 0; curr && i < limit; i++, curr = curr->next) {
+        InsnData *insn = (InsnData *) curr->data;
 
-    for (curr = miss_insns, i = 0; curr && i < limit; i++, curr = curr->next) {
-        insn = (InsnData *) curr->data;
         g_string_append_printf(rep, "0x%" PRIx64, insn->addr);
         if (insn->symbol) {
             g_string_append_printf(rep, " (%s)", insn->symbol);
         }
-        g_string_append_printf(rep, ", %ld, %s\n", insn->dmisses,
+        g_string_append_printf(rep, ", %" PRIu64 ", %s\n",
+                               *(uint64_t *)((char *)insn + offset),
                                insn->disas_str);
     }
+    g_string_append_c(rep, '\n');
+}
+
+static void log_top_insns(void)
+{
+    GList *miss_insns;
+    g_autoptr(GString) rep = g_string_new("");
+
+    miss_insns = g_hash_table_get_values(miss_ht);
+
+    miss_insns = g_list_sort(miss_insns, dcmp);
+    append_top_insns(rep, miss_insns, "data misses",
+                     offsetof(InsnData, l1_dmisses));
 
     miss_insns = g_list_sort(miss_insns, icmp);
-    g_string_append_printf(rep, "%s", "\naddress, fetch misses, instruction\n");
+    append_top_insns(rep, miss_insns, "fetch misses",
+                     offsetof(InsnData, l1_imisses));
 
-    for (curr = miss_insns, i = 0; curr && i < limit; i++, curr = curr->next) {
-        insn = (InsnData *) curr->data;
-        g_string_append_printf(rep, "0x%" PRIx64, insn->addr);
-        if (insn->symbol) {
-            g_string_append_printf(rep, " (%s)", insn->symbol);
-        }
-        g_string_append_printf(rep, ", %ld, %s\n", insn->imisses,
-                               insn->disas_str);
+    if (cores[0].l2_ucache) {
+        miss_insns = g_list_sort(miss_insns, l2_cmp);
+        append_top_insns(rep, miss_insns, "L2 misses",
+                         offsetof(InsnData, l2_misses));
     }
 
     qemu_plugin_outs(rep->str);
@@ -527,15 +829,40 @@ static void log_top_insns(void)
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    unsigned int i;
+
+    /* simulate the last block of each vCPU; no vCPU runs anymore */
+    for (i = 0; i < n_vcpus; i++) {
+        vcpu_flush(i, qemu_plugin_scoreboard_find(vcpu_state, i));
+    }
+
     log_stats();
     log_top_insns();
 
-    cache_free(dcache);
-    cache_free(icache);
+    for (i = 0; i < num_cores; i++) {
+        cache_free(cores[i].l1_dcache);
+        cache_free(cores[i].l1_icache);
+        if (cores[i].l2_ucache) {
+            cache_free(cores[i].l2_ucache);
+        }
+    }
+    if (l3_ucache) {
+        cache_free(l3_ucache);
+    }
+    g_free(cores);
 
+    qemu_plugin_scoreboard_free(vcpu_state);
+    g_ptr_array_free(blocks, true);
     g_hash_table_destroy(miss_ht);
 }
 
+static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
+{
+    g_mutex_lock(&vcpus_lock);
+    n_vcpus = MAX(n_vcpus, vcpu_index + 1);
+    g_mutex_unlock(&vcpus_lock);
+}
+
 static void policy_init(void)
 {
     switch (policy) {
@@ -545,10 +872,12 @@ static void policy_init(void)
         metadata_init = lru_priorities_init;
         metadata_destroy = lru_priorities_destroy;
         break;
+    case PLRU:
+        update_hit = plru_update_blk;
+        update_miss = plru_update_blk;
+        break;
     case FIFO:
         update_miss = fifo_update_on_miss;
-        metadata_init = fifo_init;
-        metadata_destroy = fifo_destroy;
         break;
     case RAND:
         rng = g_rand_new();
@@ -558,41 +887,92 @@ static void policy_init(void)
     }
 }
 
+static Cache *cache_init_or_report(const char *name, int blksize, int assoc,
+                                   int cachesize)
+{
+    Cache *cache = cache_init(blksize, assoc, cachesize);
+
+    if (!cache) {
+        const char *err = cache_config_error(blksize, assoc, cachesize);
+        fprintf(stderr, "%s cannot be constructed from given parameters\n",
+                name);
+        fprintf(stderr, "%s\n", err);
+    }
+    return cache;
+}
+
 QEMU_PLUGIN_EXPORT
 int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                         int argc, char **argv)
 {
     int i;
-    int iassoc, iblksize, icachesize;
-    int dassoc, dblksize, dcachesize;
+    int l1_iassoc, l1_iblksize, l1_icachesize;
+    int l1_dassoc, l1_dblksize, l1_dcachesize;
+    int l2_assoc, l2_blksize, l2_cachesize;
+    int l3_assoc, l3_blksize, l3_cachesize;
+    bool use_l2 = false, use_l3 = false;
 
     limit = 32;
     sys = info->system_emulation;
 
-    dassoc = 8;
-    dblksize = 64;
-    dcachesize = dblksize * dassoc * 32;
+    l1_dassoc = 8;
+    l1_dblksize = 64;
+    l1_dcachesize = l1_dblksize * l1_dassoc * 32;
+
+    l1_iassoc = 8;
+    l1_iblksize = 64;
+    l1_icachesize = l1_iblksize * l1_iassoc * 32;
+
+    l2_assoc = 16;
+    l2_blksize = 64;
+    l2_cachesize = l2_assoc * l2_blksize * 2048;
 
-    iassoc = 8;
-    iblksize = 64;
-    icachesize = iblksize * iassoc * 32;
+    l3_assoc = 16;
+    l3_blksize = 64;
+    l3_cachesize = l3_assoc * l3_blksize * 8192;
 
-    policy = LRU;
+    policy = PLRU;
+
+    num_cores = sys ? qemu_plugin_n_vcpus() : 1;
 
     for (i = 0; i < argc; i++) {
         char *opt = argv[i];
         if (g_str_has_prefix(opt, "iblksize=")) {
-            iblksize = g_ascii_strtoll(opt + 9, NULL, 10);
+            l1_iblksize = g_ascii_strtoll(opt + 9, NULL, 10);
         } else if (g_str_has_prefix(opt, "iassoc=")) {
-            iassoc = g_ascii_strtoll(opt + 7, NULL, 10);
+            l1_iassoc = g_ascii_strtoll(opt + 7, NULL, 10);
         } else if (g_str_has_prefix(opt, "icachesize=")) {
-            icachesize = g_ascii_strtoll(opt + 11, NULL, 10);
+            l1_icachesize = g_ascii_strtoll(opt + 11, NULL, 10);
         } else if (g_str_has_prefix(opt, "dblksize=")) {
-            dblksize = g_ascii_strtoll(opt + 9, NULL, 10);
+            l1_dblksize = g_ascii_strtoll(opt + 9, NULL, 10);
         } else if (g_str_has_prefix(opt, "dassoc=")) {
-            dassoc = g_ascii_strtoll(opt + 7, NULL, 10);
+            l1_dassoc = g_ascii_strtoll(opt + 7, NULL, 10);
         } else if (g_str_has_prefix(opt, "dcachesize=")) {
-            dcachesize = g_ascii_strtoll(opt + 11, NULL, 10);
+            l1_dcachesize = g_ascii_strtoll(opt + 11, NULL, 10);
+        } else if (g_str_has_prefix(opt, "l2cachesize=")) {
+            use_l2 = true;
+            l2_cachesize = g_ascii_strtoll(opt + 12, NULL, 10);
+        } else if (g_str_has_prefix(opt, "l2blksize=")) {
+            use_l2 = true;
+            l2_blksize = g_ascii_strtoll(opt + 10, NULL, 10);
+        } else if (g_str_has_prefix(opt, "l2assoc=")) {
+            use_l2 = true;
+            l2_assoc = g_ascii_strtoll(opt + 8, NULL, 10);
+        } else if (g_strcmp0(opt, "l2") == 0) {
+            use_l2 = true;
+        } else if (g_str_has_prefix(opt, "l3cachesize=")) {
+            use_l3 = true;
+            l3_cachesize = g_ascii_strtoll(opt + 12, NULL, 10);
+        } else if (g_str_has_prefix(opt, "l3blksize=")) {
+            use_l3 = true;
+            l3_blksize = g_ascii_strtoll(opt + 10, NULL, 10);
+        } else if (g_str_has_prefix(opt, "l3assoc=")) {
+            use_l3 = true;
+            l3_assoc = g_ascii_strtoll(opt + 8, NULL, 10);
+        } else if (g_strcmp0(opt, "l3") == 0) {
+            use_l3 = true;
+        } else if (g_str_has_prefix(opt, "cores=")) {
+            num_cores = g_ascii_strtoll(opt + 6, NULL, 10);
         } else if (g_str_has_prefix(opt, "limit=")) {
             limit = g_ascii_strtoll(opt + 6, NULL, 10);
         } else if (g_str_has_prefix(opt, "evict=")) {
@@ -601,6 +981,8 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 policy = RAND;
             } else if (g_strcmp0(p, "lru") == 0) {
                 policy = LRU;
+            } else if (g_strcmp0(p, "plru") == 0) {
+                policy = PLRU;
             } else if (g_strcmp0(p, "fifo") == 0) {
                 policy = FIFO;
             } else {
@@ -613,24 +995,45 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         }
     }
 
+    if (num_cores <= 0) {
+        fprintf(stderr, "the number of cores must be positive\n");
+        return -1;
+    }
+
     policy_init();
 
-    dcache = cache_init(dblksize, dassoc, dcachesize);
-    if (!dcache) {
-        const char *err = cache_config_error(dblksize, dassoc, dcachesize);
-        fprintf(stderr, "dcache cannot be constructed from given parameters\n");
-        fprintf(stderr, "%s\n", err);
-        return -1;
+    cores = g_new0(Core, num_cores);
+    for (i = 0; i < num_cores; i++) {
+        g_mutex_init(&cores[i].lock);
+        cores[i].l1_dcache = cache_init_or_report("dcache", l1_dblksize,
+                                                  l1_dassoc, l1_dcachesize);
+        cores[i].l1_icache = cache_init_or_report("icache", l1_iblksize,
+                                                  l1_iassoc, l1_icachesize);
+        if (!cores[i].l1_dcache || !cores[i].l1_icache) {
+            return -1;
+        }
+        if (use_l2) {
+            cores[i].l2_ucache = cache_init_or_report("L2 cache", l2_blksize,
+                                                      l2_assoc, l2_cachesize);
+            if (!cores[i].l2_ucache) {
+                return -1;
+            }
+        }
     }
 
-    icache = cache_init(iblksize, iassoc, icachesize);
-    if (!icache) {
-        const char *err = cache_config_error(iblksize, iassoc, icachesize);
-        fprintf(stderr, "icache cannot be constructed from given parameters\n");
-        fprintf(stderr, "%s\n", err);
-        return -1;
+    if (use_l3) {
+        l3_ucache = cache_init_or_report("L3 cache", l3_blksize, l3_assoc,
+                                         l3_cachesize);
+        if (!l3_ucache) {
+            return -1;
+        }
+        l3_ucache->shared = true;
     }
 
+    vcpu_state = qemu_plugin_scoreboard_new(sizeof(VcpuState));
+    blocks = g_ptr_array_new_with_free_func(g_free);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -0,0 +1,335 @@
+/*
+ * Sampling profiler
+ *
+ * Take one sample of the guest PC every N executed instructions and
+ * report the samples in the "folded stacks" format understood by
+ * flamegraph.pl and similar tools. Optionally, the caller (from the link
+ * register) and the current RTOS task are sampled too and become the
+ * outer frames of each stack.
+ *
+ * Rather than calling out on every instruction, each translation block
+ * adds its length to a per-vCPU counter inline, and a conditional
+ * callback fires only when the counter crosses the sampling period. The
+ * cost is therefore a couple of host instructions per block plus one
+ * call per sample.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/*
+ * Per-vCPU state. Each vCPU only touches its own entry, so sampling
+ * needs no lock.
+ */
+typedef struct {
+    uint64_t insns;         /* instructions since the last sample */
+    GHashTable *samples;    /* set of Sample */
+} VcpuSamples;
+
+typedef struct {
+    uint64_t task;
+    uint64_t lr;
+    uint64_t pc;
+    uint64_t count;
+} Sample;
+
+static struct qemu_plugin_scoreboard *state;
+static qemu_plugin_u64 insns;
+static uint64_t period = 10000;
+static char *outfile;
+
+static GMutex lock;
+static unsigned int n_vcpus;
+
+/* gdb number of the link register, or -1 */
+static int lr_reg = -1;
+/* address of the current task pointer, if task_addr_set */
+static uint64_t task_addr;
+static bool task_addr_set;
+static unsigned int ptr_size = 4;
+static bool big_endian;
+
+/* Firmware symbols, sorted by address */
+typedef struct {
+    uint64_t addr;
+    char *name;
+} Symbol;
+
+static GArray *symbols;
+
+static gint symbol_cmp(gconstpointer a, gconstpointer b)
+{
+    const Symbol *sa = a, *sb = b;
+
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+/*
+ * Load a symbol map in the format printed by nm, "address [type] name",
+ * one symbol per line. A symbol extends up to the next one.
+ */
+static bool symbols_load(const char *filename)
+{
+    char line[512];
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "sampler: cannot open %s\n", filename);
+        return false;
+    }
+
+    symbols = g_array_new(false, false, sizeof(Symbol));
+    while (fgets(line, sizeof(line), f)) {
+        char name[256], type[8];
+        uint64_t addr;
+        Symbol sym;
+
+        if (sscanf(line, "%" SCNx64 " %7s %255s", &addr, type, name) != 3 &&
+            sscanf(line, "%" SCNx64 " %255s", &addr, name) != 2) {
+            continue;
+        }
+        sym.addr = addr;
+        sym.name = g_strdup(name);
+        g_array_append_val(symbols, sym);
+    }
+    fclose(f);
+
+    g_array_sort(symbols, symbol_cmp);
+    return true;
+}
+
+static const char *symbols_lookup(uint64_t addr)
+{
+    guint lo = 0, hi = symbols ? symbols->len : 0;
+
+    while (lo < hi) {
+        guint mid = (lo + hi) / 2;
+
+        if (g_array_index(symbols, Symbol, mid).addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? g_array_index(symbols, Symbol, lo - 1).name : NULL;
+}
+
+static guint sample_hash(gconstpointer p)
+{
+    const Sample *s = p;
+
+    return g_int64_hash(&s->pc) ^ g_int64_hash(&s->lr) ^
+           g_int64_hash(&s->task);
+}
+
+static gboolean sample_equal(gconstpointer a, gconstpointer b)
+{
+    const Sample *sa = a, *sb = b;
+
+    return sa->pc == sb->pc && sa->lr == sb->lr && sa->task == sb->task;
+}
+
+/* Registers and memory are read in target endianness */
+static uint64_t target_value(GByteArray *buf)
+{
+    unsigned int len = MIN(buf->len, sizeof(uint64_t));
+    uint64_t val = 0;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        unsigned int b = big_endian ? i : len - 1 - i;
+        val = (val << 8) | buf->data[b];
+    }
+    return val;
+}
+
+static void vcpu_sample(unsigned int cpu_index, void *udata)
+{
+    VcpuSamples *s = qemu_plugin_scoreboard_find(state, cpu_index);
+    Sample key = { .pc = (uintptr_t)udata };
+    Sample *sample;
+
+    if (lr_reg >= 0) {
+        g_autoptr(GByteArray) buf = g_byte_array_new();
+
+        if (qemu_plugin_read_register(lr_reg, buf) > 0) {
+            key.lr = target_value(buf);
+        }
+    }
+    if (task_addr_set) {
+        g_autoptr(GByteArray) buf = g_byte_array_new();
+
+        if (qemu_plugin_read_memory_vaddr(task_addr, buf, ptr_size)) {
+            key.task = target_value(buf);
+        }
+    }
+
+    sample = g_hash_table_lookup(s->samples, &key);
+    if (!sample) {
+        sample = g_memdup(&key, sizeof(key));
+        g_hash_table_add(s->samples, sample);
+    }
+    sample->count++;
+    s->insns = 0;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    uint64_t pc = qemu_plugin_tb_vaddr(tb);
+
+    /*
+     * The sample goes to the block that crossed the period, so count
+     * its instructions before testing.
+     */
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, insns, qemu_plugin_tb_n_insns(tb));
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_sample, QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_COND_GE,
+        insns, period, (void *)(uintptr_t)pc);
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    VcpuSamples *s = qemu_plugin_scoreboard_find(state, cpu_index);
+
+    s->samples = g_hash_table_new_full(sample_hash, sample_equal,
+                                       g_free, NULL);
+
+    g_mutex_lock(&lock);
+    n_vcpus = MAX(n_vcpus, cpu_index + 1);
+    g_mutex_unlock(&lock);
+}
+
+static void append_frame(GString *stack, uint64_t addr)
+{
+    const char *sym = symbols_lookup(addr);
+
+    if (stack->len) {
+        g_string_append_c(stack, ';');
+    }
+    if (sym) {
+        g_string_append(stack, sym);
+    } else {
+        g_string_append_printf(stack, "0x%" PRIx64, addr);
+    }
+}
+
+/* Merge the samples of all vCPUs by stack */
+static void add_samples(GHashTable *stacks, VcpuSamples *s)
+{
+    GHashTableIter iter;
+    Sample *sample;
+
+    g_hash_table_iter_init(&iter, s->samples);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&sample, NULL)) {
+        GString *stack = g_string_new("");
+        char *frame;
+        gpointer old;
+
+        if (task_addr_set) {
+            g_string_append_printf(stack, "task-0x%" PRIx64, sample->task);
+        }
+        if (lr_reg >= 0) {
+            append_frame(stack, sample->lr);
+        }
+        append_frame(stack, sample->pc);
+        frame = g_string_free(stack, false);
+        old = g_hash_table_lookup(stacks, frame);
+
+        g_hash_table_replace(stacks, frame,
+                             GSIZE_TO_POINTER(GPOINTER_TO_SIZE(old) +
+                                              sample->count));
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+    g_autoptr(GHashTable) stacks =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTableIter iter;
+    gpointer frame, n;
+    unsigned int i;
+
+    for (i = 0; i < n_vcpus; i++) {
+        VcpuSamples *s = qemu_plugin_scoreboard_find(state, i);
+
+        if (s->samples) {
+            add_samples(stacks, s);
+            g_hash_table_destroy(s->samples);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, stacks);
+    while (g_hash_table_iter_next(&iter, &frame, &n)) {
+        g_string_append_printf(report, "%s %zu\n", (char *)frame,
+                               (size_t)GPOINTER_TO_SIZE(n));
+    }
+
+    if (outfile) {
+        if (!g_file_set_contents(outfile, report->str, report->len, NULL)) {
+            fprintf(stderr, "sampler: cannot write %s\n", outfile);
+        }
+    } else {
+        qemu_plugin_outs(report->str);
+    }
+    qemu_plugin_scoreboard_free(state);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        if (g_str_has_prefix(opt, "period=")) {
+            period = g_ascii_strtoull(opt + 7, NULL, 10);
+        } else if (g_str_has_prefix(opt, "symbols=")) {
+            if (!symbols_load(opt + 8)) {
+                return -1;
+            }
+        } else if (g_str_has_prefix(opt, "lr=")) {
+            lr_reg = g_ascii_strtoll(opt + 3, NULL, 0);
+        } else if (g_str_has_prefix(opt, "task=")) {
+            task_addr = g_ascii_strtoull(opt + 5, NULL, 0);
+            task_addr_set = true;
+        } else if (g_str_has_prefix(opt, "ptrsize=")) {
+            ptr_size = g_ascii_strtoull(opt + 8, NULL, 0);
+        } else if (g_strcmp0(opt, "bigendian") == 0) {
+            big_endian = true;
+        } else if (g_str_has_prefix(opt, "outfile=")) {
+            outfile = g_strdup(opt + 8);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+    if (period == 0) {
+        fprintf(stderr, "sampler: period must be non-zero\n");
+        return -1;
+    }
+    if (ptr_size != 4 && ptr_size != 8) {
+        fprintf(stderr, "sampler: ptrsize must be 4 or 8\n");
+        return -1;
+    }
+
+    state = qemu_plugin_scoreboard_new(sizeof(VcpuSamples));
+    insns = qemu_plugin_scoreboard_u64_in_struct(state, VcpuSamples, insns);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * RTOS task accounting
+ *
+ * Attribute executed instructions to the tasks of a guest RTOS, such as
+ * DryOS. The plugin watches the entry of the scheduler's context switch
+ * routine and, each time it is reached, reads the current task pointer
+ * from a fixed guest address: the instructions executed since the
+ * previous switch belong to that task, which is being switched out.
+ *
+ * Counting is done inline into per-vCPU state and the switch callback
+ * only touches the tables of the vCPU it runs on, so nothing is locked
+ * while the guest runs.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define TASK_NAME_MAX 32
+
+typedef struct {
+    uint64_t task;
+    char *name;
+    uint64_t insns;
+    uint64_t switches;
+} TaskStats;
+
+typedef struct {
+    uint64_t insns;         /* instructions since the last switch */
+    GHashTable *tasks;      /* task pointer -> TaskStats */
+} VcpuTasks;
+
+static struct qemu_plugin_scoreboard *state;
+static qemu_plugin_u64 insns;
+
+static GMutex lock;
+static unsigned int n_vcpus;
+
+static uint64_t switch_addr;
+static uint64_t current_addr;
+static int64_t name_offset = -1;
+static unsigned int ptr_size = 4;
+static bool big_endian;
+static int limit = 32;
+
+static uint64_t read_ptr(uint64_t addr, bool *ok)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    uint64_t val = 0;
+    unsigned int i;
+
+    *ok = qemu_plugin_read_memory_vaddr(addr, buf, ptr_size);
+    if (!*ok) {
+        return 0;
+    }
+    for (i = 0; i < ptr_size; i++) {
+        unsigned int b = big_endian ? i : ptr_size - 1 - i;
+        val = (val << 8) | buf->data[b];
+    }
+    return val;
+}
+
+/* Read the name of @task, if the layout of the task structure is known */
+static char *read_task_name(uint64_t task)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    uint64_t name;
+    bool ok;
+
+    if (name_offset < 0) {
+        return NULL;
+    }
+    name = read_ptr(task + name_offset, &ok);
+    if (!ok || !qemu_plugin_read_memory_vaddr(name, buf, TASK_NAME_MAX)) {
+        return NULL;
+    }
+    return g_strndup((const char *)buf->data, TASK_NAME_MAX);
+}
+
+static void vcpu_switch(unsigned int cpu_index, void *udata)
+{
+    VcpuTasks *v = qemu_plugin_scoreboard_find(state, cpu_index);
+    TaskStats *t;
+    uint64_t task;
+    bool ok;
+
+    task = read_ptr(current_addr, &ok);
+    if (!ok) {
+        return;
+    }
+    t = g_hash_table_lookup(v->tasks, &task);
+    if (!t) {
+        t = g_new0(TaskStats, 1);
+        t->task = task;
+        t->name = read_task_name(task);
+        g_hash_table_insert(v->tasks, &t->task, t);
+    }
+    t->insns += v->insns;
+    t->switches++;
+    v->insns = 0;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, insns, n);
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        if (qemu_plugin_insn_vaddr(insn) == switch_addr) {
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_switch,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   NULL);
+        }
+    }
+}
+
+static void task_stats_free(gpointer data)
+{
+    TaskStats *t = data;
+
+    g_free(t->name);
+    g_free(t);
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    VcpuTasks *v = qemu_plugin_scoreboard_find(state, cpu_index);
+
+    v->tasks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                     task_stats_free);
+
+    g_mutex_lock(&lock);
+    n_vcpus = MAX(n_vcpus, cpu_index + 1);
+    g_mutex_unlock(&lock);
+}
+
+static gint cmp_insns(gconstpointer a, gconstpointer b)
+{
+    const TaskStats *ta = a, *tb = b;
+
+    return ta->insns > tb->insns ? -1 : ta->insns < tb->insns;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+    g_autoptr(GHashTable) all =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    uint64_t total = 0, unattributed = 0, switches = 0;
+    GList *tasks, *it;
+    unsigned int i;
+    int j;
+
+    /* merge the per-vCPU tables */
+    for (i = 0; i < n_vcpus; i++) {
+        VcpuTasks *v = qemu_plugin_scoreboard_find(state, i);
+        GHashTableIter iter;
+        TaskStats *t;
+
+        if (!v->tasks) {
+            continue;
+        }
+        unattributed += v->insns;
+        g_hash_table_iter_init(&iter, v->tasks);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&t)) {
+            TaskStats *sum = g_hash_table_lookup(all, &t->task);
+
+            if (!sum) {
+                sum = g_new0(TaskStats, 1);
+                sum->task = t->task;
+                sum->name = t->name;
+                g_hash_table_insert(all, &sum->task, sum);
+            }
+            sum->insns += t->insns;
+            sum->switches += t->switches;
+            total += t->insns;
+            switches += t->switches;
+        }
+    }
+    total += unattributed;
+
+    g_string_append_printf(report, "%" PRIu64 " instructions, %" PRIu64
+                           " context switches\n", total, switches);
+    g_string_append_printf(report, "task, name, insns, %%insns, switches, "
+                           "insns/switch\n");
+    tasks = g_list_sort(g_hash_table_get_values(all), cmp_insns);
+    for (it = tasks, j = 0; it && j < limit; it = it->next, j++) {
+        TaskStats *t = it->data;
+
+        g_string_append_printf(report, "0x%08" PRIx64 ", %s, %" PRIu64
+                               ", %.2f%%, %" PRIu64 ", %" PRIu64 "\n",
+                               t->task, t->name ? t->name : "-", t->insns,
+                               total ? t->insns * 100.0 / total : 0.0,
+                               t->switches, t->insns / t->switches);
+    }
+    g_list_free(tasks);
+    g_string_append_printf(report, "%" PRIu64 " instructions since the "
+                           "last switch are not attributed\n", unattributed);
+    qemu_plugin_outs(report->str);
+
+    for (i = 0; i < n_vcpus; i++) {
+        VcpuTasks *v = qemu_plugin_scoreboard_find(state, i);
+
+        if (v->tasks) {
+            g_hash_table_destroy(v->tasks);
+        }
+    }
+    qemu_plugin_scoreboard_free(state);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    bool have_switch = false, have_current = false;
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        if (g_str_has_prefix(opt, "switch=")) {
+            switch_addr = g_ascii_strtoull(opt + 7, NULL, 0);
+            have_switch = true;
+        } else if (g_str_has_prefix(opt, "current=")) {
+            current_addr = g_ascii_strtoull(opt + 8, NULL, 0);
+            have_current = true;
+        } else if (g_str_has_prefix(opt, "name=")) {
+            name_offset = g_ascii_strtoll(opt + 5, NULL, 0);
+        } else if (g_str_has_prefix(opt, "ptrsize=")) {
+            ptr_size = g_ascii_strtoull(opt + 8, NULL, 0);
+        } else if (g_str_has_prefix(opt, "limit=")) {
+            limit = g_ascii_strtoll(opt + 6, NULL, 10);
+        } else if (g_strcmp0(opt, "bigendian") == 0) {
+            big_endian = true;
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+    if (!have_switch || !have_current) {
+        fprintf(stderr, "taskstat: switch= and current= are required\n");
+        return -1;
+    }
+    if (ptr_size != 4 && ptr_size != 8) {
+        fprintf(stderr, "taskstat: ptrsize must be 4 or 8\n");
+        return -1;
+    }
+
+    state = qemu_plugin_scoreboard_new(sizeof(VcpuTasks));
+    insns = qemu_plugin_scoreboard_u64_in_struct(state, VcpuTasks, insns);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
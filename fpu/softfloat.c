@@ -401,6 +401,103 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Hardfloat integer conversions.  Scaling by a power of 2 is exact as
+ * long as the result neither overflows nor becomes denormal, so the
+ * conversion rounds only once; inexact is already set by can_use_fpu().
+ * We keep |scale| < 64, which satisfies that for any 64-bit integer and
+ * for the scaling of a float32 computed in double precision.
+ */
+#define HARDFLOAT_MAX_SCALE 63
+
+static inline float hard_f32_pow2(int scale)
+{
+    union_float32 u;
+
+    u.s = make_float32((uint32_t)(0x7f + scale) << 23);
+    return u.h;
+}
+
+static inline double hard_f64_pow2(int scale)
+{
+    union_float64 u;
+
+    u.s = make_float64((uint64_t)(0x3ff + scale) << 52);
+    return u.h;
+}
+
+/*
+ * Round the zero or normal @d, scaled by 2**@scale, to an integer in
+ * [@min, @limit[.  Return false if the soft path must be used instead:
+ * unsupported rounding mode, invalid result or possible overflow.
+ */
+static inline bool hard_f64_to_int(double d, FloatRoundMode rmode, int scale,
+                                   double min, double limit, double *r)
+{
+    if (scale) {
+        d *= hard_f64_pow2(scale);
+    }
+    switch (rmode) {
+    case float_round_nearest_even:
+        /* can_use_fpu() implies that this is also the host rounding mode */
+        d = rint(d);
+        break;
+    case float_round_to_zero:
+        d = trunc(d);
+        break;
+    default:
+        return false;
+    }
+    if (!(d >= min && d < limit)) {
+        return false;
+    }
+    *r = d;
+    return true;
+}
+
+static inline bool f32_to_int_use_fpu(float32 *a, FloatRoundMode rmode,
+                                      int scale, double min, double limit,
+                                      float_status *s, double *r)
+{
+    union_float32 ua;
+
+    if (unlikely(!can_use_fpu(s)) ||
+        unlikely(scale < 0 || scale > HARDFLOAT_MAX_SCALE)) {
+        return false;
+    }
+    float32_input_flush1(a, s);
+    if (unlikely(!float32_is_zero_or_normal(*a))) {
+        return false;
+    }
+    ua.s = *a;
+    return hard_f64_to_int(ua.h, rmode, scale, min, limit, r);
+}
+
+static inline bool f64_to_int_use_fpu(float64 *a, FloatRoundMode rmode,
+                                      int scale, double min, double limit,
+                                      float_status *s, double *r)
+{
+    union_float64 ua;
+
+    if (unlikely(!can_use_fpu(s)) ||
+        unlikely(scale < 0 || scale > HARDFLOAT_MAX_SCALE)) {
+        return false;
+    }
+    float64_input_flush1(a, s);
+    if (unlikely(!float64_is_zero_or_normal(*a))) {
+        return false;
+    }
+    ua.s = *a;
+    return hard_f64_to_int(ua.h, rmode, scale, min, limit, r);
+}
+
+#define HARD_INT32_MIN  -0x1p31
+#define HARD_INT32_LIM  0x1p31
+#define HARD_UINT32_LIM 0x1p32
+#define HARD_INT64_MIN  -0x1p63
+#define HARD_INT64_LIM  0x1p63
+#define HARD_UINT64_LIM 0x1p64
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -2960,6 +3057,12 @@ int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f32_to_int_use_fpu(&a, rmode, scale, HARD_INT32_MIN, HARD_INT32_LIM,
+                           s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2969,6 +3072,12 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f32_to_int_use_fpu(&a, rmode, scale, HARD_INT64_MIN, HARD_INT64_LIM,
+                           s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -2987,6 +3096,12 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f64_to_int_use_fpu(&a, rmode, scale, HARD_INT32_MIN, HARD_INT32_LIM,
+                           s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -2996,6 +3111,12 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f64_to_int_use_fpu(&a, rmode, scale, HARD_INT64_MIN, HARD_INT64_LIM,
+                           s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -3286,6 +3407,11 @@ uint32_t float32_to_uint32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f32_to_int_use_fpu(&a, rmode, scale, 0, HARD_UINT32_LIM, s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
@@ -3295,6 +3421,11 @@ uint64_t float32_to_uint64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f32_to_int_use_fpu(&a, rmode, scale, 0, HARD_UINT64_LIM, s, &r)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
@@ -3313,6 +3444,11 @@ uint32_t float64_to_uint32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f64_to_int_use_fpu(&a, rmode, scale, 0, HARD_UINT32_LIM, s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
@@ -3322,6 +3458,11 @@ uint64_t float64_to_uint64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    double r;
+
+    if (f64_to_int_use_fpu(&a, rmode, scale, 0, HARD_UINT64_LIM, s, &r)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
@@ -3563,10 +3704,14 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* With limited scaling, there are no overflow or underflow concerns. */
+    if (likely(scale >= -HARDFLOAT_MAX_SCALE && scale <= HARDFLOAT_MAX_SCALE)
+        && can_use_fpu(status)) {
         union_float32 ur;
         ur.h = a;
+        if (scale) {
+            ur.h *= hard_f32_pow2(scale);
+        }
         return ur.s;
     }
 
@@ -3603,10 +3748,14 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* With limited scaling, there are no overflow or underflow concerns. */
+    if (likely(scale >= -HARDFLOAT_MAX_SCALE && scale <= HARDFLOAT_MAX_SCALE)
+        && can_use_fpu(status)) {
         union_float64 ur;
         ur.h = a;
+        if (scale) {
+            ur.h *= hard_f64_pow2(scale);
+        }
         return ur.s;
     }
 
@@ -3744,10 +3893,14 @@ float32 uint64_to_float32_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* With limited scaling, there are no overflow or underflow concerns. */
+    if (likely(scale >= -HARDFLOAT_MAX_SCALE && scale <= HARDFLOAT_MAX_SCALE)
+        && can_use_fpu(status)) {
         union_float32 ur;
         ur.h = a;
+        if (scale) {
+            ur.h *= hard_f32_pow2(scale);
+        }
         return ur.s;
     }
 
@@ -3784,10 +3937,14 @@ float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /* With limited scaling, there are no overflow or underflow concerns. */
+    if (likely(scale >= -HARDFLOAT_MAX_SCALE && scale <= HARDFLOAT_MAX_SCALE)
+        && can_use_fpu(status)) {
         union_float64 ur;
         ur.h = a;
+        if (scale) {
+            ur.h *= hard_f64_pow2(scale);
+        }
         return ur.s;
     }
 
@@ -30,6 +30,7 @@
 #include "qemu/ctype.h"
 #include "qemu/cutils.h"
 #include "qemu/module.h"
+#include "qemu/units.h"
 #include "trace/trace-root.h"
 #ifdef CONFIG_USER_ONLY
 #include "qemu.h"
@@ -42,11 +43,12 @@
 #include "hw/boards.h"
 #endif
 
-#define MAX_PACKET_LENGTH 4096
+#define MAX_PACKET_LENGTH 0x20000
 
 #include "qemu/sockets.h"
 #include "sysemu/hw_accel.h"
 #include "sysemu/kvm.h"
+#include "sysemu/tcg.h"
 #include "sysemu/runstate.h"
 #include "semihosting/semihost.h"
 #include "exec/exec-all.h"
@@ -391,6 +393,8 @@ static int get_sstep_flags(void)
 
 static GDBState gdbserver_state;
 
+static void gdb_agent_init(void);
+
 static void init_gdbserver_state(void)
 {
     g_assert(!gdbserver_state.init);
@@ -399,6 +403,7 @@ static void init_gdbserver_state(void)
     gdbserver_state.str_buf = g_string_new(NULL);
     gdbserver_state.mem_buf = g_byte_array_sized_new(MAX_PACKET_LENGTH);
     gdbserver_state.last_packet = g_byte_array_sized_new(MAX_PACKET_LENGTH + 4);
+    gdb_agent_init();
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -698,25 +703,42 @@ static void put_strbuf(void)
     put_packet(gdbserver_state.str_buf->str);
 }
 
-/* Encode data using the encoding for 'x' packets.  */
-static void memtox(GString *buf, const char *mem, int len)
+/*
+ * Encode data using the encoding for 'x' packets, stopping before @buf
+ * grows beyond @max bytes. Returns the number of bytes of @mem encoded.
+ */
+static int memtox(GString *buf, const char *mem, int len, size_t max)
 {
-    char c;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        char c = mem[i];
 
-    while (len--) {
-        c = *(mem++);
         switch (c) {
         case '#': case '$': case '*': case '}':
+            if (buf->len + 2 > max) {
+                return i;
+            }
             g_string_append_c(buf, '}');
             g_string_append_c(buf, c ^ 0x20);
             break;
         default:
+            if (buf->len + 1 > max) {
+                return i;
+            }
             g_string_append_c(buf, c);
             break;
         }
     }
+    return len;
 }
 
+/*
+ * The largest payload of a reply: MAX_PACKET_LENGTH, as advertised in
+ * PacketSize, also has to hold the "$" and "#xx" framing.
+ */
+#define MAX_REPLY_LENGTH (MAX_PACKET_LENGTH - 4)
+
 static uint32_t gdb_get_cpu_pid(CPUState *cpu)
 {
     /* TODO: In user mode, we should use the task state PID */
@@ -1025,29 +1047,931 @@ static inline int xlat_gdb_type(CPUState *cpu, int gdbtype)
 }
 #endif
 
-static int gdb_breakpoint_insert(int type, target_ulong addr, target_ulong len)
+/*
+ * Agent expressions, conditional breakpoints and tracepoints
+ *
+ * gdb can attach conditions to its breakpoints and define tracepoints,
+ * both expressed in its agent expression bytecode. Rather than stopping
+ * for gdb to evaluate them, they are evaluated here, in the vCPU thread,
+ * when the TB at the breakpoint is looked up (see check_for_breakpoints
+ * in accel/tcg/cpu-exec.c). Only breakpoint hits whose condition holds
+ * stop the VM; tracepoint hits record a trace frame and never stop it.
+ *
+ * Breakpoint sites and tracepoint definitions only change while the
+ * vCPUs are stopped; the trace buffer and trace state variables are
+ * updated by the vCPUs and are protected by gdb_agent.lock.
+ */
+
+#define AGENT_STACK_SIZE    64
+#define AGENT_MAX_STEPS     10000
+#define TRACE_BUFFER_SIZE   (5 * MiB)
+
+/* Agent expression opcodes, as in gdb's ax.def */
+enum {
+    AX_ADD = 0x02,
+    AX_SUB,
+    AX_MUL,
+    AX_DIV_SIGNED,
+    AX_DIV_UNSIGNED,
+    AX_REM_SIGNED,
+    AX_REM_UNSIGNED,
+    AX_LSH,
+    AX_RSH_SIGNED,
+    AX_RSH_UNSIGNED,
+    AX_TRACE,
+    AX_TRACE_QUICK,
+    AX_LOG_NOT,
+    AX_BIT_AND,
+    AX_BIT_OR,
+    AX_BIT_XOR,
+    AX_BIT_NOT,
+    AX_EQUAL,
+    AX_LESS_SIGNED,
+    AX_LESS_UNSIGNED,
+    AX_EXT,
+    AX_REF8,
+    AX_REF16,
+    AX_REF32,
+    AX_REF64,
+    AX_IF_GOTO = 0x20,
+    AX_GOTO,
+    AX_CONST8,
+    AX_CONST16,
+    AX_CONST32,
+    AX_CONST64,
+    AX_REG,
+    AX_END,
+    AX_DUP,
+    AX_POP,
+    AX_ZERO_EXT,
+    AX_SWAP,
+    AX_GETV,
+    AX_SETV,
+    AX_TRACEV,
+    AX_TRACENZ,
+    AX_TRACE16,
+    AX_PICK = 0x32,
+    AX_ROT,
+};
+
+typedef enum {
+    TRACE_ACTION_MEM,       /* M basereg,offset,len */
+    TRACE_ACTION_EXPR,      /* X len,expr */
+} TraceActionType;
+
+typedef struct TraceAction {
+    TraceActionType type;
+    int basereg;            /* -1 for an absolute address */
+    uint64_t offset;
+    uint64_t len;
+    GByteArray *expr;
+} TraceAction;
+
+typedef struct Tracepoint {
+    int num;
+    target_ulong addr;
+    bool enabled;
+    uint64_t pass;          /* stop tracing after this many hits, or 0 */
+    uint64_t hits;
+    size_t traced;          /* bytes of trace buffer used */
+    GByteArray *cond;
+    GArray *actions;        /* of TraceAction */
+} Tracepoint;
+
+typedef struct TraceStateVar {
+    int num;
+    int64_t initial;
+    int64_t value;
+} TraceStateVar;
+
+typedef struct TraceBlock {
+    target_ulong addr;
+    uint32_t len;
+    uint32_t offset;        /* in TraceFrame.data */
+} TraceBlock;
+
+typedef struct TraceFrame {
+    int tp;
+    target_ulong pc;
+    GByteArray *regs;       /* all 'g' registers */
+    GArray *blocks;         /* of TraceBlock */
+    GByteArray *data;
+    GArray *tsvs;           /* of TraceStateVar, as collected */
+    size_t size;
+} TraceFrame;
+
+typedef struct TraceRange {
+    target_ulong start;
+    target_ulong end;
+} TraceRange;
+
+typedef enum {
+    TRACE_NOT_RUN,
+    TRACE_STOPPED,
+    TRACE_FULL,
+    TRACE_PASSCOUNT,
+} TraceStopReason;
+
+/* A pc with a gdb breakpoint, tracepoints, or both */
+typedef struct GDBBreakpointSite {
+    uint64_t pc;
+    bool breakpoint;
+    GPtrArray *conds;       /* stop if any is true, or NULL to always stop */
+    GPtrArray *tracepoints;
+} GDBBreakpointSite;
+
+typedef struct GDBAgentState {
+    GHashTable *sites;          /* pc -> GDBBreakpointSite */
+    GPtrArray *tracepoints;
+    GArray *readonly;           /* of TraceRange, readable in any frame */
+
+    QemuMutex lock;
+    GHashTable *tsvs;           /* number -> TraceStateVar */
+    GPtrArray *frames;
+    bool running;
+    TraceStopReason stop_reason;
+    int stop_tp;
+    size_t buffer_size;
+    size_t buffer_used;
+    unsigned int created;
+
+    int cur_frame;              /* selected with QTFrame, or -1 */
+} GDBAgentState;
+
+static GDBAgentState gdb_agent;
+
+static void gdb_site_free(gpointer data)
+{
+    GDBBreakpointSite *site = data;
+
+    if (site->conds) {
+        g_ptr_array_unref(site->conds);
+    }
+    g_ptr_array_unref(site->tracepoints);
+    g_free(site);
+}
+
+static void gdb_tracepoint_free(gpointer data)
+{
+    Tracepoint *tp = data;
+    int i;
+
+    for (i = 0; i < tp->actions->len; i++) {
+        TraceAction *action = &g_array_index(tp->actions, TraceAction, i);
+
+        if (action->expr) {
+            g_byte_array_unref(action->expr);
+        }
+    }
+    g_array_free(tp->actions, true);
+    if (tp->cond) {
+        g_byte_array_unref(tp->cond);
+    }
+    g_free(tp);
+}
+
+static void gdb_trace_frame_free(gpointer data)
+{
+    TraceFrame *frame = data;
+
+    g_byte_array_unref(frame->regs);
+    g_array_free(frame->blocks, true);
+    g_byte_array_unref(frame->data);
+    g_array_free(frame->tsvs, true);
+    g_free(frame);
+}
+
+static void gdb_agent_init(void)
+{
+    gdb_agent.sites = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            NULL, gdb_site_free);
+    gdb_agent.tracepoints = g_ptr_array_new_with_free_func(gdb_tracepoint_free);
+    gdb_agent.readonly = g_array_new(false, false, sizeof(TraceRange));
+    qemu_mutex_init(&gdb_agent.lock);
+    gdb_agent.tsvs = g_hash_table_new_full(g_int_hash, g_int_equal,
+                                           NULL, g_free);
+    gdb_agent.frames = g_ptr_array_new_with_free_func(gdb_trace_frame_free);
+    gdb_agent.buffer_size = TRACE_BUFFER_SIZE;
+    gdb_agent.cur_frame = -1;
+}
+
+/*
+ * Parse an agent expression, "X<len>,<hex bytes>", advancing *p past it.
+ */
+static GByteArray *gdb_agent_parse_expr(const char **p)
+{
+    const char *s = *p;
+    unsigned long len;
+    GByteArray *expr;
+    int i;
+
+    if (*s != 'X' || qemu_strtoul(s + 1, &s, 16, &len) || *s != ',' ||
+        len == 0 || len > MAX_PACKET_LENGTH / 2) {
+        return NULL;
+    }
+    s++;
+    for (i = 0; i < len * 2; i++) {
+        if (!qemu_isxdigit(s[i])) {
+            return NULL;
+        }
+    }
+
+    expr = g_byte_array_sized_new(len);
+    hextomem(expr, s, len);
+    *p = s + len * 2;
+    return expr;
+}
+
+/* Parse the breakpoint conditions of a Z packet, "X...[;X...]" */
+static GPtrArray *gdb_agent_parse_conds(const char *p)
+{
+    GPtrArray *conds =
+        g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+
+    while (*p) {
+        GByteArray *expr = gdb_agent_parse_expr(&p);
+
+        if (!expr || (*p && *p++ != ';')) {
+            if (expr) {
+                g_byte_array_unref(expr);
+            }
+            g_ptr_array_unref(conds);
+            return NULL;
+        }
+        g_ptr_array_add(conds, expr);
+    }
+    return conds;
+}
+
+/* Load a target-endian value of @size bytes */
+static uint64_t gdb_agent_ld(const uint8_t *buf, int size)
+{
+    switch (size) {
+    case 1:
+        return ldub_p(buf);
+    case 2:
+        return lduw_p(buf);
+    case 4:
+        return (uint32_t)ldl_p(buf);
+    default:
+        return ldq_p(buf);
+    }
+}
+
+static bool gdb_agent_reg(CPUState *cpu, int reg, uint64_t *val)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    int size = gdb_read_register(cpu, buf, reg);
+
+    if (size != 1 && size != 2 && size != 4 && size < 8) {
+        return false;
+    }
+    /* Wider registers, e.g. vectors, yield their first 8 bytes */
+    *val = gdb_agent_ld(buf->data, size);
+    return true;
+}
+
+static bool gdb_trace_collect(CPUState *cpu, TraceFrame *frame,
+                              target_ulong addr, uint64_t len)
+{
+    TraceBlock block = {
+        .addr = addr,
+        .offset = frame->data->len,
+    };
+
+    len = MIN(len, gdb_agent.buffer_size);
+    g_byte_array_set_size(frame->data, block.offset + len);
+    if (target_memory_rw_debug(cpu, addr, frame->data->data + block.offset,
+                               len, false)) {
+        g_byte_array_set_size(frame->data, block.offset);
+        return false;
+    }
+    block.len = len;
+    g_array_append_val(frame->blocks, block);
+    frame->size += sizeof(block) + len;
+    return true;
+}
+
+/* Collect a string of up to @len bytes, including its terminating NUL */
+static bool gdb_trace_collect_nz(CPUState *cpu, TraceFrame *frame,
+                                 target_ulong addr, uint64_t len)
+{
+    uint64_t n;
+    uint8_t c;
+
+    for (n = 0; n < len; n++) {
+        if (target_memory_rw_debug(cpu, addr + n, &c, 1, false)) {
+            return false;
+        }
+        if (!c) {
+            n++;
+            break;
+        }
+    }
+    return gdb_trace_collect(cpu, frame, addr, n);
+}
+
+/* Fetch a big-endian operand of @n bytes from @expr at *pc */
+static bool gdb_agent_operand(GByteArray *expr, int *pc, int n, uint64_t *val)
+{
+    int i;
+
+    if (*pc + n > expr->len) {
+        return false;
+    }
+    *val = 0;
+    for (i = 0; i < n; i++) {
+        *val = (*val << 8) | expr->data[(*pc)++];
+    }
+    return true;
+}
+
+static TraceStateVar *gdb_agent_tsv(int num)
+{
+    return g_hash_table_lookup(gdb_agent.tsvs, &num);
+}
+
+/*
+ * Run the agent expression @expr. When @frame is not NULL the trace
+ * opcodes record into it, otherwise they only pop their operands. On
+ * success, the value at the top of the stack is stored in @result.
+ */
+static bool gdb_agent_eval(CPUState *cpu, GByteArray *expr,
+                           TraceFrame *frame, int64_t *result)
+{
+    uint64_t stack[AGENT_STACK_SIZE];
+    int pc = 0, sp = 0, steps = 0;
+
+#define NEED(n)                                         \
+    do {                                                \
+        if (sp < (n)) {                                 \
+            return false;                               \
+        }                                               \
+    } while (0)
+#define ROOM(n)                                         \
+    do {                                                \
+        if (sp + (n) > AGENT_STACK_SIZE) {              \
+            return false;                               \
+        }                                               \
+    } while (0)
+#define OPERAND(n, v)                                   \
+    do {                                                \
+        if (!gdb_agent_operand(expr, &pc, (n), &(v))) { \
+            return false;                               \
+        }                                               \
+    } while (0)
+#define TOP stack[sp - 1]
+
+    while (pc < expr->len) {
+        uint8_t op = expr->data[pc++];
+        uint64_t a = 0, b, n;
+        TraceStateVar *tsv;
+        uint8_t buf[8];
+
+        if (++steps > AGENT_MAX_STEPS) {
+            return false;
+        }
+
+        switch (op) {
+        case AX_ADD ... AX_RSH_UNSIGNED:
+        case AX_BIT_AND ... AX_BIT_XOR:
+        case AX_EQUAL ... AX_LESS_UNSIGNED:
+            NEED(2);
+            b = stack[--sp];
+            a = TOP;
+            switch (op) {
+            case AX_ADD:
+                a += b;
+                break;
+            case AX_SUB:
+                a -= b;
+                break;
+            case AX_MUL:
+                a *= b;
+                break;
+            case AX_DIV_SIGNED:
+                if (!b) {
+                    return false;
+                }
+                a = (int64_t)b == -1 ? -a : (int64_t)a / (int64_t)b;
+                break;
+            case AX_DIV_UNSIGNED:
+                if (!b) {
+                    return false;
+                }
+                a /= b;
+                break;
+            case AX_REM_SIGNED:
+                if (!b) {
+                    return false;
+                }
+                a = (int64_t)b == -1 ? 0 : (int64_t)a % (int64_t)b;
+                break;
+            case AX_REM_UNSIGNED:
+                if (!b) {
+                    return false;
+                }
+                a %= b;
+                break;
+            case AX_LSH:
+                a = b < 64 ? a << b : 0;
+                break;
+            case AX_RSH_SIGNED:
+                a = (int64_t)a >> MIN(b, 63);
+                break;
+            case AX_RSH_UNSIGNED:
+                a = b < 64 ? a >> b : 0;
+                break;
+            case AX_BIT_AND:
+                a &= b;
+                break;
+            case AX_BIT_OR:
+                a |= b;
+                break;
+            case AX_BIT_XOR:
+                a ^= b;
+                break;
+            case AX_EQUAL:
+                a = a == b;
+                break;
+            case AX_LESS_SIGNED:
+                a = (int64_t)a < (int64_t)b;
+                break;
+            case AX_LESS_UNSIGNED:
+                a = a < b;
+                break;
+            }
+            TOP = a;
+            break;
+        case AX_LOG_NOT:
+            NEED(1);
+            TOP = !TOP;
+            break;
+        case AX_BIT_NOT:
+            NEED(1);
+            TOP = ~TOP;
+            break;
+        case AX_EXT:
+            OPERAND(1, n);
+            NEED(1);
+            if (n && n < 64) {
+                TOP = sextract64(TOP, 0, n);
+            }
+            break;
+        case AX_ZERO_EXT:
+            OPERAND(1, n);
+            NEED(1);
+            if (n && n < 64) {
+                TOP = extract64(TOP, 0, n);
+            }
+            break;
+        case AX_REF8 ... AX_REF64:
+            NEED(1);
+            n = 1 << (op - AX_REF8);
+            if (target_memory_rw_debug(cpu, TOP, buf, n, false)) {
+                return false;
+            }
+            TOP = gdb_agent_ld(buf, n);
+            break;
+        case AX_TRACE:
+            NEED(2);
+            b = stack[--sp];
+            a = stack[--sp];
+            if (frame && !gdb_trace_collect(cpu, frame, a, b)) {
+                return false;
+            }
+            break;
+        case AX_TRACE_QUICK:
+        case AX_TRACE16:
+            OPERAND(op == AX_TRACE16 ? 2 : 1, n);
+            NEED(1);
+            if (frame && !gdb_trace_collect(cpu, frame, TOP, n)) {
+                return false;
+            }
+            break;
+        case AX_TRACENZ:
+            NEED(2);
+            b = stack[--sp];
+            a = stack[--sp];
+            if (frame && !gdb_trace_collect_nz(cpu, frame, a, b)) {
+                return false;
+            }
+            break;
+        case AX_IF_GOTO:
+            OPERAND(2, n);
+            NEED(1);
+            if (stack[--sp]) {
+                pc = n;
+            }
+            break;
+        case AX_GOTO:
+            OPERAND(2, n);
+            pc = n;
+            break;
+        case AX_CONST8:
+        case AX_CONST16:
+        case AX_CONST32:
+        case AX_CONST64:
+            OPERAND(1 << (op - AX_CONST8), n);
+            ROOM(1);
+            stack[sp++] = n;
+            break;
+        case AX_REG:
+            OPERAND(2, n);
+            ROOM(1);
+            if (!gdb_agent_reg(cpu, n, &a)) {
+                return false;
+            }
+            stack[sp++] = a;
+            break;
+        case AX_END:
+            *result = sp ? TOP : 0;
+            return true;
+        case AX_DUP:
+            NEED(1);
+            ROOM(1);
+            stack[sp] = TOP;
+            sp++;
+            break;
+        case AX_POP:
+            NEED(1);
+            sp--;
+            break;
+        case AX_SWAP:
+            NEED(2);
+            a = TOP;
+            TOP = stack[sp - 2];
+            stack[sp - 2] = a;
+            break;
+        case AX_PICK:
+            OPERAND(1, n);
+            NEED(n + 1);
+            ROOM(1);
+            stack[sp] = stack[sp - 1 - n];
+            sp++;
+            break;
+        case AX_ROT:
+            /* a b c => c a b */
+            NEED(3);
+            a = TOP;
+            TOP = stack[sp - 2];
+            stack[sp - 2] = stack[sp - 3];
+            stack[sp - 3] = a;
+            break;
+        case AX_GETV:
+        case AX_SETV:
+        case AX_TRACEV:
+            OPERAND(2, n);
+            qemu_mutex_lock(&gdb_agent.lock);
+            tsv = gdb_agent_tsv(n);
+            if (tsv) {
+                if (op == AX_GETV) {
+                    a = tsv->value;
+                } else if (op == AX_SETV) {
+                    if (sp) {
+                        tsv->value = TOP;
+                    }
+                } else if (frame) {
+                    TraceStateVar v = *tsv;
+
+                    g_array_append_val(frame->tsvs, v);
+                    frame->size += sizeof(v);
+                }
+            }
+            qemu_mutex_unlock(&gdb_agent.lock);
+            if (!tsv || (op == AX_SETV && !sp)) {
+                return false;
+            }
+            if (op == AX_GETV) {
+                ROOM(1);
+                stack[sp++] = a;
+            }
+            break;
+        default:
+            /* floating point, printf and invalid opcodes */
+            return false;
+        }
+    }
+    return false;
+
+#undef NEED
+#undef ROOM
+#undef TOP
+#undef OPERAND
+}
+
+static void gdb_trace_stop(TraceStopReason reason, int tp)
+{
+    if (gdb_agent.running) {
+        qatomic_set(&gdb_agent.running, false);
+        gdb_agent.stop_reason = reason;
+        gdb_agent.stop_tp = tp;
+    }
+}
+
+static void gdb_tracepoint_hit(CPUState *cpu, Tracepoint *tp)
+{
+    TraceFrame *frame;
+    int64_t val;
+    int i;
+
+    if (!tp->enabled ||
+        (tp->cond && (!gdb_agent_eval(cpu, tp->cond, NULL, &val) || !val))) {
+        return;
+    }
+
+    frame = g_new0(TraceFrame, 1);
+    frame->tp = tp->num;
+    frame->pc = tp->addr;
+    frame->regs = g_byte_array_new();
+    frame->blocks = g_array_new(false, false, sizeof(TraceBlock));
+    frame->data = g_byte_array_new();
+    frame->tsvs = g_array_new(false, false, sizeof(TraceStateVar));
+
+    /* Registers are always collected, whatever the R actions ask for */
+    for (i = 0; i < cpu->gdb_num_g_regs; i++) {
+        gdb_read_register(cpu, frame->regs, i);
+    }
+    frame->size = sizeof(*frame) + frame->regs->len;
+
+    for (i = 0; i < tp->actions->len; i++) {
+        TraceAction *action = &g_array_index(tp->actions, TraceAction, i);
+        uint64_t base = 0;
+
+        switch (action->type) {
+        case TRACE_ACTION_MEM:
+            if (action->basereg >= 0 &&
+                !gdb_agent_reg(cpu, action->basereg, &base)) {
+                break;
+            }
+            gdb_trace_collect(cpu, frame, base + action->offset, action->len);
+            break;
+        case TRACE_ACTION_EXPR:
+            gdb_agent_eval(cpu, action->expr, frame, &val);
+            break;
+        }
+    }
+
+    qemu_mutex_lock(&gdb_agent.lock);
+    if (!gdb_agent.running) {
+        gdb_trace_frame_free(frame);
+    } else if (gdb_agent.buffer_used + frame->size > gdb_agent.buffer_size) {
+        gdb_trace_frame_free(frame);
+        gdb_trace_stop(TRACE_FULL, 0);
+    } else {
+        g_ptr_array_add(gdb_agent.frames, frame);
+        gdb_agent.buffer_used += frame->size;
+        gdb_agent.created++;
+        tp->traced += frame->size;
+        if (++tp->hits == tp->pass) {
+            gdb_trace_stop(TRACE_PASSCOUNT, tp->num);
+        }
+    }
+    qemu_mutex_unlock(&gdb_agent.lock);
+}
+
+bool gdb_breakpoint_is_conditional(vaddr pc)
+{
+    GDBBreakpointSite *site = g_hash_table_lookup(gdb_agent.sites, &pc);
+
+    return site && (site->conds || site->tracepoints->len);
+}
+
+bool gdb_breakpoint_hit(CPUState *cpu, vaddr pc)
+{
+    GDBBreakpointSite *site = g_hash_table_lookup(gdb_agent.sites, &pc);
+    int64_t val;
+    int i;
+
+    if (!site) {
+        return true;
+    }
+
+    if (qatomic_read(&gdb_agent.running)) {
+        for (i = 0; i < site->tracepoints->len; i++) {
+            gdb_tracepoint_hit(cpu, g_ptr_array_index(site->tracepoints, i));
+        }
+    }
+
+    if (!site->breakpoint) {
+        return false;
+    }
+    if (!site->conds) {
+        return true;
+    }
+    /*
+     * As with gdbserver, a condition that cannot be evaluated, e.g.
+     * because of unreadable memory, reports the hit.
+     */
+    for (i = 0; i < site->conds->len; i++) {
+        if (!gdb_agent_eval(cpu, g_ptr_array_index(site->conds, i),
+                            NULL, &val) || val) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Get the site at @pc, inserting its breakpoint in every CPU if new */
+static int gdb_site_get(target_ulong pc, GDBBreakpointSite **psite)
+{
+    uint64_t key = pc;
+    GDBBreakpointSite *site = g_hash_table_lookup(gdb_agent.sites, &key);
+    CPUState *cpu;
+    int err;
+
+    if (!site) {
+        CPU_FOREACH(cpu) {
+            err = cpu_breakpoint_insert(cpu, pc, BP_GDB, NULL);
+            if (err) {
+                CPU_FOREACH(cpu) {
+                    cpu_breakpoint_remove(cpu, pc, BP_GDB);
+                }
+                return err;
+            }
+        }
+        site = g_new0(GDBBreakpointSite, 1);
+        site->pc = pc;
+        site->tracepoints = g_ptr_array_new();
+        g_hash_table_insert(gdb_agent.sites, &site->pc, site);
+    }
+    *psite = site;
+    return 0;
+}
+
+/* Drop @site, and its breakpoint, once nothing uses it */
+static void gdb_site_put(GDBBreakpointSite *site)
 {
     CPUState *cpu;
+
+    if (site->breakpoint || site->tracepoints->len) {
+        return;
+    }
+    CPU_FOREACH(cpu) {
+        cpu_breakpoint_remove(cpu, site->pc, BP_GDB);
+    }
+    g_hash_table_remove(gdb_agent.sites, &site->pc);
+}
+
+static void gdb_trace_uninstall(void)
+{
+    GList *sites = g_hash_table_get_values(gdb_agent.sites);
+    GList *it;
+
+    for (it = sites; it; it = it->next) {
+        GDBBreakpointSite *site = it->data;
+
+        g_ptr_array_set_size(site->tracepoints, 0);
+        gdb_site_put(site);
+    }
+    g_list_free(sites);
+}
+
+static int gdb_trace_install(void)
+{
+    GDBBreakpointSite *site;
+    int i, err;
+
+    for (i = 0; i < gdb_agent.tracepoints->len; i++) {
+        Tracepoint *tp = g_ptr_array_index(gdb_agent.tracepoints, i);
+
+        if (!tp->enabled) {
+            continue;
+        }
+        err = gdb_site_get(tp->addr, &site);
+        if (err) {
+            gdb_trace_uninstall();
+            return err;
+        }
+        g_ptr_array_add(site->tracepoints, tp);
+    }
+    return 0;
+}
+
+/*
+ * Forget every site, once all gdb breakpoints have been removed from
+ * the CPUs, and stop tracing.
+ */
+static void gdb_agent_reset(void)
+{
+    g_hash_table_remove_all(gdb_agent.sites);
+    qemu_mutex_lock(&gdb_agent.lock);
+    gdb_trace_stop(TRACE_STOPPED, 0);
+    qemu_mutex_unlock(&gdb_agent.lock);
+    gdb_agent.cur_frame = -1;
+}
+
+/* The trace frame selected with QTFrame, if any */
+static TraceFrame *gdb_trace_cur_frame(void)
+{
+    TraceFrame *frame = NULL;
+
+    if (gdb_agent.cur_frame < 0) {
+        return NULL;
+    }
+    qemu_mutex_lock(&gdb_agent.lock);
+    if (gdb_agent.cur_frame < gdb_agent.frames->len) {
+        frame = g_ptr_array_index(gdb_agent.frames, gdb_agent.cur_frame);
+    }
+    qemu_mutex_unlock(&gdb_agent.lock);
+    return frame;
+}
+
+/*
+ * Read register @reg of @frame into @buf. Registers have the same size
+ * in every frame as in the live CPU, which gives their offset.
+ */
+static int gdb_trace_frame_reg(CPUState *cpu, TraceFrame *frame,
+                               GByteArray *buf, int reg)
+{
+    g_autoptr(GByteArray) scratch = g_byte_array_new();
+    int i, offset = 0, size = 0;
+
+    if (reg >= cpu->gdb_num_g_regs) {
+        return 0;
+    }
+    for (i = 0; i <= reg; i++) {
+        offset += size;
+        g_byte_array_set_size(scratch, 0);
+        size = gdb_read_register(cpu, scratch, i);
+    }
+    if (offset + size > frame->regs->len) {
+        return 0;
+    }
+    g_byte_array_append(buf, frame->regs->data + offset, size);
+    return size;
+}
+
+/*
+ * Read memory as it was when @frame was collected. Returns the number
+ * of bytes available at @addr, which may be fewer than @len.
+ */
+static int gdb_trace_frame_mem(CPUState *cpu, TraceFrame *frame,
+                               target_ulong addr, uint8_t *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < frame->blocks->len; i++) {
+        TraceBlock *block = &g_array_index(frame->blocks, TraceBlock, i);
+
+        if (addr >= block->addr && addr - block->addr < block->len) {
+            len = MIN(len, block->len - (addr - block->addr));
+            memcpy(buf, frame->data->data + block->offset +
+                   (addr - block->addr), len);
+            return len;
+        }
+    }
+
+    /* Read-only sections are the same in every frame */
+    for (i = 0; i < gdb_agent.readonly->len; i++) {
+        TraceRange *r = &g_array_index(gdb_agent.readonly, TraceRange, i);
+
+        if (addr >= r->start && addr < r->end) {
+            len = MIN(len, r->end - addr);
+            if (target_memory_rw_debug(cpu, addr, buf, len, false)) {
+                return 0;
+            }
+            return len;
+        }
+    }
+    return 0;
+}
+
+static int gdb_breakpoint_insert(int type, target_ulong addr, target_ulong len,
+                                 GPtrArray *conds)
+{
+    GDBBreakpointSite *site;
+    CPUState *cpu;
     int err = 0;
 
     if (kvm_enabled()) {
+        if (conds) {
+            return -EINVAL;
+        }
         return kvm_insert_breakpoint(gdbserver_state.c_cpu, addr, len, type);
     }
 
     switch (type) {
     case GDB_BREAKPOINT_SW:
     case GDB_BREAKPOINT_HW:
-        CPU_FOREACH(cpu) {
-            err = cpu_breakpoint_insert(cpu, addr, BP_GDB, NULL);
-            if (err) {
-                break;
-            }
+        err = gdb_site_get(addr, &site);
+        if (err) {
+            return err;
         }
-        return err;
+        /* Inserting again replaces the conditions */
+        site->breakpoint = true;
+        if (site->conds) {
+            g_ptr_array_unref(site->conds);
+        }
+        site->conds = conds ? g_ptr_array_ref(conds) : NULL;
+        return 0;
 #ifndef CONFIG_USER_ONLY
     case GDB_WATCHPOINT_WRITE:
     case GDB_WATCHPOINT_READ:
     case GDB_WATCHPOINT_ACCESS:
+        if (conds) {
+            return -EINVAL;
+        }
         CPU_FOREACH(cpu) {
             err = cpu_watchpoint_insert(cpu, addr, len,
                                         xlat_gdb_type(cpu, type), NULL);
@@ -1064,6 +1988,8 @@ static int gdb_breakpoint_insert(int type, target_ulong addr, target_ulong len)
 
 static int gdb_breakpoint_remove(int type, target_ulong addr, target_ulong len)
 {
+    GDBBreakpointSite *site;
+    uint64_t key = addr;
     CPUState *cpu;
     int err = 0;
 
@@ -1074,13 +2000,17 @@ static int gdb_breakpoint_remove(int type, target_ulong addr, target_ulong len)
     switch (type) {
     case GDB_BREAKPOINT_SW:
     case GDB_BREAKPOINT_HW:
-        CPU_FOREACH(cpu) {
-            err = cpu_breakpoint_remove(cpu, addr, BP_GDB);
-            if (err) {
-                break;
-            }
+        site = g_hash_table_lookup(gdb_agent.sites, &key);
+        if (!site || !site->breakpoint) {
+            return -ENOENT;
         }
-        return err;
+        site->breakpoint = false;
+        if (site->conds) {
+            g_ptr_array_unref(site->conds);
+            site->conds = NULL;
+        }
+        gdb_site_put(site);
+        return 0;
 #ifndef CONFIG_USER_ONLY
     case GDB_WATCHPOINT_WRITE:
     case GDB_WATCHPOINT_READ:
@@ -1114,6 +2044,7 @@ static void gdb_process_breakpoint_remove_all(GDBProcess *p)
         gdb_cpu_breakpoint_remove_all(cpu);
         cpu = gdb_next_cpu_in_process(cpu);
     }
+    gdb_agent_reset();
 }
 
 static void gdb_breakpoint_remove_all(void)
@@ -1128,6 +2059,7 @@ static void gdb_breakpoint_remove_all(void)
     CPU_FOREACH(cpu) {
         gdb_cpu_breakpoint_remove_all(cpu);
     }
+    gdb_agent_reset();
 }
 
 static void gdb_set_cpu_pc(target_ulong pc)
@@ -1653,16 +2585,26 @@ static void handle_set_thread(GArray *params, void *user_ctx)
 
 static void handle_insert_bp(GArray *params, void *user_ctx)
 {
+    g_autoptr(GPtrArray) conds = NULL;
     int res;
 
-    if (params->len != 3) {
+    if (params->len != 3 && params->len != 4) {
         put_packet("E22");
         return;
     }
 
+    /* Z0/Z1 may carry conditions: ";X<len>,<expr>[;X<len>,<expr>...]" */
+    if (params->len == 4) {
+        conds = gdb_agent_parse_conds(get_param(params, 3)->data);
+        if (!conds) {
+            put_packet("E22");
+            return;
+        }
+    }
+
     res = gdb_breakpoint_insert(get_param(params, 0)->val_ul,
                                 get_param(params, 1)->val_ull,
-                                get_param(params, 2)->val_ull);
+                                get_param(params, 2)->val_ull, conds);
     if (res >= 0) {
         put_packet("OK");
         return;
@@ -1731,6 +2673,7 @@ static void handle_set_reg(GArray *params, void *user_ctx)
 
 static void handle_get_reg(GArray *params, void *user_ctx)
 {
+    TraceFrame *frame;
     int reg_size;
 
     if (!gdb_has_xml) {
@@ -1743,9 +2686,16 @@ static void handle_get_reg(GArray *params, void *user_ctx)
         return;
     }
 
-    reg_size = gdb_read_register(gdbserver_state.g_cpu,
-                                 gdbserver_state.mem_buf,
-                                 get_param(params, 0)->val_ull);
+    frame = gdb_trace_cur_frame();
+    if (frame) {
+        reg_size = gdb_trace_frame_reg(gdbserver_state.g_cpu, frame,
+                                       gdbserver_state.mem_buf,
+                                       get_param(params, 0)->val_ull);
+    } else {
+        reg_size = gdb_read_register(gdbserver_state.g_cpu,
+                                     gdbserver_state.mem_buf,
+                                     get_param(params, 0)->val_ull);
+    }
     if (!reg_size) {
         put_packet("E14");
         return;
@@ -1786,13 +2736,16 @@ static void handle_write_mem(GArray *params, void *user_ctx)
 
 static void handle_read_mem(GArray *params, void *user_ctx)
 {
+    TraceFrame *frame;
+    int len;
+
     if (params->len != 2) {
         put_packet("E22");
         return;
     }
 
     /* memtohex() doubles the required space */
-    if (get_param(params, 1)->val_ull > MAX_PACKET_LENGTH / 2) {
+    if (get_param(params, 1)->val_ull > MAX_REPLY_LENGTH / 2) {
         put_packet("E22");
         return;
     }
@@ -1800,10 +2753,22 @@ static void handle_read_mem(GArray *params, void *user_ctx)
     g_byte_array_set_size(gdbserver_state.mem_buf,
                           get_param(params, 1)->val_ull);
 
-    if (target_memory_rw_debug(gdbserver_state.g_cpu,
-                               get_param(params, 0)->val_ull,
-                               gdbserver_state.mem_buf->data,
-                               gdbserver_state.mem_buf->len, false)) {
+    frame = gdb_trace_cur_frame();
+    if (frame) {
+        len = gdb_trace_frame_mem(gdbserver_state.g_cpu, frame,
+                                  get_param(params, 0)->val_ull,
+                                  gdbserver_state.mem_buf->data,
+                                  gdbserver_state.mem_buf->len);
+        if (!len) {
+            /* not collected */
+            put_packet("E01");
+            return;
+        }
+        g_byte_array_set_size(gdbserver_state.mem_buf, len);
+    } else if (target_memory_rw_debug(gdbserver_state.g_cpu,
+                                      get_param(params, 0)->val_ull,
+                                      gdbserver_state.mem_buf->data,
+                                      gdbserver_state.mem_buf->len, false)) {
         put_packet("E14");
         return;
     }
@@ -1813,6 +2778,50 @@ static void handle_read_mem(GArray *params, void *user_ctx)
     put_strbuf();
 }
 
+/*
+ * Binary memory read: the reply is "b" followed by the data in the
+ * escaped binary encoding, which is about half the size of the hex
+ * encoding of 'm' replies. The reply may be shorter than requested if
+ * the data does not fit in a packet.
+ */
+static void handle_read_mem_binary(GArray *params, void *user_ctx)
+{
+    TraceFrame *frame;
+    uint64_t len;
+
+    if (params->len != 2) {
+        put_packet("E22");
+        return;
+    }
+
+    len = MIN(get_param(params, 1)->val_ull, MAX_REPLY_LENGTH - 1);
+    g_byte_array_set_size(gdbserver_state.mem_buf, len);
+
+    frame = gdb_trace_cur_frame();
+    if (frame) {
+        len = gdb_trace_frame_mem(gdbserver_state.g_cpu, frame,
+                                  get_param(params, 0)->val_ull,
+                                  gdbserver_state.mem_buf->data, len);
+        if (!len) {
+            put_packet("E01");
+            return;
+        }
+    } else if (target_memory_rw_debug(gdbserver_state.g_cpu,
+                                      get_param(params, 0)->val_ull,
+                                      gdbserver_state.mem_buf->data,
+                                      gdbserver_state.mem_buf->len, false)) {
+        put_packet("E14");
+        return;
+    }
+
+    g_string_assign(gdbserver_state.str_buf, "b");
+    memtox(gdbserver_state.str_buf,
+           (const char *)gdbserver_state.mem_buf->data, len,
+           MAX_REPLY_LENGTH);
+    put_packet_binary(gdbserver_state.str_buf->str,
+                      gdbserver_state.str_buf->len, true);
+}
+
 static void handle_write_all_regs(GArray *params, void *user_ctx)
 {
     target_ulong addr, len;
@@ -1838,8 +2847,16 @@ static void handle_write_all_regs(GArray *params, void *user_ctx)
 
 static void handle_read_all_regs(GArray *params, void *user_ctx)
 {
+    TraceFrame *frame = gdb_trace_cur_frame();
     target_ulong addr, len;
 
+    if (frame) {
+        memtohex(gdbserver_state.str_buf, frame->regs->data,
+                 frame->regs->len);
+        put_strbuf();
+        return;
+    }
+
     cpu_synchronize_state(gdbserver_state.g_cpu);
     g_byte_array_set_size(gdbserver_state.mem_buf, 0);
     len = 0;
@@ -2178,7 +3195,13 @@ static void handle_query_supported(GArray *params, void *user_ctx)
         gdbserver_state.multiprocess = true;
     }
 
-    g_string_append(gdbserver_state.str_buf, ";vContSupported+;multiprocess+");
+    if (tcg_enabled()) {
+        g_string_append(gdbserver_state.str_buf,
+                        ";ConditionalBreakpoints+;ConditionalTracepoints+");
+    }
+
+    g_string_append(gdbserver_state.str_buf,
+                    ";vContSupported+;multiprocess+;binary-upload+");
     put_strbuf();
 }
 
@@ -2218,16 +3241,11 @@ static void handle_query_xfer_features(GArray *params, void *user_ctx)
         return;
     }
 
-    if (len > (MAX_PACKET_LENGTH - 5) / 2) {
-        len = (MAX_PACKET_LENGTH - 5) / 2;
-    }
-
-    if (len < total_len - addr) {
-        g_string_assign(gdbserver_state.str_buf, "m");
-        memtox(gdbserver_state.str_buf, xml + addr, len);
-    } else {
-        g_string_assign(gdbserver_state.str_buf, "l");
-        memtox(gdbserver_state.str_buf, xml + addr, total_len - addr);
+    len = MIN(len, total_len - addr);
+    g_string_assign(gdbserver_state.str_buf, "m");
+    if (addr + memtox(gdbserver_state.str_buf, xml + addr, len,
+                      MAX_REPLY_LENGTH) == total_len) {
+        gdbserver_state.str_buf->str[0] = 'l';
     }
 
     put_packet_binary(gdbserver_state.str_buf->str,
@@ -2256,17 +3274,7 @@ static void handle_query_xfer_auxv(GArray *params, void *user_ctx)
         return;
     }
 
-    if (len > (MAX_PACKET_LENGTH - 5) / 2) {
-        len = (MAX_PACKET_LENGTH - 5) / 2;
-    }
-
-    if (len < auxv_len - offset) {
-        g_string_assign(gdbserver_state.str_buf, "m");
-    } else {
-        g_string_assign(gdbserver_state.str_buf, "l");
-        len = auxv_len - offset;
-    }
-
+    len = MIN(len, MIN(auxv_len - offset, MAX_REPLY_LENGTH - 1));
     g_byte_array_set_size(gdbserver_state.mem_buf, len);
     if (target_memory_rw_debug(gdbserver_state.g_cpu, saved_auxv + offset,
                                gdbserver_state.mem_buf->data, len, false)) {
@@ -2274,8 +3282,12 @@ static void handle_query_xfer_auxv(GArray *params, void *user_ctx)
         return;
     }
 
-    memtox(gdbserver_state.str_buf,
-           (const char *)gdbserver_state.mem_buf->data, len);
+    g_string_assign(gdbserver_state.str_buf, "m");
+    if (offset + memtox(gdbserver_state.str_buf,
+                        (const char *)gdbserver_state.mem_buf->data, len,
+                        MAX_REPLY_LENGTH) == auxv_len) {
+        gdbserver_state.str_buf->str[0] = 'l';
+    }
     put_packet_binary(gdbserver_state.str_buf->str,
                       gdbserver_state.str_buf->len, true);
 }
@@ -2319,6 +3331,435 @@ static void handle_set_qemu_phy_mem_mode(GArray *params, void *user_ctx)
 }
 #endif
 
+/*
+ * Tracepoint packets. The definitions are only changed while tracing is
+ * stopped; the frames are then read back with QTFrame and the usual
+ * register and memory packets.
+ */
+static void handle_trace_init(GArray *params, void *user_ctx)
+{
+    if (!tcg_enabled()) {
+        put_packet("");
+        return;
+    }
+
+    gdb_trace_uninstall();
+    qemu_mutex_lock(&gdb_agent.lock);
+    gdb_trace_stop(TRACE_STOPPED, 0);
+    gdb_agent.stop_reason = TRACE_NOT_RUN;
+    g_ptr_array_set_size(gdb_agent.frames, 0);
+    gdb_agent.buffer_used = 0;
+    gdb_agent.created = 0;
+    g_hash_table_remove_all(gdb_agent.tsvs);
+    qemu_mutex_unlock(&gdb_agent.lock);
+    g_ptr_array_set_size(gdb_agent.tracepoints, 0);
+    g_array_set_size(gdb_agent.readonly, 0);
+    gdb_agent.cur_frame = -1;
+    put_packet("OK");
+}
+
+static Tracepoint *gdb_tracepoint_find(int num, target_ulong addr)
+{
+    int i;
+
+    for (i = 0; i < gdb_agent.tracepoints->len; i++) {
+        Tracepoint *tp = g_ptr_array_index(gdb_agent.tracepoints, i);
+
+        if (tp->num == num && tp->addr == addr) {
+            return tp;
+        }
+    }
+    return NULL;
+}
+
+/* Parse the actions of a "QTDP:-n:addr:..." packet into @tp */
+static bool gdb_tracepoint_parse_actions(Tracepoint *tp, const char *p)
+{
+    TraceAction action;
+    unsigned long basereg;
+
+    /* while-stepping actions are not supported, and are ignored */
+    if (*p == 'S') {
+        return true;
+    }
+
+    while (*p && *p != '-') {
+        memset(&action, 0, sizeof(action));
+        switch (*p) {
+        case 'R':
+            /* all registers are collected anyway */
+            p++;
+            while (qemu_isxdigit(*p)) {
+                p++;
+            }
+            continue;
+        case 'M':
+            action.type = TRACE_ACTION_MEM;
+            if (qemu_strtoul(p + 1, &p, 16, &basereg) || *p++ != ',' ||
+                qemu_strtou64(p, &p, 16, &action.offset) || *p++ != ',' ||
+                qemu_strtou64(p, &p, 16, &action.len)) {
+                return false;
+            }
+            /* gdb sends -1 as a 32-bit value */
+            action.basereg = (int32_t)basereg;
+            break;
+        case 'X':
+            action.type = TRACE_ACTION_EXPR;
+            action.expr = gdb_agent_parse_expr(&p);
+            if (!action.expr) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        g_array_append_val(tp->actions, action);
+    }
+    return true;
+}
+
+static void handle_trace_define(GArray *params, void *user_ctx)
+{
+    const char *p = params->len ? get_param(params, 0)->data : "";
+    bool actions = *p == '-';
+    unsigned long num;
+    uint64_t addr, step, pass;
+    Tracepoint *tp;
+
+    if (gdb_agent.running) {
+        put_packet("E01");
+        return;
+    }
+
+    if (qemu_strtoul(p + actions, &p, 16, &num) || *p++ != ':' ||
+        qemu_strtou64(p, &p, 16, &addr) || *p++ != ':') {
+        put_packet("E22");
+        return;
+    }
+
+    if (actions) {
+        tp = gdb_tracepoint_find(num, addr);
+        if (!tp || !gdb_tracepoint_parse_actions(tp, p)) {
+            put_packet("E22");
+            return;
+        }
+        put_packet("OK");
+        return;
+    }
+
+    /* QTDP:n:addr:E|D:step:pass[:X<len>,<cond>][-] */
+    tp = g_new0(Tracepoint, 1);
+    tp->num = num;
+    tp->addr = addr;
+    tp->enabled = *p == 'E';
+    tp->actions = g_array_new(false, false, sizeof(TraceAction));
+    if ((*p != 'E' && *p != 'D') || p[1] != ':' ||
+        qemu_strtou64(p + 2, &p, 16, &step) || *p++ != ':' ||
+        qemu_strtou64(p, &p, 16, &pass)) {
+        goto fail;
+    }
+    tp->pass = pass;
+    while (*p == ':') {
+        p++;
+        /* fast and static tracepoints are not supported */
+        if (*p != 'X' || tp->cond) {
+            goto fail;
+        }
+        tp->cond = gdb_agent_parse_expr(&p);
+        if (!tp->cond) {
+            goto fail;
+        }
+    }
+    if (*p && strcmp(p, "-")) {
+        goto fail;
+    }
+    g_ptr_array_add(gdb_agent.tracepoints, tp);
+    put_packet("OK");
+    return;
+
+fail:
+    gdb_tracepoint_free(tp);
+    put_packet("E22");
+}
+
+/* QTDV:n:value:builtin:name */
+static void handle_trace_define_var(GArray *params, void *user_ctx)
+{
+    const char *p = params->len ? get_param(params, 0)->data : "";
+    TraceStateVar *tsv;
+    unsigned long num;
+    uint64_t value;
+
+    if (qemu_strtoul(p, &p, 16, &num) || *p++ != ':' ||
+        qemu_strtou64(p, &p, 16, &value)) {
+        put_packet("E22");
+        return;
+    }
+
+    qemu_mutex_lock(&gdb_agent.lock);
+    tsv = gdb_agent_tsv(num);
+    if (!tsv) {
+        tsv = g_new0(TraceStateVar, 1);
+        tsv->num = num;
+        g_hash_table_insert(gdb_agent.tsvs, &tsv->num, tsv);
+    }
+    tsv->initial = tsv->value = value;
+    qemu_mutex_unlock(&gdb_agent.lock);
+    put_packet("OK");
+}
+
+/* QTro:start,end[:start,end...] */
+static void handle_trace_readonly(GArray *params, void *user_ctx)
+{
+    const char *p = params->len ? get_param(params, 0)->data : "";
+    TraceRange r;
+    uint64_t start, end;
+
+    g_array_set_size(gdb_agent.readonly, 0);
+    while (*p == ':') {
+        if (qemu_strtou64(p + 1, &p, 16, &start) || *p++ != ',' ||
+            qemu_strtou64(p, &p, 16, &end)) {
+            g_array_set_size(gdb_agent.readonly, 0);
+            put_packet("E22");
+            return;
+        }
+        r.start = start;
+        r.end = end;
+        g_array_append_val(gdb_agent.readonly, r);
+    }
+    put_packet("OK");
+}
+
+static void handle_trace_buffer_size(GArray *params, void *user_ctx)
+{
+    const char *p = params->len ? get_param(params, 0)->data : "";
+    uint64_t size;
+
+    if (gdb_agent.running || qemu_strtou64(p, NULL, 16, &size)) {
+        put_packet("E22");
+        return;
+    }
+    /* -1 asks for the default size */
+    gdb_agent.buffer_size = size == UINT64_MAX ? TRACE_BUFFER_SIZE : size;
+    put_packet("OK");
+}
+
+static void handle_trace_start(GArray *params, void *user_ctx)
+{
+    GHashTableIter iter;
+    TraceStateVar *tsv;
+    int i;
+
+    if (!tcg_enabled() || gdb_agent.running) {
+        put_packet("E01");
+        return;
+    }
+
+    gdb_trace_uninstall();
+    qemu_mutex_lock(&gdb_agent.lock);
+    g_ptr_array_set_size(gdb_agent.frames, 0);
+    gdb_agent.buffer_used = 0;
+    gdb_agent.created = 0;
+    g_hash_table_iter_init(&iter, gdb_agent.tsvs);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&tsv)) {
+        tsv->value = tsv->initial;
+    }
+    for (i = 0; i < gdb_agent.tracepoints->len; i++) {
+        Tracepoint *tp = g_ptr_array_index(gdb_agent.tracepoints, i);
+
+        tp->hits = 0;
+        tp->traced = 0;
+    }
+    qemu_mutex_unlock(&gdb_agent.lock);
+    gdb_agent.cur_frame = -1;
+
+    if (gdb_trace_install()) {
+        put_packet("E01");
+        return;
+    }
+    qatomic_set(&gdb_agent.running, true);
+    put_packet("OK");
+}
+
+static void handle_trace_stop(GArray *params, void *user_ctx)
+{
+    qemu_mutex_lock(&gdb_agent.lock);
+    gdb_trace_stop(TRACE_STOPPED, 0);
+    qemu_mutex_unlock(&gdb_agent.lock);
+    gdb_trace_uninstall();
+    put_packet("OK");
+}
+
+static void handle_trace_status(GArray *params, void *user_ctx)
+{
+    static const char *const reasons[] = {
+        [TRACE_NOT_RUN] = "tnotrun:0",
+        [TRACE_STOPPED] = "tstop:0",
+        [TRACE_FULL] = "tfull:0",
+        [TRACE_PASSCOUNT] = "tpasscount:",
+    };
+
+    if (!tcg_enabled()) {
+        put_packet("");
+        return;
+    }
+
+    qemu_mutex_lock(&gdb_agent.lock);
+    if (gdb_agent.running) {
+        g_string_printf(gdbserver_state.str_buf, "T1;tnotrun:0");
+    } else {
+        g_string_printf(gdbserver_state.str_buf, "T0;%s",
+                        reasons[gdb_agent.stop_reason]);
+        if (gdb_agent.stop_reason == TRACE_PASSCOUNT) {
+            g_string_append_printf(gdbserver_state.str_buf, "%x",
+                                   gdb_agent.stop_tp);
+        }
+    }
+    g_string_append_printf(gdbserver_state.str_buf,
+                           ";tframes:%x;tcreated:%x;tfree:%zx;tsize:%zx"
+                           ";circular:0;disconn:0",
+                           gdb_agent.frames->len, gdb_agent.created,
+                           gdb_agent.buffer_size - gdb_agent.buffer_used,
+                           gdb_agent.buffer_size);
+    qemu_mutex_unlock(&gdb_agent.lock);
+    put_strbuf();
+}
+
+/* qTP:n:addr, the hit count and trace buffer usage of a tracepoint */
+static void handle_trace_point_status(GArray *params, void *user_ctx)
+{
+    Tracepoint *tp;
+
+    if (params->len != 2) {
+        put_packet("E22");
+        return;
+    }
+
+    tp = gdb_tracepoint_find(get_param(params, 0)->val_ul,
+                             get_param(params, 1)->val_ull);
+    if (!tp) {
+        put_packet("");
+        return;
+    }
+    qemu_mutex_lock(&gdb_agent.lock);
+    g_string_printf(gdbserver_state.str_buf, "V%" PRIx64 ":%zx",
+                    tp->hits, tp->traced);
+    qemu_mutex_unlock(&gdb_agent.lock);
+    put_strbuf();
+}
+
+/* qTV:n, the value of a trace state variable, in the selected frame */
+static void handle_trace_var_value(GArray *params, void *user_ctx)
+{
+    TraceFrame *frame = gdb_trace_cur_frame();
+    TraceStateVar *tsv = NULL;
+    int num, i;
+
+    if (!params->len) {
+        put_packet("E22");
+        return;
+    }
+    num = get_param(params, 0)->val_ul;
+
+    qemu_mutex_lock(&gdb_agent.lock);
+    if (frame) {
+        for (i = frame->tsvs->len - 1; i >= 0; i--) {
+            if (g_array_index(frame->tsvs, TraceStateVar, i).num == num) {
+                tsv = &g_array_index(frame->tsvs, TraceStateVar, i);
+                break;
+            }
+        }
+    } else {
+        tsv = gdb_agent_tsv(num);
+    }
+    if (tsv) {
+        g_string_printf(gdbserver_state.str_buf, "V%" PRIx64, tsv->value);
+    } else {
+        g_string_assign(gdbserver_state.str_buf, "U");
+    }
+    qemu_mutex_unlock(&gdb_agent.lock);
+    put_strbuf();
+}
+
+/* Uploading the tracepoints and variables to gdb is not supported */
+static void handle_trace_upload(GArray *params, void *user_ctx)
+{
+    put_packet("l");
+}
+
+static bool gdb_trace_frame_match(TraceFrame *frame, const char *type,
+                                  uint64_t a, uint64_t b)
+{
+    if (!strcmp(type, "pc")) {
+        return frame->pc == a;
+    } else if (!strcmp(type, "tdp")) {
+        return frame->tp == a;
+    } else if (!strcmp(type, "range")) {
+        return frame->pc >= a && frame->pc <= b;
+    } else {
+        return frame->pc < a || frame->pc > b;
+    }
+}
+
+/*
+ * QTFrame:n, or QTFrame:pc:addr, tdp:t, range:start:end or
+ * outside:start:end to find the next frame that matches.
+ */
+static void handle_trace_frame(GArray *params, void *user_ctx)
+{
+    const char *p = params->len ? get_param(params, 0)->data : "";
+    static const char *const types[] = { "pc", "tdp", "range", "outside" };
+    const char *type = NULL;
+    uint64_t a, b = 0;
+    int i, found = -1;
+
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        if (g_str_has_prefix(p, types[i]) && p[strlen(types[i])] == ':') {
+            type = types[i];
+            p += strlen(type) + 1;
+            break;
+        }
+    }
+    if (qemu_strtou64(p, &p, 16, &a) ||
+        (type && i >= 2 && (*p++ != ':' || qemu_strtou64(p, &p, 16, &b))) ||
+        *p) {
+        put_packet("E22");
+        return;
+    }
+
+    qemu_mutex_lock(&gdb_agent.lock);
+    if (!type) {
+        if ((int32_t)a == -1) {
+            /* stop looking at trace frames */
+            gdb_agent.cur_frame = -1;
+            qemu_mutex_unlock(&gdb_agent.lock);
+            put_packet("OK");
+            return;
+        }
+        if (a < gdb_agent.frames->len) {
+            found = a;
+        }
+    } else {
+        for (i = gdb_agent.cur_frame + 1; i < gdb_agent.frames->len; i++) {
+            if (gdb_trace_frame_match(g_ptr_array_index(gdb_agent.frames, i),
+                                      type, a, b)) {
+                found = i;
+                break;
+            }
+        }
+    }
+    gdb_agent.cur_frame = found;
+    if (found >= 0) {
+        TraceFrame *frame = g_ptr_array_index(gdb_agent.frames, found);
+
+        g_string_printf(gdbserver_state.str_buf, "F%xT%x", found, frame->tp);
+    } else {
+        g_string_assign(gdbserver_state.str_buf, "F-1");
+    }
+    qemu_mutex_unlock(&gdb_agent.lock);
+    put_strbuf();
+}
+
 static const GdbCmdParseEntry gdb_gen_query_set_common_table[] = {
     /* Order is important if has same prefix */
     {
@@ -2407,6 +3848,38 @@ static const GdbCmdParseEntry gdb_gen_query_table[] = {
         .handler = handle_query_qemu_supported,
         .cmd = "qemu.Supported",
     },
+    {
+        .handler = handle_trace_status,
+        .cmd = "TStatus",
+    },
+    {
+        .handler = handle_trace_point_status,
+        .cmd = "TP:",
+        .cmd_startswith = 1,
+        .schema = "l:L0"
+    },
+    {
+        .handler = handle_trace_var_value,
+        .cmd = "TV:",
+        .cmd_startswith = 1,
+        .schema = "l0"
+    },
+    {
+        .handler = handle_trace_upload,
+        .cmd = "TfP",
+    },
+    {
+        .handler = handle_trace_upload,
+        .cmd = "TsP",
+    },
+    {
+        .handler = handle_trace_upload,
+        .cmd = "TfV",
+    },
+    {
+        .handler = handle_trace_upload,
+        .cmd = "TsV",
+    },
 #ifndef CONFIG_USER_ONLY
     {
         .handler = handle_query_qemu_phy_mem_mode,
@@ -2423,6 +3896,48 @@ static const GdbCmdParseEntry gdb_gen_set_table[] = {
         .cmd_startswith = 1,
         .schema = "l0"
     },
+    {
+        .handler = handle_trace_init,
+        .cmd = "Tinit",
+    },
+    {
+        .handler = handle_trace_define,
+        .cmd = "TDP:",
+        .cmd_startswith = 1,
+        .schema = "s0"
+    },
+    {
+        .handler = handle_trace_define_var,
+        .cmd = "TDV:",
+        .cmd_startswith = 1,
+        .schema = "s0"
+    },
+    {
+        .handler = handle_trace_readonly,
+        .cmd = "Tro",
+        .cmd_startswith = 1,
+        .schema = "s0"
+    },
+    {
+        .handler = handle_trace_buffer_size,
+        .cmd = "TBuffer:size:",
+        .cmd_startswith = 1,
+        .schema = "s0"
+    },
+    {
+        .handler = handle_trace_start,
+        .cmd = "TStart",
+    },
+    {
+        .handler = handle_trace_stop,
+        .cmd = "TStop",
+    },
+    {
+        .handler = handle_trace_frame,
+        .cmd = "TFrame:",
+        .cmd_startswith = 1,
+        .schema = "s0"
+    },
 #ifndef CONFIG_USER_ONLY
     {
         .handler = handle_set_qemu_phy_mem_mode,
@@ -2619,6 +4134,17 @@ static int gdb_handle_packet(const char *line_buf)
             cmd_parser = &read_mem_cmd_desc;
         }
         break;
+    case 'x':
+        {
+            static const GdbCmdParseEntry read_mem_binary_cmd_desc = {
+                .handler = handle_read_mem_binary,
+                .cmd = "x",
+                .cmd_startswith = 1,
+                .schema = "L,L0"
+            };
+            cmd_parser = &read_mem_binary_cmd_desc;
+        }
+        break;
     case 'M':
         {
             static const GdbCmdParseEntry write_mem_cmd_desc = {
@@ -2658,7 +4184,7 @@ static int gdb_handle_packet(const char *line_buf)
                 .handler = handle_insert_bp,
                 .cmd = "Z",
                 .cmd_startswith = 1,
-                .schema = "l?L?L0"
+                .schema = "l?L?L;s0"
             };
             cmd_parser = &insert_bp_cmd_desc;
         }
@@ -268,6 +268,23 @@ SRST
     Show memory tree.
 ERST
 
+    {
+        .name       = "mmio-stats",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the memory regions that took the most time in "
+                      "MMIO callbacks, up to max entries (default: 10)",
+        .cmd        = hmp_info_mmio_stats,
+    },
+
+SRST
+  ``info mmio-stats`` [*max*]
+    Show the number of MMIO reads and writes dispatched to the device
+    model of each memory region, and the time they took, for the *max*
+    regions with the highest total time. Collection is started with
+    ``mmio_stats on``.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "jit",
@@ -296,6 +313,23 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the most executed translation blocks, up to "
+                      "max entries (default: 10)",
+    },
+#endif
+
+SRST
+  ``info tb-profile`` [*max*]
+    Show execution count, exits, translation cost and code size of the
+    *max* most executed translation blocks. Requires
+    ``-accel tcg,tb-profile=on``.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
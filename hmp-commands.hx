@@ -285,6 +285,21 @@ SRST
   changes status of a trace event
 ERST
 
+    {
+        .name       = "mmio_stats",
+        .args_type  = "op:s",
+        .params     = "on|off|reset",
+        .help       = "start, stop or reset the collection of MMIO statistics",
+        .cmd        = hmp_mmio_stats,
+    },
+
+SRST
+``mmio_stats on|off|reset``
+  Start or stop counting and timing the MMIO accesses dispatched to each
+  memory region, or reset the statistics. They are shown with
+  ``info mmio-stats``.
+ERST
+
 #if defined(CONFIG_TRACE_SIMPLE)
     {
         .name       = "trace-file",
@@ -198,6 +198,10 @@ static void armv7m_realize(DeviceState *dev, Error **errp)
             return;
         }
     }
+    if (!object_property_set_bool(OBJECT(s->cpu), "local-exclusive-monitor",
+                                  s->local_excl_monitor, errp)) {
+        return;
+    }
 
     /*
      * Tell the CPU where the NVIC is; it will fail realize if it doesn't
@@ -266,6 +270,8 @@ static Property armv7m_properties[] = {
                      false),
     DEFINE_PROP_BOOL("vfp", ARMv7MState, vfp, true),
     DEFINE_PROP_BOOL("dsp", ARMv7MState, dsp, true),
+    DEFINE_PROP_BOOL("local-exclusive-monitor", ARMv7MState,
+                     local_excl_monitor, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
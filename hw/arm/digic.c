@@ -60,6 +60,12 @@ static void digic_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    /* DIGIC has a single core and no bus master that uses exclusives */
+    if (!object_property_set_bool(OBJECT(&s->cpu), "local-exclusive-monitor",
+                                  true, errp)) {
+        return;
+    }
+
     if (!qdev_realize(DEVICE(&s->cpu), NULL, errp)) {
         return;
     }
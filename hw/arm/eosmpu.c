@@ -326,6 +326,8 @@ static void eosmpu_init(MachineState *machine)
 
     qdev_prop_set_string(armv7m, "cpu-type", machine->cpu_type);
     qdev_prop_set_bit(armv7m, "enable-bitband", true);
+    /* Single core, and no DMA master takes part in the RTOS locking */
+    qdev_prop_set_bit(armv7m, "local-exclusive-monitor", true);
     object_property_set_link(OBJECT(&mms->armv7m), "memory",
                              OBJECT(system_memory), &error_abort);
     sysbus_realize(SYS_BUS_DEVICE(&mms->armv7m), &error_fatal);
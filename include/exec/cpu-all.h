@@ -31,6 +31,8 @@
 #define EXCP_HALTED     0x10003 /* cpu is halted (waiting for external event) */
 #define EXCP_YIELD      0x10004 /* cpu wants to yield timeslice to another */
 #define EXCP_ATOMIC     0x10005 /* stop-the-world and emulate atomic */
+#define EXCP_IDLE       0x10006 /* cpu is spinning in an idle loop */
+#define EXCP_QUANTUM    0x10007 /* cpu must wait for its serial turn */
 
 /* some important defines:
  *
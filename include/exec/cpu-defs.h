@@ -76,8 +76,18 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb is CPU_VTLB_WAYS-way set associative, with the set
+ * selected by the low bits of the page number.  CPU_VTLB_SETS must be
+ * a power of 2.
+ */
+#ifndef CPU_VTLB_SETS
+#define CPU_VTLB_SETS 8
+#endif
+#ifndef CPU_VTLB_WAYS
+#define CPU_VTLB_WAYS 4
+#endif
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -168,13 +178,21 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
+    /* The next way to replace in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
+    /*
+     * Statistics, read and written atomically like those in CPUTLBCommon.
+     * Fills count the entries installed by tlb_set_page, i.e. the page
+     * table walks that were not satisfied by the victim tlb.
+     */
+    size_t vtlb_hit_count;
+    size_t vtlb_miss_count;
+    size_t fill_count;
 } CPUTLBDesc;
 
 /*
@@ -498,6 +498,8 @@ struct TranslationBlock {
 #define CF_NO_GOTO_TB    0x00000200 /* Do not chain with goto_tb */
 #define CF_NO_GOTO_PTR   0x00000400 /* Do not chain with goto_ptr */
 #define CF_SINGLE_STEP   0x00000800 /* gdbstub single-step in effect */
+#define CF_QUANTUM       0x00001000 /* icount with MTTCG: serialize I/O, atomics */
+#define CF_BP_CHECK      0x00002000 /* gdb breakpoint checked by the TB */
 #define CF_LAST_IO       0x00008000 /* Last insn may be an IO access.  */
 #define CF_MEMI_ONLY     0x00010000 /* Only instrument memory ops */
 #define CF_USE_ICOUNT    0x00020000
@@ -517,6 +519,9 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /* Loop that only polls guest state, see translator_use_goto_tb() */
+    bool idle_loop;
+
     struct tb_tc tc;
 
     /* first and second physical page containing code. The lower bit
@@ -559,6 +564,9 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /* Execution profile, when enabled with -accel tcg,tb-profile=on */
+    struct TBProfile *prof;
 };
 
 /* Hide the qatomic_read to make code a little easier on the eyes */
@@ -47,6 +47,29 @@ void gdb_do_syscallv(gdb_syscall_complete_cb cb, const char *fmt, va_list va);
 int use_gdb_syscalls(void);
 void gdb_set_stop_cpu(CPUState *cpu);
 
+/**
+ * gdb_breakpoint_is_conditional: check whether a gdb breakpoint has work
+ * @pc: address of the breakpoint
+ *
+ * Returns true if there are tracepoints or breakpoint conditions at @pc.
+ * TCG then evaluates them with gdb_breakpoint_hit() each time the
+ * instruction at @pc executes, rather than always stopping there.
+ */
+bool gdb_breakpoint_is_conditional(vaddr pc);
+
+/**
+ * gdb_breakpoint_hit: evaluate a gdb breakpoint
+ * @cpu: CPU about to execute the instruction at @pc
+ * @pc: address of the breakpoint
+ *
+ * Called from the vCPU thread when a gdb breakpoint is reached. Any
+ * tracepoint at @pc collects its data, and the conditions gdb attached
+ * to the breakpoint are evaluated.
+ *
+ * Returns true if execution must stop and be reported to gdb.
+ */
+bool gdb_breakpoint_hit(CPUState *cpu, vaddr pc);
+
 /**
  * gdb_exit: exit gdb session, reporting inferior status
  * @code: exit code reported
@@ -10,7 +10,10 @@ static TCGOp *icount_start_insn;
 
 static inline void gen_io_start(void)
 {
-    TCGv_i32 tmp = tcg_const_i32(1);
+    TCGv_i32 tmp;
+
+    tcg_gen_quantum_serial();
+    tmp = tcg_const_i32(1);
     tcg_gen_st_i32(tmp, cpu_env,
                    offsetof(ArchCPU, parent_obj.can_do_io) -
                    offsetof(ArchCPU, env));
@@ -27,6 +27,7 @@
 #include "qemu/notify.h"
 #include "qom/object.h"
 #include "qemu/rcu.h"
+#include "qemu/stats64.h"
 
 #define RAM_ADDR_INVALID (~(ram_addr_t)0)
 
@@ -679,6 +680,14 @@ void ram_discard_manager_unregister_listener(RamDiscardManager *rdm,
 typedef struct CoalescedMemoryRange CoalescedMemoryRange;
 typedef struct MemoryRegionIoeventfd MemoryRegionIoeventfd;
 
+/* MMIO statistics of a region, see x-query-mmio-stats */
+typedef struct MemoryRegionStats {
+    Stat64 reads;
+    Stat64 read_ns;
+    Stat64 writes;
+    Stat64 write_ns;
+} MemoryRegionStats;
+
 /** MemoryRegion:
  *
  * A struct representing a memory region.
@@ -723,6 +732,9 @@ struct MemoryRegion {
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
     RamDiscardManager *rdm; /* Only for RAM */
+    bool stats_listed;
+    QTAILQ_ENTRY(MemoryRegion) stats_link;
+    MemoryRegionStats stats;
 };
 
 struct IOMMUMemoryRegion {
@@ -63,6 +63,10 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @num_followed: Number of direct branches followed within this TB.
+ * @idle_loop: The TB branches back to itself without side effects.
+ * @idle_checked: Value of @num_insns when @idle_body was computed.
+ * @idle_body: The ops generated up to then have no side effects.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -73,7 +77,11 @@ typedef struct DisasContextBase {
     DisasJumpType is_jmp;
     int num_insns;
     int max_insns;
+    int num_followed;
+    int idle_checked;
     bool singlestep_enabled;
+    bool idle_loop;
+    bool idle_body;
 } DisasContextBase;
 
 /**
@@ -144,6 +152,20 @@ void translator_loop_temp_check(DisasContextBase *db);
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_follow_branch
+ * @db: Disassembly context
+ * @dest: target pc of an unconditional direct branch
+ *
+ * Return true if, rather than ending the TB at the branch, translation
+ * may continue at @dest as if it were the next instruction.  This is
+ * limited to forward branches within the page of the TB, so that
+ * [pc_first, pc_next) still covers all of the guest code translated,
+ * and to the number of branches per TB set with
+ * "-accel tcg,follow-branches=N".  The caller must update pc_next.
+ */
+bool translator_follow_branch(DisasContextBase *db, target_ulong dest);
+
 /*
  * Translator Load Functions
  *
@@ -75,6 +75,7 @@ struct ARMv7MState {
     bool start_powered_off;
     bool vfp;
     bool dsp;
+    bool local_excl_monitor;
 };
 
 #endif
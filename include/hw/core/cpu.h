@@ -301,6 +301,10 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @tb_pretranslate: Queue of direct branch targets to translate while
+ *    the vCPU is halted; only touched by the vCPU's own thread.
+ * @tb_pretranslating: Set while translating one of those targets, so that
+ *    fetching code gives up instead of filling the TLB.
  *
  * State of one CPU core or thread.
  */
@@ -353,6 +357,14 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct TBPretranslateQueue *tb_pretranslate;
+    bool tb_pretranslating;
+    /* TB last looked up, and how often in a row if it is an idle loop */
+    TranslationBlock *idle_tb;
+    unsigned idle_spins;
+    /* MTTCG with icount: serial turn granted, and why one is needed */
+    bool quantum_turn;
+    int quantum_wait;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -364,6 +376,8 @@ struct CPUState {
 
     QTAILQ_HEAD(, CPUWatchpoint) watchpoints;
     CPUWatchpoint *watchpoint_hit;
+    /* @watchpoints indexed by address range, rebuilt on demand */
+    struct IntervalIndex *watchpoint_index;
 
     void *opaque;
 
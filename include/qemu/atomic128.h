@@ -78,13 +78,55 @@ static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
     return int128_make128(oldl, oldh);
 }
 # define HAVE_CMPXCHG128 1
+#elif defined(__x86_64__) && defined(CONFIG_INT128) && defined(CONFIG_CPUID_H)
+/*
+ * The compiler only emits cmpxchg16b with -mcx16, but all but the very
+ * first x86_64 processors implement it.  Test for it at run-time, so that
+ * a default build does not exit to cpu_exec_step_atomic() for every
+ * 16-byte guest atomic.
+ */
+extern bool have_cmpxchg16b;
+
+static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
+{
+    uint64_t cmpl = int128_getlo(cmp), cmph = int128_gethi(cmp);
+    uint64_t newl = int128_getlo(new), newh = int128_gethi(new);
+
+    asm volatile("lock cmpxchg16b %[mem]"
+                 : [mem] "+m"(*ptr), "+a"(cmpl), "+d"(cmph)
+                 : "b"(newl), "c"(newh)
+                 : "memory", "cc");
+
+    return int128_make128(cmpl, cmph);
+}
+# define HAVE_CMPXCHG128 likely(have_cmpxchg16b)
+# define HAVE_CMPXCHG16B_RUNTIME 1
 #else
-/* Fallback definition that must be optimized away, or error.  */
+/*
+ * Fallback definition that must be optimized away, or error.  Note that
+ * a lock-based implementation would not do: it would not be atomic with
+ * respect to the word-sized accesses described above.  Callers fall back
+ * to cpu_exec_step_atomic() instead.
+ */
 Int128 QEMU_ERROR("unsupported atomic")
     atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new);
 # define HAVE_CMPXCHG128 0
 #endif /* Some definition for HAVE_CMPXCHG128 */
 
+/*
+ * HAVE_CMPXCHG128 need not be a constant, and cannot be tested by the
+ * preprocessor.  HAVE_CMPXCHG128_MAYBE says whether atomic16_cmpxchg
+ * is defined at all, so that code calling it can be compiled.  Such code
+ * must still test HAVE_CMPXCHG128 before it is reached.
+ */
+#ifdef HAVE_CMPXCHG16B_RUNTIME
+# define HAVE_CMPXCHG128_MAYBE 1
+#elif HAVE_CMPXCHG128
+# define HAVE_CMPXCHG128_MAYBE 1
+#else
+# define HAVE_CMPXCHG128_MAYBE 0
+#endif
+
 
 #if defined(CONFIG_ATOMIC128)
 static inline Int128 atomic16_read(Int128 *ptr)
@@ -128,7 +170,7 @@ static inline void atomic16_set(Int128 *ptr, Int128 val)
 }
 
 # define HAVE_ATOMIC128 1
-#elif !defined(CONFIG_USER_ONLY) && HAVE_CMPXCHG128
+#elif !defined(CONFIG_USER_ONLY) && HAVE_CMPXCHG128_MAYBE
 static inline Int128 atomic16_read(Int128 *ptr)
 {
     /* Maybe replace 0 with 0, returning the old value.  */
@@ -144,7 +186,8 @@ static inline void atomic16_set(Int128 *ptr, Int128 val)
     } while (old != cmp);
 }
 
-# define HAVE_ATOMIC128 1
+# define HAVE_ATOMIC128 HAVE_CMPXCHG128
+# define HAVE_ATOMIC128_MAYBE 1
 #else
 /* Fallback definitions that must be optimized away, or error.  */
 Int128 QEMU_ERROR("unsupported atomic") atomic16_read(Int128 *ptr);
@@ -152,4 +195,8 @@ void QEMU_ERROR("unsupported atomic") atomic16_set(Int128 *ptr, Int128 val);
 # define HAVE_ATOMIC128 0
 #endif /* Some definition for HAVE_ATOMIC128 */
 
+#ifndef HAVE_ATOMIC128_MAYBE
+# define HAVE_ATOMIC128_MAYBE HAVE_ATOMIC128
+#endif
+
 #endif /* QEMU_ATOMIC128_H */
@@ -25,6 +25,9 @@
 #endif
 
 /* Leaf 1, %ecx */
+#ifndef bit_CMPXCHG16B
+#define bit_CMPXCHG16B  (1 << 13)
+#endif
 #ifndef bit_SSE4_1
 #define bit_SSE4_1      (1 << 19)
 #endif
@@ -48,6 +51,15 @@
 #ifndef bit_AVX512F
 #define bit_AVX512F        (1 << 16)
 #endif
+#ifndef bit_AVX512DQ
+#define bit_AVX512DQ    (1 << 17)
+#endif
+#ifndef bit_AVX512BW
+#define bit_AVX512BW    (1 << 30)
+#endif
+#ifndef bit_AVX512VL
+#define bit_AVX512VL    (1u << 31)
+#endif
 #ifndef bit_BMI2
 #define bit_BMI2        (1 << 8)
 #endif
@@ -0,0 +1,40 @@
+/*
+ * Index of closed intervals, for stabbing and overlap queries.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_INDEX_H
+#define QEMU_INTERVAL_INDEX_H
+
+/*
+ * An interval tree for sets that are queried far more often than they
+ * change, such as the watchpoints of a CPU.  The intervals are kept in
+ * an array sorted by start address, and the array is read as a balanced
+ * binary search tree: the root of [lo, hi) is its middle element.  Each
+ * node records the highest end address in its subtree, so that subtrees
+ * which cannot overlap the query are skipped.  A query that overlaps k
+ * intervals out of n then costs O(k log n), whatever their lengths.
+ *
+ * Inserting only appends; the first query after an insertion sorts the
+ * array again, in O(n log n).  Intervals cannot be removed: build a new
+ * index instead.  An IntervalIndex is not thread-safe.
+ */
+typedef struct IntervalIndex IntervalIndex;
+
+/* Called for each interval that overlaps the query, in start order. */
+typedef void IntervalIndexFn(uint64_t start, uint64_t last, uint64_t value,
+                             void *opaque);
+
+IntervalIndex *interval_index_new(void);
+void interval_index_free(IntervalIndex *idx);
+
+/* Add the interval [@start, @last] with the payload @value. */
+void interval_index_insert(IntervalIndex *idx, uint64_t start, uint64_t last,
+                           uint64_t value);
+
+/* Call @fn for every interval that overlaps [@start, @last]. */
+void interval_index_foreach(IntervalIndex *idx, uint64_t start, uint64_t last,
+                            IntervalIndexFn *fn, void *opaque);
+
+#endif /* QEMU_INTERVAL_INDEX_H */
@@ -69,6 +69,23 @@ enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
     PLUGIN_N_CB_SUBTYPES,
+    /*
+     * Conditional callbacks and address logs are kept with the inline
+     * ops, since they are generated inline the same way.
+     */
+    PLUGIN_CB_COND = PLUGIN_N_CB_SUBTYPES,
+    PLUGIN_CB_LOG,
+};
+
+/*
+ * A scoreboard holds one entry per vCPU. @data is reallocated, with all
+ * vCPUs stopped, when a vCPU beyond the allocated size is created; the
+ * generated code therefore loads it at run-time.
+ */
+struct qemu_plugin_scoreboard {
+    void *data;
+    size_t element_size;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
 /*
@@ -84,13 +101,45 @@ struct qemu_plugin_dyn_cb {
     enum qemu_plugin_mem_rw rw;
     /* fields specific to each dyn_cb type go here */
     union {
+        /* @entry.score is NULL for ops on the pointer in @userp */
         struct {
             enum qemu_plugin_op op;
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
+        /* regular mem callbacks: virtual addresses in [start, last] */
+        struct {
+            uint64_t start;
+            uint64_t last;
+        } range;
+        /* mem address logs: the records are at @offset in @count's slot */
+        struct {
+            qemu_plugin_u64 count;
+            size_t offset;
+            uint64_t mask;
+            uint64_t tag;
+        } log;
     };
 };
 
+static inline bool
+qemu_plugin_dyn_cb_filtered(const struct qemu_plugin_dyn_cb *cb)
+{
+    return cb->range.start != 0 || cb->range.last != UINT64_MAX;
+}
+
+static inline bool
+qemu_plugin_dyn_cb_in_range(const struct qemu_plugin_dyn_cb *cb,
+                            uint64_t vaddr)
+{
+    return vaddr - cb->range.start <= cb->range.last - cb->range.start;
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
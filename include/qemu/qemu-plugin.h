@@ -13,6 +13,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <glib.h>
 
 /*
  * For best performance, build the plugin with -fvisibility=hidden so that
@@ -50,7 +51,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -209,6 +210,19 @@ void qemu_plugin_register_vcpu_resume_cb(qemu_plugin_id_t id,
 struct qemu_plugin_tb;
 /** struct qemu_plugin_insn - Opaque handle for a translated instruction */
 struct qemu_plugin_insn;
+/** struct qemu_plugin_scoreboard - Opaque handle for a scoreboard */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
+ *
+ * This field allows to access a specific uint64_t member in one given entry,
+ * located at a specified offset. Inline operations expect this as entry.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
 
 /**
  * enum qemu_plugin_cb_flags - type of callback
@@ -269,16 +283,67 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                           enum qemu_plugin_cb_flags flags,
                                           void *userdata);
 
+/**
+ * enum qemu_plugin_cond - condition to enable callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: false
+ * @QEMU_PLUGIN_COND_ALWAYS: true
+ * @QEMU_PLUGIN_COND_EQ: is equal?
+ * @QEMU_PLUGIN_COND_NE: is not equal?
+ * @QEMU_PLUGIN_COND_LT: is less than?
+ * @QEMU_PLUGIN_COND_LE: is less than or equal?
+ * @QEMU_PLUGIN_COND_GT: is greater than?
+ * @QEMU_PLUGIN_COND_GE: is greater than or equal?
+ *
+ * Comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
+};
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - register conditional callback
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable callback
+ * @entry: first operand for condition
+ * @imm: second operand for condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when a translated unit executes if
+ * entry @cond imm is true, where @entry is read from the scoreboard
+ * slot of the executing vCPU. The test is generated inline, so the
+ * call only happens when the condition holds. If condition is
+ * QEMU_PLUGIN_COND_ALWAYS, this is equivalent to
+ * qemu_plugin_register_vcpu_tb_exec_cb. If condition is
+ * QEMU_PLUGIN_COND_NEVER, nothing is registered.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
- *
- * Note: currently only a single inline op is supported.
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
 };
 
 /**
@@ -299,6 +364,23 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - execution inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry to run op
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on a given scoreboard entry, in the slot of the
+ * vCPU executing the translated unit. Since each vCPU only touches its
+ * own slot, the result is exact without any locking.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -327,6 +409,45 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - insn exec inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry to run op
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op to every time an instruction executes, on the
+ * scoreboard slot of the executing vCPU.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn execution cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable callback
+ * @entry: first operand for condition
+ * @imm: second operand for condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when an instruction executes if
+ * entry @cond imm is true. See
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb().
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -491,11 +612,92 @@ void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
                                       enum qemu_plugin_mem_rw rw,
                                       void *userdata);
 
+/**
+ * qemu_plugin_register_vcpu_mem_range_cb() - filtered memory access callback
+ * @insn: handle for instruction to instrument
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @rw: apply to reads, writes or both
+ * @start: first virtual address of interest
+ * @len: size of the address range of interest
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * Like qemu_plugin_register_vcpu_mem_cb(), but @cb is only called for
+ * accesses whose virtual address is in [@start, @start + @len). The
+ * address is normally tested by the translated code, so accesses outside
+ * the range do not leave it; when the address is known at translation
+ * time, accesses outside the range are not instrumented at all.
+ *
+ * This makes it cheap to watch e.g. a single MMIO window.
+ */
+void qemu_plugin_register_vcpu_mem_range_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_mem_cb_t cb,
+                                            enum qemu_plugin_cb_flags flags,
+                                            enum qemu_plugin_mem_rw rw,
+                                            uint64_t start, uint64_t len,
+                                            void *userdata);
+
 void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_mem_rw rw,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - memory access inline op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the op, of type qemu_plugin_op
+ * @entry: entry to run op
+ * @imm: immediate data for @op
+ *
+ * Insert an inline op on the scoreboard slot of the executing vCPU
+ * every time @insn accesses memory.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * typedef qemu_plugin_mem_record - record of an inline memory access log
+ *
+ * @vaddr: virtual address of the access
+ * @tag: the @tag given to qemu_plugin_register_vcpu_mem_inline_log()
+ */
+typedef struct {
+    uint64_t vaddr;
+    uint64_t tag;
+} qemu_plugin_mem_record;
+
+/**
+ * qemu_plugin_register_vcpu_mem_inline_log() - log memory accesses inline
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @count: number of accesses logged so far
+ * @log: first element of an array of @n_records qemu_plugin_mem_record
+ * @n_records: size of the log, a power of two
+ * @tag: value recorded along with the address
+ *
+ * Every time @insn accesses memory, the translated code appends a record
+ * of the virtual address and @tag to the log in the scoreboard slot of
+ * the executing vCPU, at index @count modulo @n_records, and increments
+ * @count. @count and @log must be in the same scoreboard.
+ *
+ * No callback is made, so the plugin must consume the log before it
+ * wraps around, e.g. from a conditional callback on @count at the start
+ * of each block. Records that were overwritten show as @count having
+ * advanced by more than @n_records since the log was last consumed.
+ */
+void qemu_plugin_register_vcpu_mem_inline_log(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    qemu_plugin_u64 count,
+    qemu_plugin_u64 log,
+    uint64_t n_records,
+    uint64_t tag);
+
 
 
 typedef void
@@ -571,6 +773,110 @@ int qemu_plugin_n_vcpus(void);
 /* returns -1 in user-mode */
 int qemu_plugin_n_max_vcpus(void);
 
+/**
+ * qemu_plugin_read_register() - read a register of the current vCPU
+ * @reg: register number, as numbered by the gdbstub for the core
+ *       registers of the target (e.g. 14 is LR on Arm)
+ * @buf: byte array the value is appended to, in target byte order
+ *
+ * This may only be called from a vCPU callback. Guest registers are
+ * only guaranteed to be up to date in callbacks made at the start of a
+ * translation block, such as those registered with
+ * qemu_plugin_register_vcpu_tb_exec_cb(); later in a block the
+ * translated code may still hold them in host registers.
+ *
+ * Returns the size of the register in bytes, or -1 if @reg does not
+ * name a core register.
+ */
+int qemu_plugin_read_register(unsigned int reg, GByteArray *buf);
+
+/**
+ * qemu_plugin_read_memory_vaddr() - read guest memory of the current vCPU
+ * @addr: virtual address to read from
+ * @data: byte array the data is appended to
+ * @len: number of bytes to read
+ *
+ * This may only be called from a vCPU callback. The access goes through
+ * the vCPU's current MMU context, like a debugger access: it does not
+ * fault or update the TLB. Reading device memory is not side effect
+ * free, so plugins should stick to RAM.
+ *
+ * Returns true on success, false if some of the range is not mapped.
+ */
+bool qemu_plugin_read_memory_vaddr(uint64_t addr, GByteArray *data,
+                                   size_t len);
+
+/**
+ * qemu_plugin_scoreboard_new() - alloc a new scoreboard
+ * @element_size: size (in bytes) for one entry
+ *
+ * A scoreboard is an array of values, indexed by vcpu_index, with one
+ * zero-initialised entry of @element_size bytes per vCPU. New entries
+ * are added automatically when vCPUs are created, so plugins do not
+ * need to know how many vCPUs there are.
+ *
+ * Returns a pointer to a new scoreboard. It must be freed using
+ * qemu_plugin_scoreboard_free.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * No translated code referring to @score may run afterwards, which in
+ * practice means this is only safe from an atexit callback.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get pointer to an entry of a scoreboard
+ * @score: scoreboard to query
+ * @vcpu_index: entry index
+ *
+ * Returns address of entry of a scoreboard matching a given vcpu_index. This
+ * address can be modified later if scoreboard is resized.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Macros to define a qemu_plugin_u64 */
+#define qemu_plugin_scoreboard_u64(score) \
+    (qemu_plugin_u64) {score, 0}
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    (qemu_plugin_u64) {score, offsetof(type, member)}
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - return sum of all vcpu entries in a scoreboard
+ * @entry: entry to sum
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 /**
  * qemu_plugin_outs() - output string via QEMU's logging system
  * @string: a string
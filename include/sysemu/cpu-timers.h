@@ -31,6 +31,17 @@ extern int use_icount;
 #define icount_enabled() 0
 #endif
 
+/*
+ * With MTTCG, icount runs the vCPUs in lockstep quanta of instructions
+ * and QEMU_CLOCK_VIRTUAL only advances at the end of each quantum.
+ */
+#ifdef CONFIG_TCG
+extern bool use_icount_quanta;
+#define icount_quanta_enabled() (use_icount_quanta)
+#else
+#define icount_quanta_enabled() false
+#endif
+
 /*
  * Update the icount with the executed instructions. Called by
  * cpus-tcg vCPU thread so the main-loop can see time has moved forward.
@@ -60,6 +71,12 @@ int64_t icount_round(int64_t count);
 void icount_start_warp_timer(void);
 void icount_account_warp_timer(void);
 
+/*
+ * With icount quanta, advance the clock to the next timer while all vCPUs
+ * are idle.  Return false if there is no timer to advance to.
+ */
+bool icount_warp_idle(void);
+
 /*
  * CPU Ticks and Clock
  */
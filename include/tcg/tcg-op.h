@@ -830,6 +830,16 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_quantum_serial() - wait for the vCPU's serial turn
+ *
+ * With icount and MTTCG (CF_QUANTUM), leave the TB with EXCP_QUANTUM and
+ * restart the current instruction once the other vCPUs have stopped, so
+ * that accesses visible to other vCPUs happen in a reproducible order.
+ * Used before I/O and before guest atomics; no-op otherwise.
+ */
+void tcg_gen_quantum_serial(void);
+
 static inline void tcg_gen_plugin_cb_start(unsigned from, unsigned type,
                                            unsigned wr)
 {
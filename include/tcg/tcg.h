@@ -260,12 +260,16 @@ struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 14;
     unsigned refs : 16;
+    unsigned join_globals : 1;
+    unsigned set_seen : 1;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
     } u;
     QSIMPLEQ_HEAD(, TCGRelocation) relocs;
     QSIMPLEQ_ENTRY(TCGLabel) next;
+    /* Globals held in each host register on all branches seen so far */
+    struct TCGTemp **reg_state;
 };
 
 typedef struct TCGPool {
@@ -607,6 +611,9 @@ struct TCGContext {
 
     /* list to quickly access the injected ops */
     QSIMPLEQ_HEAD(, TCGOp) plugin_ops;
+
+    /* if non-NULL, new ops are emitted before this one, not at the end */
+    TCGOp *emit_before_op;
 #endif
 
     GHashTable *const_table[TCG_TYPE_COUNT];
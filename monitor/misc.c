@@ -67,6 +67,7 @@
 #include "block/block-hmp-cmds.h"
 #include "qapi/qapi-commands-char.h"
 #include "qapi/qapi-commands-control.h"
+#include "qapi/qapi-commands-machine.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qapi-commands-misc.h"
 #include "qapi/qapi-commands-qom.h"
@@ -929,6 +930,50 @@ static void hmp_info_mtree(Monitor *mon, const QDict *qdict)
     mtree_info(flatview, dispatch_tree, owner, disabled);
 }
 
+static void hmp_info_mmio_stats(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+    MmioStatsInfoList *list, *elem;
+    Error *err = NULL;
+
+    list = qmp_x_query_mmio_stats(true, max, false, false, &err);
+    if (err) {
+        hmp_handle_error(mon, err);
+        return;
+    }
+
+    monitor_printf(mon, "%-24s %12s %14s %12s %14s  %s\n",
+                   "region", "reads", "read-ns", "writes", "write-ns",
+                   "owner");
+    for (elem = list; elem; elem = elem->next) {
+        MmioStatsInfo *info = elem->value;
+
+        monitor_printf(mon, "%-24s %12" PRIu64 " %14" PRIu64 " %12" PRIu64
+                       " %14" PRIu64 "  %s\n",
+                       info->name, info->reads, info->read_ns,
+                       info->writes, info->write_ns,
+                       info->has_owner ? info->owner : "-");
+    }
+    qapi_free_MmioStatsInfoList(list);
+}
+
+static void hmp_mmio_stats(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_str(qdict, "op");
+    Error *err = NULL;
+
+    if (!strcmp(op, "on") || !strcmp(op, "off")) {
+        qmp_x_set_mmio_stats(!strcmp(op, "on"), &err);
+    } else if (!strcmp(op, "reset")) {
+        qapi_free_MmioStatsInfoList(
+            qmp_x_query_mmio_stats(false, 0, true, true, &err));
+    } else {
+        error_setg(&err, "Invalid argument '%s', expected on, off or reset",
+                   op);
+    }
+    hmp_handle_error(mon, err);
+}
+
 #ifdef CONFIG_PROFILER
 
 int64_t dev_time;
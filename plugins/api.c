@@ -35,6 +35,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/lockable.h"
 #include "qemu/plugin.h"
 #include "tcg/tcg.h"
 #include "exec/exec-all.h"
@@ -47,6 +48,8 @@
 #endif
 #include "trace/mem.h"
 
+extern struct qemu_plugin_state plugin;
+
 /* Uninstall and Reset handlers */
 
 void qemu_plugin_uninstall(qemu_plugin_id_t id, qemu_plugin_simple_cb_t cb)
@@ -98,6 +101,37 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *udata)
+{
+    if (cond == QEMU_PLUGIN_COND_NEVER || tb->mem_only) {
+        return;
+    }
+    if (cond == QEMU_PLUGIN_COND_ALWAYS) {
+        qemu_plugin_register_vcpu_tb_exec_cb(tb, cb, flags, udata);
+        return;
+    }
+    plugin_register_dyn_cond_cb__udata(&tb->cbs[PLUGIN_CB_INLINE], cb, flags,
+                                       cond, entry, imm, udata);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!tb->mem_only) {
+        plugin_register_inline_op_on_entry(&tb->cbs[PLUGIN_CB_INLINE],
+                                           0, op, entry, imm);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
@@ -120,6 +154,39 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
 }
 
 
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *udata)
+{
+    if (cond == QEMU_PLUGIN_COND_NEVER || insn->mem_only) {
+        return;
+    }
+    if (cond == QEMU_PLUGIN_COND_ALWAYS) {
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, cb, flags, udata);
+        return;
+    }
+    plugin_register_dyn_cond_cb__udata(
+        &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], cb, flags,
+        cond, entry, imm, udata);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!insn->mem_only) {
+        plugin_register_inline_op_on_entry(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], 0, op, entry, imm);
+    }
+}
+
 /*
  * We always plant memory instrumentation because they don't finalise until
  * after the operation has complete.
@@ -131,7 +198,21 @@ void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
                                       void *udata)
 {
     plugin_register_vcpu_mem_cb(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR],
-                                    cb, flags, rw, udata);
+                                    cb, flags, rw, 0, UINT64_MAX, udata);
+}
+
+void qemu_plugin_register_vcpu_mem_range_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_mem_cb_t cb,
+                                            enum qemu_plugin_cb_flags flags,
+                                            enum qemu_plugin_mem_rw rw,
+                                            uint64_t start, uint64_t len,
+                                            void *udata)
+{
+    if (len == 0) {
+        return;
+    }
+    plugin_register_vcpu_mem_cb(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR],
+                                cb, flags, rw, start, start + len - 1, udata);
 }
 
 void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
@@ -143,6 +224,31 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                               rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    plugin_register_inline_op_on_entry(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], rw, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_inline_log(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    qemu_plugin_u64 count,
+    qemu_plugin_u64 log,
+    uint64_t n_records,
+    uint64_t tag)
+{
+    g_assert(count.score == log.score);
+    g_assert(n_records && !(n_records & (n_records - 1)));
+    plugin_register_inline_log(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE],
+                               rw, count, log.offset, n_records, tag);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -376,6 +482,114 @@ int qemu_plugin_n_max_vcpus(void)
 #endif
 }
 
+/*
+ * Guest state introspection, only from vCPU context. Registers go
+ * through the gdbstub accessors so that plugins see the same register
+ * numbering and layout as a debugger would.
+ */
+
+int qemu_plugin_read_register(unsigned int reg, GByteArray *buf)
+{
+    CPUState *cpu = current_cpu;
+    CPUClass *cc;
+
+    g_assert(cpu);
+    cc = CPU_GET_CLASS(cpu);
+    if (reg >= cc->gdb_num_core_regs) {
+        return -1;
+    }
+    return cc->gdb_read_register(cpu, buf, reg);
+}
+
+bool qemu_plugin_read_memory_vaddr(uint64_t addr, GByteArray *data,
+                                   size_t len)
+{
+    CPUState *cpu = current_cpu;
+    guint old_len = data->len;
+
+    g_assert(cpu);
+    if (len == 0) {
+        return true;
+    }
+    g_byte_array_set_size(data, old_len + len);
+    if (cpu_memory_rw_debug(cpu, addr, data->data + old_len, len, false) < 0) {
+        g_byte_array_set_size(data, old_len);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Scoreboards
+ *
+ * One entry per vCPU, so that inline ops and callbacks can count without
+ * locking. See plugin_grow_scoreboards() for how vCPUs created later are
+ * handled.
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score = g_new0(struct qemu_plugin_scoreboard,
+                                                  1);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    score->element_size = element_size;
+    score->data = g_malloc0(element_size * plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    QEMU_LOCK_GUARD(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    g_free(score->data);
+    g_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < plugin.scoreboard_alloc_size);
+    return score->data + vcpu_index * score->element_size;
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                    unsigned int vcpu_index)
+{
+    return qemu_plugin_scoreboard_find(entry.score, vcpu_index) +
+           entry.offset;
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    /* Entries of vCPUs never created are zero */
+    for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+        total += qemu_plugin_u64_get(entry, i);
+    }
+    return total;
+}
+
 /*
  * Plugin output
  */
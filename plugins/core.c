@@ -211,10 +211,44 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room for @cpu in all the scoreboards. Translated code reads the
+ * scoreboard data pointers at run-time, so it is enough to stop all vCPUs
+ * while the data moves. In system mode this never happens, because the
+ * scoreboards are sized for smp.max_cpus from the start.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t old_size, new_size;
+
+    if (cpu->cpu_index < plugin.scoreboard_alloc_size) {
+        return;
+    }
+
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+    old_size = plugin.scoreboard_alloc_size;
+    new_size = old_size;
+    while (cpu->cpu_index >= new_size) {
+        new_size *= 2;
+    }
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        score->data = g_realloc(score->data, new_size * score->element_size);
+        memset(score->data + old_size * score->element_size, 0,
+               (new_size - old_size) * score->element_size);
+    }
+    plugin.scoreboard_alloc_size = new_size;
+    qemu_rec_mutex_unlock(&plugin.lock);
+    end_exclusive();
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
@@ -292,9 +326,47 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry.score = NULL;
+    dyn_cb->inline_insn.entry.offset = 0;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
+void plugin_register_inline_log(GArray **arr,
+                                enum qemu_plugin_mem_rw rw,
+                                qemu_plugin_u64 count,
+                                size_t log_offset,
+                                uint64_t n_records,
+                                uint64_t tag)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_LOG;
+    dyn_cb->rw = rw;
+    dyn_cb->log.count = count;
+    dyn_cb->log.offset = log_offset;
+    dyn_cb->log.mask = n_records - 1;
+    dyn_cb->log.tag = tag;
+}
+
 void plugin_register_dyn_cb__udata(GArray **arr,
                                    qemu_plugin_vcpu_udata_cb_t cb,
                                    enum qemu_plugin_cb_flags flags,
@@ -308,10 +380,31 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->rw = 0;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.imm = imm;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
                                  enum qemu_plugin_mem_rw rw,
+                                 uint64_t start, uint64_t last,
                                  void *udata)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
@@ -322,6 +415,8 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
     dyn_cb->rw = rw;
     dyn_cb->f.generic = cb;
+    dyn_cb->range.start = start;
+    dyn_cb->range.last = last;
 }
 
 /*
@@ -433,19 +528,42 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
     uint64_t *val = cb->userp;
 
+    if (entry.score) {
+        val = entry.score->data + cpu_index * entry.score->element_size +
+              entry.offset;
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+void exec_inline_log(struct qemu_plugin_dyn_cb *cb, int cpu_index,
+                     uint64_t vaddr)
+{
+    qemu_plugin_u64 count = cb->log.count;
+    void *slot = count.score->data + cpu_index * count.score->element_size;
+    uint64_t *n = slot + count.offset;
+    qemu_plugin_mem_record *rec = slot + cb->log.offset;
+
+    rec += *n & cb->log.mask;
+    rec->vaddr = vaddr;
+    rec->tag = cb->log.tag;
+    (*n)++;
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 {
     GArray *arr = cpu->plugin_mem_cbs;
@@ -460,14 +578,19 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
         int w = !!(info & TRACE_MEM_ST) + 1;
 
         if (!(w & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
-            cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
+            if (qemu_plugin_dyn_cb_in_range(cb, vaddr)) {
+                cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
+            }
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_LOG:
+            exec_inline_log(cb, cpu->cpu_index, vaddr);
             break;
         default:
             g_assert_not_reached();
@@ -552,6 +675,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
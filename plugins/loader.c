@@ -282,6 +282,9 @@ int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
     info->system_emulation = true;
     info->system.smp_vcpus = ms->smp.cpus;
     info->system.max_vcpus = ms->smp.max_cpus;
+    /* Scoreboards never have to grow, so hotplug need not stop the vCPUs */
+    plugin.scoreboard_alloc_size = MAX(plugin.scoreboard_alloc_size,
+                                       ms->smp.max_cpus);
 #else
     info->system_emulation = false;
 #endif
@@ -143,8 +143,16 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                pretranslate=on|off (translate branch targets while idle, default=off)\n"
+    "                tb-profile=on|off (profile each translation block, default=off)\n"
+    "                idle-detect=on|off (park vCPUs spinning in polling loops, default=off)\n"
+    "                perfmap=on|off (write /tmp/perf-<pid>.map for TCG code, default=off)\n"
+    "                jitdump=on|off (write jit-<pid>.dump for TCG code, default=off)\n"
+    "                perf-symbols=file (guest symbol map used to name TCG code)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                follow-branches=n (direct branches to translate through per TB, default=0)\n"
+    "                icount-quantum=n (instructions per vCPU between icount synchronizations, default=10000)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -170,6 +178,48 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``pretranslate=on|off``
+        When the TCG vCPU is halted, translate the static branch targets
+        of recently translated blocks ahead of time, so that the guest
+        does not have to wait for code generation when it first jumps
+        there. Only targets whose code pages are already in the vCPU's
+        TLB are translated, so this helps guests that idle with WFI or
+        HLT between bursts of work, not guests that never halt. The
+        default is off.
+
+    ``tb-profile=on|off``
+        Keep per translation block execution counts, exit counts,
+        translation time and code size, reported by the ``info
+        tb-profile`` monitor command and the ``x-query-tb-profile`` QMP
+        command. The counting is done inline by the generated code.
+
+    ``idle-detect=on|off``
+        Recognize translation blocks that branch back to themselves
+        without storing to memory, calling helpers, or updating a loop
+        counter, such as a loop polling a device status register instead
+        of executing WFI. A vCPU that keeps going around such a loop is
+        put to sleep until it is interrupted or the next timer is due,
+        for at most one millisecond at a time, so that it stops using a
+        host core. A change of the polled location that neither raises
+        an interrupt nor comes from a timer is seen late by up to that
+        amount. With ``thread=single`` only a single vCPU is put to
+        sleep. Not available with ``-icount``. The default is off.
+
+    ``perfmap=on|off``
+        Write ``/tmp/perf-<pid>.map``, describing each block of TCG
+        generated code by its guest PC and guest symbol, so that
+        ``perf report`` can attribute host time to guest code.
+
+    ``jitdump=on|off``
+        Write ``jit-<pid>.dump`` in the current directory, to be merged
+        into a ``perf record -k 1`` profile with ``perf inject -j``.
+
+    ``perf-symbols=file``
+        Name translated code after the guest functions listed in
+        ``file``, one ``ADDRESS [TYPE] NAME`` entry per line as printed
+        by ``nm``. Symbols of an ELF firmware image loaded with
+        ``-kernel`` are used even without this option.
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
@@ -179,6 +229,24 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``follow-branches=n``
+        Allows the translator to continue a translation block across up
+        to ``n`` unconditional forward branches within the same page,
+        instead of ending the block at each of them. Larger blocks mean
+        fewer dispatches on straight-line code at the cost of some
+        duplicated host code. The number of branches followed is
+        reported by ``info jit``. Currently only used by 32-bit Arm.
+        The default is 0.
+
+    ``icount-quantum=n``
+        With ``-icount`` and ``thread=multi``, the vCPUs run in rounds of
+        at most ``n`` instructions each, shorter when a virtual clock
+        timer is due. At the end of a round, and whenever a vCPU reaches
+        an I/O access or an atomic operation, all vCPUs stop so that the
+        access is done in the same order in every run. Smaller values
+        give more precise timers, larger values better parallelism.
+        The default is 10000.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -187,6 +255,14 @@ SRST
         incompatible TCG features have been enabled (e.g.
         icount/replay).
 
+        ``thread=multi`` can be combined with ``-icount`` with a fixed
+        ``shift``; see ``icount-quantum``. Runs are then reproducible as
+        long as the vCPUs communicate through atomic operations and
+        devices rather than plain memory accesses, and no external input
+        (such as a character device or the network) reaches the guest.
+        Time the vCPUs spend idle is skipped, as with ``sleep=off``.
+        Record/replay still requires ``thread=single``.
+
     ``dirty-ring-size=n``
         When the KVM accelerator is used, it controls the size of the per-vCPU
         dirty page ring buffer (number of entries for each vCPU). It should
@@ -4186,13 +4262,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrperiod=<n>]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrperiod=n]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4234,6 +4310,9 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    In replay mode, ``rrperiod=n`` keeps VM snapshots in memory every
+    ``n`` instructions to speed up reverse debugging; it has no effect
+    if a writable drive is attached to a device.
 ERST
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -0,0 +1,561 @@
+/*
+ * replay-chunk.c
+ *
+ * Chunked storage of the replay log.
+ *
+ * The log is a stream of bytes written by replay_put_* and read by
+ * replay_get_*.  On disk the stream is cut into chunks, each compressed
+ * on its own with zstd when available, and followed by an index of the
+ * chunks so that a logical stream offset (as saved in the snapshots by
+ * replay_pre_save) can be found with a binary search instead of a scan.
+ * Chunks preferably start at checkpoints.
+ *
+ * Recording only appends to an in-memory chunk; full chunks are
+ * compressed and written by a background thread.  When replaying,
+ * another thread reads and decompresses the next chunks ahead of time.
+ *
+ * File layout, all integers big-endian:
+ *   header (see replay.c)
+ *   chunk*:  u32 stored size, u32 stream size, u32 flags, stored data
+ *   index:   u32 count, count * (u64 file offset, u64 stream offset)
+ * The index offset is kept in the file header.  If it is missing, e.g.
+ * because QEMU was killed while recording, the index is rebuilt from the
+ * chunk headers.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+
+/* A chunk is cut at the first checkpoint after this many bytes... */
+#define REPLAY_CHUNK_MIN        (64 * KiB)
+/* ...or anywhere once it reaches this size. */
+#define REPLAY_CHUNK_MAX        (1 * MiB)
+/* Chunks queued for the writer, or decompressed ahead by the reader */
+#define REPLAY_CHUNK_QUEUE      4
+#define REPLAY_CHUNK_ZSTD_LEVEL 1
+
+#define REPLAY_CHUNK_HEADER_SIZE (3 * sizeof(uint32_t))
+#define REPLAY_CHUNK_ZSTD       1
+
+typedef struct ReplayChunk {
+    /* Index of the chunk, and stream offset of its first byte */
+    uint64_t index;
+    uint64_t offset;
+    uint8_t *data;
+    size_t len;
+    bool error;
+    QSIMPLEQ_ENTRY(ReplayChunk) next;
+} ReplayChunk;
+
+typedef struct ReplayChunkIndex {
+    uint64_t file_offset;
+    uint64_t offset;
+} ReplayChunkIndex;
+
+/* Chunk being filled (record) or consumed (replay) under replay_mutex */
+static ReplayChunk *cur;
+static size_t cur_pos;
+static bool stream_eof;
+
+/*
+ * Chunk index, appended to by the writer thread, and end of the chunks
+ * (record) or of the file (replay)
+ */
+static GArray *chunk_index;
+static uint64_t file_end;
+
+/*
+ * Queue between the vCPU/main loop threads and the writer or reader
+ * thread.  For the reader, queue_gen is bumped on every seek so that
+ * chunks read ahead for the old position are dropped.
+ */
+static QemuThread chunk_thread;
+static QemuMutex queue_lock;
+static QemuCond queue_cond;
+static QSIMPLEQ_HEAD(, ReplayChunk) queue = QSIMPLEQ_HEAD_INITIALIZER(queue);
+static unsigned queue_len;
+static unsigned queue_gen;
+static uint64_t queue_want;
+static uint64_t queue_expect;
+static bool queue_exit;
+static bool chunk_thread_running;
+
+static ReplayChunk *replay_chunk_new(uint64_t index, uint64_t offset)
+{
+    ReplayChunk *chunk = g_new0(ReplayChunk, 1);
+
+    chunk->index = index;
+    chunk->offset = offset;
+    return chunk;
+}
+
+static void replay_chunk_free(ReplayChunk *chunk)
+{
+    if (chunk) {
+        g_free(chunk->data);
+        g_free(chunk);
+    }
+}
+
+/* Writing */
+
+static bool replay_chunk_write(ReplayChunk *chunk)
+{
+    uint8_t header[REPLAY_CHUNK_HEADER_SIZE];
+    ReplayChunkIndex entry = {
+        .file_offset = file_end,
+        .offset = chunk->offset,
+    };
+    const uint8_t *data = chunk->data;
+    size_t stored = chunk->len;
+    uint32_t flags = 0;
+    g_autofree uint8_t *zbuf = NULL;
+
+#ifdef CONFIG_ZSTD
+    {
+        size_t bound = ZSTD_compressBound(chunk->len);
+        size_t ret;
+
+        zbuf = g_malloc(bound);
+        ret = ZSTD_compress(zbuf, bound, chunk->data, chunk->len,
+                            REPLAY_CHUNK_ZSTD_LEVEL);
+        if (!ZSTD_isError(ret) && ret < chunk->len) {
+            data = zbuf;
+            stored = ret;
+            flags |= REPLAY_CHUNK_ZSTD;
+        }
+    }
+#endif
+
+    stl_be_p(header, stored);
+    stl_be_p(header + 4, chunk->len);
+    stl_be_p(header + 8, flags);
+    if (fwrite(header, sizeof(header), 1, replay_file) != 1 ||
+        fwrite(data, 1, stored, replay_file) != stored) {
+        return false;
+    }
+
+    g_array_append_val(chunk_index, entry);
+    file_end += sizeof(header) + stored;
+    return true;
+}
+
+static void *replay_chunk_writer(void *opaque)
+{
+    bool error = false;
+
+    qemu_mutex_lock(&queue_lock);
+    for (;;) {
+        ReplayChunk *chunk;
+
+        while (QSIMPLEQ_EMPTY(&queue) && !queue_exit) {
+            qemu_cond_wait(&queue_cond, &queue_lock);
+        }
+        chunk = QSIMPLEQ_FIRST(&queue);
+        if (!chunk) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&queue, next);
+        qemu_mutex_unlock(&queue_lock);
+
+        if (!error && !replay_chunk_write(chunk)) {
+            error_report("replay write error");
+            error = true;
+        }
+        replay_chunk_free(chunk);
+
+        qemu_mutex_lock(&queue_lock);
+        queue_len--;
+        qemu_cond_broadcast(&queue_cond);
+    }
+    qemu_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+static void replay_chunk_submit(void)
+{
+    uint64_t offset = cur->offset + cur->len;
+    uint64_t index = cur->index + 1;
+
+    if (cur->len) {
+        qemu_mutex_lock(&queue_lock);
+        while (queue_len >= REPLAY_CHUNK_QUEUE) {
+            qemu_cond_wait(&queue_cond, &queue_lock);
+        }
+        QSIMPLEQ_INSERT_TAIL(&queue, cur, next);
+        queue_len++;
+        qemu_cond_broadcast(&queue_cond);
+        qemu_mutex_unlock(&queue_lock);
+    } else {
+        replay_chunk_free(cur);
+        index--;
+    }
+
+    cur = replay_chunk_new(index, offset);
+    cur->data = g_malloc(REPLAY_CHUNK_MAX);
+}
+
+void replay_chunk_put(const uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n = MIN(size, REPLAY_CHUNK_MAX - cur->len);
+
+        memcpy(cur->data + cur->len, buf, n);
+        cur->len += n;
+        buf += n;
+        size -= n;
+        if (cur->len == REPLAY_CHUNK_MAX) {
+            replay_chunk_submit();
+        }
+    }
+}
+
+void replay_chunk_checkpoint(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD && cur->len >= REPLAY_CHUNK_MIN) {
+        replay_chunk_submit();
+    }
+}
+
+/* Reading */
+
+/* Once the reader thread is running, only it accesses replay_file. */
+static bool replay_chunk_read_at(void *buf, size_t size, uint64_t offset)
+{
+    if (offset + size > file_end) {
+        return false;
+    }
+    return fseek(replay_file, offset, SEEK_SET) == 0 &&
+           fread(buf, 1, size, replay_file) == size;
+}
+
+static ReplayChunk *replay_chunk_load(uint64_t index)
+{
+    ReplayChunkIndex *entry = &g_array_index(chunk_index, ReplayChunkIndex,
+                                             index);
+    ReplayChunk *chunk = replay_chunk_new(index, entry->offset);
+    uint8_t header[REPLAY_CHUNK_HEADER_SIZE];
+    g_autofree uint8_t *stored = NULL;
+    uint32_t stored_len, flags;
+
+    chunk->error = true;
+    if (!replay_chunk_read_at(header, sizeof(header), entry->file_offset)) {
+        return chunk;
+    }
+    stored_len = ldl_be_p(header);
+    chunk->len = ldl_be_p(header + 4);
+    flags = ldl_be_p(header + 8);
+    if (chunk->len > REPLAY_CHUNK_MAX || stored_len > chunk->len) {
+        return chunk;
+    }
+
+    stored = g_malloc(stored_len);
+    if (!replay_chunk_read_at(stored, stored_len,
+                              entry->file_offset + sizeof(header))) {
+        return chunk;
+    }
+
+    if (flags & REPLAY_CHUNK_ZSTD) {
+#ifdef CONFIG_ZSTD
+        size_t ret;
+
+        chunk->data = g_malloc(chunk->len);
+        ret = ZSTD_decompress(chunk->data, chunk->len, stored, stored_len);
+        if (ZSTD_isError(ret) || ret != chunk->len) {
+            return chunk;
+        }
+#else
+        return chunk;
+#endif
+    } else if (stored_len == chunk->len) {
+        chunk->data = g_steal_pointer(&stored);
+    } else {
+        return chunk;
+    }
+
+    chunk->error = false;
+    return chunk;
+}
+
+static void *replay_chunk_reader(void *opaque)
+{
+    qemu_mutex_lock(&queue_lock);
+    for (;;) {
+        ReplayChunk *chunk;
+        uint64_t index;
+        unsigned gen;
+
+        while (!queue_exit && (queue_len >= REPLAY_CHUNK_QUEUE ||
+                               queue_want >= chunk_index->len)) {
+            qemu_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (queue_exit) {
+            break;
+        }
+        index = queue_want++;
+        gen = queue_gen;
+        qemu_mutex_unlock(&queue_lock);
+
+        chunk = replay_chunk_load(index);
+
+        qemu_mutex_lock(&queue_lock);
+        if (gen == queue_gen) {
+            QSIMPLEQ_INSERT_TAIL(&queue, chunk, next);
+            queue_len++;
+            qemu_cond_broadcast(&queue_cond);
+        } else {
+            replay_chunk_free(chunk);
+        }
+    }
+    qemu_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+static void replay_chunk_drain(void)
+{
+    ReplayChunk *chunk;
+
+    while ((chunk = QSIMPLEQ_FIRST(&queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&queue, next);
+        replay_chunk_free(chunk);
+    }
+    queue_len = 0;
+}
+
+/* Make chunk @index current, restarting the read-ahead if it was a seek. */
+static void replay_chunk_fetch(uint64_t index)
+{
+    ReplayChunk *chunk;
+
+    replay_chunk_free(cur);
+
+    qemu_mutex_lock(&queue_lock);
+    if (index != queue_expect) {
+        queue_gen++;
+        replay_chunk_drain();
+        queue_want = index;
+        qemu_cond_broadcast(&queue_cond);
+    }
+    while (QSIMPLEQ_EMPTY(&queue)) {
+        qemu_cond_wait(&queue_cond, &queue_lock);
+    }
+    chunk = QSIMPLEQ_FIRST(&queue);
+    QSIMPLEQ_REMOVE_HEAD(&queue, next);
+    queue_len--;
+    queue_expect = index + 1;
+    qemu_cond_broadcast(&queue_cond);
+    qemu_mutex_unlock(&queue_lock);
+
+    assert(chunk->index == index);
+    if (chunk->error) {
+        error_report("Replay: chunk %" PRIu64 " of the log is corrupted",
+                     index);
+        exit(1);
+    }
+    cur = chunk;
+    cur_pos = 0;
+}
+
+bool replay_chunk_get(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (cur_pos == cur->len) {
+            if (cur->index + 1 >= chunk_index->len) {
+                stream_eof = true;
+                return false;
+            }
+            replay_chunk_fetch(cur->index + 1);
+        }
+        n = MIN(size, cur->len - cur_pos);
+        memcpy(buf, cur->data + cur_pos, n);
+        cur_pos += n;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool replay_chunk_eof(void)
+{
+    return stream_eof;
+}
+
+uint64_t replay_chunk_tell(void)
+{
+    return cur->offset + (replay_mode == REPLAY_MODE_RECORD ? cur->len
+                                                             : cur_pos);
+}
+
+void replay_chunk_seek(uint64_t offset)
+{
+    size_t lo = 0, hi = chunk_index->len;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+
+    /* Find the last chunk starting at or before @offset */
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+
+        if (g_array_index(chunk_index, ReplayChunkIndex, mid).offset <=
+            offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (chunk_index->len && lo != cur->index) {
+        replay_chunk_fetch(lo);
+    }
+    if (offset - cur->offset > cur->len) {
+        error_report("Replay: log offset %" PRIu64 " is out of range",
+                     offset);
+        exit(1);
+    }
+    cur_pos = offset - cur->offset;
+    stream_eof = false;
+}
+
+/* Rebuild the index of a log whose recording was interrupted. */
+static void replay_chunk_scan(uint64_t start)
+{
+    uint8_t header[REPLAY_CHUNK_HEADER_SIZE];
+    ReplayChunkIndex entry = {
+        .file_offset = start,
+    };
+
+    while (replay_chunk_read_at(header, sizeof(header), entry.file_offset)) {
+        uint64_t next = entry.file_offset + sizeof(header) + ldl_be_p(header);
+
+        /* Drop a chunk that was only partially written */
+        if (next > file_end) {
+            break;
+        }
+        g_array_append_val(chunk_index, entry);
+        entry.file_offset = next;
+        entry.offset += ldl_be_p(header + 4);
+    }
+}
+
+static bool replay_chunk_read_index(uint64_t index_offset)
+{
+    uint8_t buf[sizeof(uint32_t)];
+    g_autofree uint8_t *entries = NULL;
+    uint32_t i, count;
+
+    if (!replay_chunk_read_at(buf, sizeof(buf), index_offset)) {
+        return false;
+    }
+    count = ldl_be_p(buf);
+    if (count > (file_end - index_offset) / (2 * sizeof(uint64_t))) {
+        return false;
+    }
+    entries = g_malloc_n(count, 2 * sizeof(uint64_t));
+    if (!replay_chunk_read_at(entries, count * 2 * sizeof(uint64_t),
+                            index_offset + sizeof(buf))) {
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        ReplayChunkIndex entry = {
+            .file_offset = ldq_be_p(entries + i * 16),
+            .offset = ldq_be_p(entries + i * 16 + 8),
+        };
+        g_array_append_val(chunk_index, entry);
+    }
+    return true;
+}
+
+/* Setup and teardown */
+
+void replay_chunk_start(uint64_t start, uint64_t index_offset)
+{
+    chunk_index = g_array_new(false, false, sizeof(ReplayChunkIndex));
+    qemu_mutex_init(&queue_lock);
+    qemu_cond_init(&queue_cond);
+    queue_exit = false;
+    stream_eof = false;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        file_end = start;
+        cur = replay_chunk_new(0, 0);
+        cur->data = g_malloc(REPLAY_CHUNK_MAX);
+        qemu_thread_create(&chunk_thread, "replay-writer",
+                           replay_chunk_writer, NULL, QEMU_THREAD_JOINABLE);
+    } else {
+        fseek(replay_file, 0, SEEK_END);
+        file_end = ftell(replay_file);
+        if (!index_offset || !replay_chunk_read_index(index_offset)) {
+            warn_report("Replay: log has no chunk index, rebuilding it");
+            g_array_set_size(chunk_index, 0);
+            replay_chunk_scan(start);
+        }
+        queue_want = queue_expect = 0;
+        qemu_thread_create(&chunk_thread, "replay-reader",
+                           replay_chunk_reader, NULL, QEMU_THREAD_JOINABLE);
+        if (chunk_index->len) {
+            replay_chunk_fetch(0);
+        } else {
+            cur = replay_chunk_new(0, 0);
+        }
+    }
+    chunk_thread_running = true;
+}
+
+uint64_t replay_chunk_finish(void)
+{
+    uint64_t index_offset = 0;
+    uint8_t buf[2 * sizeof(uint64_t)];
+    guint i;
+
+    if (!chunk_thread_running) {
+        return 0;
+    }
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_chunk_submit();
+    }
+
+    qemu_mutex_lock(&queue_lock);
+    queue_exit = true;
+    qemu_cond_broadcast(&queue_cond);
+    qemu_mutex_unlock(&queue_lock);
+    qemu_thread_join(&chunk_thread);
+    chunk_thread_running = false;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        index_offset = file_end;
+        fseek(replay_file, index_offset, SEEK_SET);
+        stl_be_p(buf, chunk_index->len);
+        fwrite(buf, sizeof(uint32_t), 1, replay_file);
+        for (i = 0; i < chunk_index->len; i++) {
+            ReplayChunkIndex *entry = &g_array_index(chunk_index,
+                                                     ReplayChunkIndex, i);
+
+            stq_be_p(buf, entry->file_offset);
+            stq_be_p(buf + 8, entry->offset);
+            fwrite(buf, sizeof(buf), 1, replay_file);
+        }
+    } else {
+        replay_chunk_drain();
+    }
+
+    replay_chunk_free(cur);
+    cur = NULL;
+    g_array_free(chunk_index, true);
+    chunk_index = NULL;
+    return index_offset;
+}
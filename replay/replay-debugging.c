@@ -40,6 +40,7 @@ void hmp_info_replay(Monitor *mon, const QDict *qdict)
             "%s execution '%s': instruction count = %"PRId64"\n",
             replay_mode == REPLAY_MODE_RECORD ? "Recording" : "Replaying",
             replay_get_filename(), replay_get_current_icount());
+        replay_ram_snapshot_info(mon);
     }
 }
 
@@ -184,7 +185,8 @@ fail:
 static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
 {
     char *snapshot = NULL;
-    int64_t snapshot_icount;
+    int64_t snapshot_icount, ram_icount;
+    bool ok = true;
 
     if (replay_mode != REPLAY_MODE_PLAY) {
         error_setg(errp, "replay must be enabled to seek");
@@ -192,13 +194,27 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
     }
 
     snapshot = replay_find_nearest_snapshot(icount, &snapshot_icount);
-    if (snapshot) {
+    if (!snapshot) {
+        snapshot_icount = -1;
+    }
+    ram_icount = replay_ram_snapshot_find(icount);
+    if (ram_icount >= 0 && ram_icount >= snapshot_icount) {
+        /* In-memory snapshots are much cheaper to load */
+        if (icount < replay_get_current_icount()
+            || replay_get_current_icount() < ram_icount) {
+            ok = replay_ram_snapshot_load(ram_icount, errp);
+        }
+    } else if (snapshot) {
         if (icount < replay_get_current_icount()
             || replay_get_current_icount() < snapshot_icount) {
             vm_stop(RUN_STATE_RESTORE_VM);
-            load_snapshot(snapshot, NULL, false, NULL, errp);
+            ok = load_snapshot(snapshot, NULL, false, NULL, errp);
+            replay_ram_snapshot_invalidate();
         }
-        g_free(snapshot);
+    }
+    g_free(snapshot);
+    if (!ok) {
+        return;
     }
     if (replay_get_current_icount() <= icount) {
         replay_break(icount, callback, NULL);
@@ -326,7 +342,7 @@ void replay_gdb_attached(void)
      * debugging even if snapshots were not enabled.
      */
     if (replay_mode == REPLAY_MODE_PLAY
-        && !replay_snapshot) {
+        && !replay_snapshot && !replay_ram_snapshot_enabled()) {
         if (!save_snapshot("start_debugging", true, NULL, false, NULL, NULL)) {
             /* Can't create the snapshot. Continue conventional debugging. */
         }
@@ -27,17 +27,8 @@ static QemuCond mutex_cond;
 static unsigned long mutex_head, mutex_tail;
 
 /* File for replay writing */
-static bool write_error;
 FILE *replay_file;
 
-static void replay_write_error(void)
-{
-    if (!write_error) {
-        error_report("replay write error");
-        write_error = true;
-    }
-}
-
 static void replay_read_error(void)
 {
     error_report("error reading the replay data");
@@ -47,15 +38,16 @@ static void replay_read_error(void)
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
-        }
+        replay_chunk_put(&byte, 1);
     }
 }
 
 void replay_put_event(uint8_t event)
 {
     assert(event < EVENT_COUNT);
+    if (event >= EVENT_CHECKPOINT && event <= EVENT_CHECKPOINT_LAST) {
+        replay_chunk_checkpoint();
+    }
     replay_put_byte(event);
 }
 
@@ -82,9 +74,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_chunk_put(buf, size);
     }
 }
 
@@ -92,11 +82,9 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (!replay_chunk_get(&byte, 1)) {
             replay_read_error();
         }
-        byte = r;
     }
     return byte;
 }
@@ -138,7 +126,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
+        if (!replay_chunk_get(buf, *size)) {
             replay_read_error();
         }
     }
@@ -149,7 +137,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
+        if (!replay_chunk_get(*buf, *size)) {
             replay_read_error();
         }
     }
@@ -158,14 +146,10 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (replay_chunk_eof()) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
-            error_report("replay file is over or something goes wrong");
-            qemu_system_vmstop_request_prepare();
-            qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
         }
     }
 }
@@ -113,6 +113,29 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/* Chunked log storage */
+
+/*! Starts the log writer or read-ahead thread. Chunks begin at file
+    offset start. index_offset is the chunk index position read from
+    the header when replaying, or 0 to rebuild the index. */
+void replay_chunk_start(uint64_t start, uint64_t index_offset);
+/*! Flushes and stops the log thread.
+    \return the position of the chunk index when recording */
+uint64_t replay_chunk_finish(void);
+/*! Appends data to the log. */
+void replay_chunk_put(const uint8_t *buf, size_t size);
+/*! Reads data from the log.
+    \return false if the log is over */
+bool replay_chunk_get(uint8_t *buf, size_t size);
+/*! Returns true if a read went past the end of the log. */
+bool replay_chunk_eof(void);
+/*! Called before writing a checkpoint, to start a new chunk there. */
+void replay_chunk_checkpoint(void);
+/*! Returns the current position in the log data. */
+uint64_t replay_chunk_tell(void);
+/*! Moves the read position in the log data. */
+void replay_chunk_seek(uint64_t offset);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
@@ -195,4 +218,24 @@ void *replay_event_net_load(void);
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
 
+/* In-memory snapshots */
+
+/*! Instructions between in-memory snapshots, 0 if disabled */
+extern uint64_t replay_ram_snapshot_period;
+
+/*! Starts taking in-memory snapshots while replaying. */
+void replay_ram_snapshot_init(void);
+/*! Returns true if in-memory snapshots are being taken. */
+bool replay_ram_snapshot_enabled(void);
+/*! Returns the instruction count of the latest in-memory snapshot
+    not after @icount, or -1 if there is none. */
+int64_t replay_ram_snapshot_find(int64_t icount);
+/*! Restores the in-memory snapshot taken at @icount and drops
+    the newer ones. */
+bool replay_ram_snapshot_load(int64_t icount, Error **errp);
+/*! Called when the dirty bitmap was changed by a savevm or loadvm. */
+void replay_ram_snapshot_invalidate(void);
+/*! Prints in-memory snapshot information for "info replay". */
+void replay_ram_snapshot_info(Monitor *mon);
+
 #endif
@@ -0,0 +1,439 @@
+/*
+ * replay-ram-snapshot.c
+ *
+ * In-memory snapshots for reverse debugging.
+ *
+ * While replaying, the VM is snapshotted every rrperiod instructions into
+ * host memory.  Only the guest pages written since the previous snapshot
+ * are copied, using the migration dirty bitmap; the first snapshot holds
+ * every page.  The device state is saved as with savevm, but without RAM.
+ *
+ * To go back to snapshot K, each page written since K is copied back from
+ * the newest snapshot up to K that holds it, then the device state of K
+ * is loaded.  The snapshots newer than K are dropped: they are taken again
+ * as the replay moves forward.
+ *
+ * The number of snapshots is bounded.  When a new one exceeds the bound,
+ * the snapshot whose neighbours are closest together relative to their
+ * age is merged into the next one, so that the snapshots kept end up
+ * spaced roughly geometrically with age: recent history is dense and
+ * reverse steps near the current position stay cheap.
+ *
+ * Disk contents are not part of the snapshots, so they are only taken when
+ * no writable drive is attached to a device.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/timer.h"
+#include "sysemu/replay.h"
+#include "sysemu/runstate.h"
+#include "replay-internal.h"
+#include "sysemu/block-backend.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-buffer.h"
+#include "migration/qemu-file-channel.h"
+#include "migration/qemu-file.h"
+#include "migration/savevm.h"
+#include "monitor/monitor.h"
+
+/* Maximum number of snapshots kept */
+#define REPLAY_RAM_SNAPSHOT_MAX     32
+/* How often to check whether a snapshot is due */
+#define REPLAY_RAM_SNAPSHOT_POLL_MS 10
+
+typedef struct RamSnapshot {
+    int64_t icount;
+    /* Device state, as saved by qemu_save_device_state */
+    uint8_t *devices;
+    size_t devices_len;
+    /*
+     * Pages written since the previous snapshot, keyed by ram_addr page
+     * number, with their contents, or NULL if they were all zeroes
+     */
+    GHashTable *pages;
+} RamSnapshot;
+
+uint64_t replay_ram_snapshot_period;
+
+/* Oldest first */
+static GPtrArray *snapshots;
+static QEMUTimer *snapshot_timer;
+/* The dirty bitmap cannot be trusted, e.g. after a savevm */
+static bool all_dirty;
+/* Ignore the state changes caused by our own vm_stop */
+static bool busy;
+
+static void replay_ram_snapshot_free(gpointer p)
+{
+    RamSnapshot *s = p;
+
+    g_hash_table_destroy(s->pages);
+    g_free(s->devices);
+    g_free(s);
+}
+
+static RamSnapshot *replay_ram_snapshot_get(guint i)
+{
+    return g_ptr_array_index(snapshots, i);
+}
+
+/*
+ * Call @fn for each page of @rb written since the last call, or for all
+ * pages if the dirty bitmap is not reliable, and clear the dirty bitmap.
+ */
+static void replay_ram_foreach_dirty(RAMBlock *rb,
+                                     void (*fn)(RAMBlock *rb, ram_addr_t off,
+                                                void *opaque),
+                                     void *opaque)
+{
+    size_t page_size = qemu_target_page_size();
+    DirtyBitmapSnapshot *snap;
+    ram_addr_t off;
+
+    snap = memory_region_snapshot_and_clear_dirty(rb->mr, 0, rb->used_length,
+                                                  DIRTY_MEMORY_MIGRATION);
+    for (off = 0; off < rb->used_length; off += page_size) {
+        if (all_dirty ||
+            memory_region_snapshot_get_dirty(rb->mr, snap, off, page_size)) {
+            fn(rb, off, opaque);
+        }
+    }
+    g_free(snap);
+}
+
+static gpointer replay_ram_page_key(RAMBlock *rb, ram_addr_t off)
+{
+    return GSIZE_TO_POINTER((rb->offset + off) >> qemu_target_page_bits());
+}
+
+static void replay_ram_save_page(RAMBlock *rb, ram_addr_t off, void *opaque)
+{
+    RamSnapshot *s = opaque;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *host = rb->host + off;
+
+    g_hash_table_insert(s->pages, replay_ram_page_key(rb, off),
+                        buffer_is_zero(host, page_size)
+                        ? NULL : g_memdup(host, page_size));
+}
+
+static int replay_ram_save_block(RAMBlock *rb, void *opaque)
+{
+    if (qemu_ram_is_migratable(rb)) {
+        replay_ram_foreach_dirty(rb, replay_ram_save_page, opaque);
+    }
+    return 0;
+}
+
+/* Merge snapshot @i into the next one and drop it. */
+static void replay_ram_snapshot_merge(guint i)
+{
+    RamSnapshot *s = replay_ram_snapshot_get(i);
+    RamSnapshot *next = replay_ram_snapshot_get(i + 1);
+    GHashTableIter iter;
+    gpointer key, data;
+
+    /* A page not written between the two still has the older contents */
+    g_hash_table_iter_init(&iter, s->pages);
+    while (g_hash_table_iter_next(&iter, &key, &data)) {
+        if (!g_hash_table_contains(next->pages, key)) {
+            g_hash_table_iter_steal(&iter);
+            g_hash_table_insert(next->pages, key, data);
+        }
+    }
+    g_ptr_array_remove_index(snapshots, i);
+}
+
+static void replay_ram_snapshot_thin(void)
+{
+    int64_t now = replay_get_current_icount();
+    double score, best = 0;
+    guint i, victim = 0;
+
+    if (snapshots->len <= REPLAY_RAM_SNAPSHOT_MAX) {
+        return;
+    }
+
+    /* Never drop the oldest snapshot, or the one just taken */
+    for (i = 1; i + 1 < snapshots->len; i++) {
+        RamSnapshot *prev = replay_ram_snapshot_get(i - 1);
+        RamSnapshot *next = replay_ram_snapshot_get(i + 1);
+
+        score = (double)(next->icount - prev->icount) /
+                (now - prev->icount + 1);
+        if (!victim || score < best) {
+            victim = i;
+            best = score;
+        }
+    }
+    replay_ram_snapshot_merge(victim);
+}
+
+static bool replay_ram_snapshot_take(Error **errp)
+{
+    RamSnapshot *s = g_new0(RamSnapshot, 1);
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int ret;
+
+    s->icount = replay_get_current_icount();
+    s->pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+    if (!global_dirty_log) {
+        /* Stopped by a savevm, or not started yet */
+        memory_global_dirty_log_start();
+        all_dirty = true;
+    }
+    if (snapshots->len == 0) {
+        all_dirty = true;
+    }
+    qemu_ram_foreach_block(replay_ram_save_block, s);
+    all_dirty = false;
+
+    bioc = qio_channel_buffer_new(64 * KiB);
+    f = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    if (ret == 0) {
+        s->devices_len = bioc->usage;
+        s->devices = g_memdup(bioc->data, bioc->usage);
+    }
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+
+    if (ret) {
+        error_setg(errp, "Error %d while saving device state", ret);
+        replay_ram_snapshot_free(s);
+        /* The pages copied above are lost for the next snapshot */
+        all_dirty = true;
+        return false;
+    }
+
+    g_ptr_array_add(snapshots, s);
+    replay_ram_snapshot_thin();
+    return true;
+}
+
+static void replay_ram_snapshot_tick(void *opaque)
+{
+    int64_t last = snapshots->len ? replay_ram_snapshot_get(
+                                        snapshots->len - 1)->icount : -1;
+    int64_t icount = replay_get_current_icount();
+    Error *err = NULL;
+
+    timer_mod(snapshot_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                              REPLAY_RAM_SNAPSHOT_POLL_MS);
+
+    if (!runstate_is_running() || !replay_can_snapshot() ||
+        (last >= 0 && icount < last + replay_ram_snapshot_period)) {
+        return;
+    }
+
+    busy = true;
+    vm_stop(RUN_STATE_SAVE_VM);
+    busy = false;
+    if (!replay_ram_snapshot_take(&err)) {
+        warn_report_err(err);
+    }
+    vm_start();
+}
+
+static void replay_ram_snapshot_state_change(void *opaque, bool running,
+                                             RunState state)
+{
+    /* savevm and loadvm use and clear the migration dirty bitmap */
+    if (!busy && (state == RUN_STATE_SAVE_VM ||
+                  state == RUN_STATE_RESTORE_VM)) {
+        all_dirty = true;
+    }
+}
+
+bool replay_ram_snapshot_enabled(void)
+{
+    return snapshots != NULL;
+}
+
+int64_t replay_ram_snapshot_find(int64_t icount)
+{
+    guint i;
+
+    if (!snapshots) {
+        return -1;
+    }
+    for (i = snapshots->len; i-- > 0;) {
+        if (replay_ram_snapshot_get(i)->icount <= icount) {
+            return replay_ram_snapshot_get(i)->icount;
+        }
+    }
+    return -1;
+}
+
+typedef struct RamRestore {
+    guint index;
+} RamRestore;
+
+static void replay_ram_restore_page(RAMBlock *rb, ram_addr_t off,
+                                    void *opaque)
+{
+    RamRestore *r = opaque;
+    gpointer key = replay_ram_page_key(rb, off);
+    size_t page_size = qemu_target_page_size();
+    gpointer data;
+    guint i;
+
+    for (i = r->index + 1; i-- > 0;) {
+        if (g_hash_table_lookup_extended(replay_ram_snapshot_get(i)->pages,
+                                         key, NULL, &data)) {
+            if (data) {
+                memcpy(rb->host + off, data, page_size);
+            } else {
+                memset(rb->host + off, 0, page_size);
+            }
+            memory_region_set_dirty(rb->mr, off, page_size);
+            return;
+        }
+    }
+}
+
+static int replay_ram_restore_block(RAMBlock *rb, void *opaque)
+{
+    RamRestore *r = opaque;
+    size_t page_size = qemu_target_page_size();
+    ram_addr_t off;
+    guint i;
+
+    if (!qemu_ram_is_migratable(rb)) {
+        return 0;
+    }
+
+    /* Pages written since the last snapshot... */
+    replay_ram_foreach_dirty(rb, replay_ram_restore_page, r);
+
+    /* ...and between the target snapshot and the last one */
+    for (off = 0; off < rb->used_length; off += page_size) {
+        gpointer key = replay_ram_page_key(rb, off);
+
+        for (i = r->index + 1; i < snapshots->len; i++) {
+            if (g_hash_table_contains(replay_ram_snapshot_get(i)->pages,
+                                      key)) {
+                replay_ram_restore_page(rb, off, r);
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Clear the dirty bits set by memory_region_set_dirty while restoring. */
+static void replay_ram_ignore_page(RAMBlock *rb, ram_addr_t off, void *opaque)
+{
+}
+
+static int replay_ram_clear_block(RAMBlock *rb, void *opaque)
+{
+    if (qemu_ram_is_migratable(rb)) {
+        replay_ram_foreach_dirty(rb, replay_ram_ignore_page, NULL);
+    }
+    return 0;
+}
+
+bool replay_ram_snapshot_load(int64_t icount, Error **errp)
+{
+    RamRestore r;
+    RamSnapshot *s;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int ret;
+
+    for (r.index = 0; r.index < snapshots->len; r.index++) {
+        if (replay_ram_snapshot_get(r.index)->icount == icount) {
+            break;
+        }
+    }
+    assert(r.index < snapshots->len);
+    s = replay_ram_snapshot_get(r.index);
+
+    busy = true;
+    vm_stop(RUN_STATE_RESTORE_VM);
+    busy = false;
+
+    /* As in load_snapshot: the VM state is going to change */
+    replay_flush_events();
+    qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+
+    if (!global_dirty_log) {
+        memory_global_dirty_log_start();
+        all_dirty = true;
+    }
+    qemu_ram_foreach_block(replay_ram_restore_block, &r);
+    all_dirty = false;
+    qemu_ram_foreach_block(replay_ram_clear_block, NULL);
+
+    bioc = qio_channel_buffer_new(s->devices_len);
+    memcpy(bioc->data, s->devices, s->devices_len);
+    bioc->usage = s->devices_len;
+    f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        ret = -EINVAL;
+    } else {
+        ret = qemu_load_device_state(f);
+    }
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+
+    /* RAM now matches snapshot K, the newer ones will be taken again */
+    g_ptr_array_set_size(snapshots, r.index + 1);
+
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading device state", ret);
+        return false;
+    }
+    return true;
+}
+
+void replay_ram_snapshot_invalidate(void)
+{
+    all_dirty = true;
+}
+
+void replay_ram_snapshot_init(void)
+{
+    BlockBackend *blk = NULL;
+
+    /* Drives used only to store VM snapshots are not attached */
+    while ((blk = blk_next(blk))) {
+        if (blk_get_attached_dev(blk) && blk_is_inserted(blk) &&
+            blk_is_writable(blk)) {
+            warn_report("Replay: in-memory snapshots are disabled, "
+                        "they cannot undo writes to drive '%s'",
+                        blk_name(blk));
+            return;
+        }
+    }
+
+    snapshots = g_ptr_array_new_with_free_func(replay_ram_snapshot_free);
+    all_dirty = true;
+    qemu_add_vm_change_state_handler(replay_ram_snapshot_state_change, NULL);
+    snapshot_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                  replay_ram_snapshot_tick, NULL);
+    timer_mod(snapshot_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
+void replay_ram_snapshot_info(Monitor *mon)
+{
+    if (snapshots && snapshots->len) {
+        monitor_printf(mon, "%u in-memory snapshots, "
+                       "oldest at instruction count %" PRId64 "\n",
+                       snapshots->len, replay_ram_snapshot_get(0)->icount);
+    }
+}
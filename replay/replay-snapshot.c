@@ -22,7 +22,7 @@
 static int replay_pre_save(void *opaque)
 {
     ReplayState *state = opaque;
-    state->file_offset = ftell(replay_file);
+    state->file_offset = replay_chunk_tell();
 
     return 0;
 }
@@ -31,7 +31,7 @@ static int replay_post_load(void *opaque, int version_id)
 {
     ReplayState *state = opaque;
     if (replay_mode == REPLAY_MODE_PLAY) {
-        fseek(replay_file, state->file_offset, SEEK_SET);
+        replay_chunk_seek(state->file_offset);
         /* If this was a vmstate, saved in recording mode,
            we need to initialize replay data fields. */
         replay_fetch_data_kind();
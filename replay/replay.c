@@ -17,13 +17,14 @@
 #include "replay-internal.h"
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
+#include "qemu/bswap.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200a
-/* Size of replay log header */
+#define REPLAY_VERSION              0xe0200b
+/* Size of replay log header: version and chunk index offset */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
@@ -240,6 +241,18 @@ bool replay_has_checkpoint(void)
     return res;
 }
 
+static void replay_write_header(uint64_t index_offset)
+{
+    uint8_t header[HEADER_SIZE];
+
+    stl_be_p(header, REPLAY_VERSION);
+    stq_be_p(header + sizeof(uint32_t), index_offset);
+    fseek(replay_file, 0, SEEK_SET);
+    if (fwrite(header, sizeof(header), 1, replay_file) != 1) {
+        error_report("replay write error");
+    }
+}
+
 static void replay_enable(const char *fname, int mode)
 {
     const char *fmode = NULL;
@@ -274,17 +287,22 @@ static void replay_enable(const char *fname, int mode)
     replay_state.current_icount = 0;
     replay_state.has_unread_data = 0;
 
-    /* skip file header for RECORD and check it for PLAY */
+    /*
+     * Write the file header for RECORD, the index offset is filled in by
+     * replay_finish; check it for PLAY
+     */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_write_header(0);
+        replay_chunk_start(HEADER_SIZE, 0);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t header[HEADER_SIZE];
+
+        if (fread(header, sizeof(header), 1, replay_file) != 1 ||
+            ldl_be_p(header) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_chunk_start(HEADER_SIZE, ldq_be_p(header + sizeof(uint32_t)));
         replay_fetch_data_kind();
     }
 
@@ -325,6 +343,7 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_ram_snapshot_period = qemu_opt_get_number(opts, "rrperiod", 0);
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -347,7 +366,9 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    if (replay_mode == REPLAY_MODE_PLAY && replay_ram_snapshot_period) {
+        replay_ram_snapshot_init();
+    }
 
     replay_enable_events();
 }
@@ -371,9 +392,10 @@ void replay_finish(void)
             /* write end event */
             replay_put_event(EVENT_END);
 
-            /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            /* flush the chunks and point the header at their index */
+            replay_write_header(replay_chunk_finish());
+        } else {
+            replay_chunk_finish();
         }
 
         fclose(replay_file);
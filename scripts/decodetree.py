@@ -35,6 +35,10 @@
 formats = {}
 allpatterns = []
 anyextern = False
+jump_table = False
+jump_table_count = 0
+trans_stubs = False
+stub_functions = {}
 
 translate_prefix = 'trans'
 translate_scope = 'static '
@@ -279,6 +283,7 @@ def __init__(self, func, base):
         self.sign = base.sign
         self.base = base
         self.func = func
+        stub_functions[func] = 'int x'
 
     def __str__(self):
         return self.func + '(' + str(self.base) + ')'
@@ -300,6 +305,7 @@ def __init__(self, func):
         self.mask = 0
         self.sign = 0
         self.func = func
+        stub_functions.setdefault(func, None)
 
     def __str__(self):
         return self.func
@@ -384,9 +390,22 @@ def output_decl(self):
         global translate_prefix
         output('typedef ', self.base.base.struct_name(),
                ' arg_', self.name, ';\n')
+        if trans_stubs:
+            self.output_stub()
+            return
         output(translate_scope, 'bool ', translate_prefix, '_', self.name,
                '(DisasContext *ctx, arg_', self.name, ' *a);\n')
 
+    def output_stub(self):
+        """Define a translator that only reports the match"""
+        name = translate_prefix + '_' + self.name
+        output('#ifndef DECODE_STUB_', name, '\n',
+               '#define DECODE_STUB_', name, '\n',
+               'static bool ', name, '(DisasContext *ctx, arg_', self.name,
+               ' *a)\n{\n',
+               '    return decode_stub_trans(ctx, "', self.name,
+               '", a, sizeof(*a));\n}\n#endif\n')
+
     def output_code(self, i, extracted, outerbits, outermask):
         global translate_prefix
         ind = str_indent(i)
@@ -559,6 +578,13 @@ def str_switch(b):
             def str_case(b):
                 return whexC(b)
 
+        if sh >= 0 and jump_table:
+            width = bin(self.thismask).count('1')
+            if 2 <= width <= 8 and len(self.subs) * 2 >= 1 << width:
+                self.output_jump_table(i, extracted, outerbits, outermask,
+                                       sh, width)
+                return
+
         output(ind, 'switch (', str_switch(self.thismask), ') {\n')
         for b, s in sorted(self.subs):
             assert (self.thismask & ~s.fixedmask) == 0
@@ -570,6 +596,36 @@ def str_case(b):
             s.output_code(i + 4, extracted, innerbits, innermask)
             output(ind, '    break;\n')
         output(ind, '}\n')
+
+    def output_jump_table(self, i, extracted, outerbits, outermask,
+                          sh, width):
+        """Dispatch through a table of label addresses instead of a
+           switch, for dense subtrees.  Every entry is in range by
+           construction, so there is no bounds check."""
+        global jump_table_count
+        ind = str_indent(i)
+        tbl = f'{decode_function}_jt{jump_table_count}'
+        jump_table_count += 1
+        cases = {b >> sh: s for b, s in self.subs}
+
+        output(ind, '{\n')
+        output(ind, f'    static const void * const {tbl}[{1 << width}] = {{\n')
+        for n in range(1 << width):
+            lab = f'{tbl}_{n:x}' if n in cases else f'{tbl}_end'
+            output(ind, f'        &&{lab},\n')
+        output(ind, '    };\n')
+        output(ind, f'    goto *{tbl}[(insn >> {sh}) & {(1 << width) - 1:#x}];\n')
+        output(ind, '}\n')
+        for n, s in sorted(cases.items()):
+            assert (self.thismask & ~s.fixedmask) == 0
+            innermask = outermask | self.thismask
+            innerbits = outerbits | (n << sh)
+            output(str_indent(max(i - 4, 0)), f' {tbl}_{n:x}:\n')
+            output(ind, '/* ', str_match_bits(innerbits, innermask), ' */\n')
+            s.output_code(i, extracted, innerbits, innermask)
+            output(ind, f'goto {tbl}_end;\n')
+        output(str_indent(max(i - 4, 0)), f' {tbl}_end:\n')
+        output(ind, ';\n')
 # end Tree
 
 
@@ -1289,8 +1345,12 @@ def main():
 
     decode_scope = 'static '
 
+    global jump_table
+    global trans_stubs
+
     long_opts = ['decode=', 'translate=', 'output=', 'insnwidth=',
-                 'static-decode=', 'varinsnwidth=']
+                 'static-decode=', 'varinsnwidth=', 'jump-table',
+                 'trans-stubs']
     try:
         (opts, args) = getopt.gnu_getopt(sys.argv[1:], 'o:vw:', long_opts)
     except getopt.GetoptError as err:
@@ -1319,6 +1379,10 @@ def main():
                 bitop_width = 64
             elif insnwidth != 32:
                 error(0, 'cannot handle insns of width', insnwidth)
+        elif o == '--jump-table':
+            jump_table = True
+        elif o == '--trans-stubs':
+            trans_stubs = True
         else:
             assert False, 'unhandled option'
 
@@ -1388,6 +1452,16 @@ def main():
     if anyextern:
         output("#pragma GCC diagnostic pop\n\n")
 
+    if trans_stubs:
+        for n in sorted(stub_functions.keys()):
+            args = stub_functions[n]
+            output('#ifndef DECODE_STUB_', n, '\n',
+                   '#define DECODE_STUB_', n, '\n',
+                   'static inline int ', n, '(DisasContext *ctx',
+                   ', ' + args if args else '', ')\n{\n',
+                   '    return ', 'x' if args else '0', ';\n}\n#endif\n')
+        output('\n')
+
     for n in sorted(formats.keys()):
         f = formats[n]
         f.output_extract()
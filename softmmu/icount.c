@@ -57,6 +57,7 @@ static bool icount_sleep = true;
  * 2 = Runtime adaptive algorithm to compute shift
  */
 int use_icount;
+bool use_icount_quanta;
 
 static void icount_enable_precise(void)
 {
@@ -288,6 +289,16 @@ static void icount_timer_cb(void *opaque)
     icount_warp_rt();
 }
 
+static void icount_add_bias(int64_t delta)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    qatomic_set_i64(&timers_state.qemu_icount_bias,
+                    timers_state.qemu_icount_bias + delta);
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+}
+
 void icount_start_warp_timer(void)
 {
     int64_t clock;
@@ -303,6 +314,11 @@ void icount_start_warp_timer(void)
         return;
     }
 
+    /* The vCPU threads warp the clock themselves, see icount_warp_idle.  */
+    if (icount_quanta_enabled()) {
+        return;
+    }
+
     if (replay_mode != REPLAY_MODE_PLAY) {
         if (!all_cpu_threads_idle()) {
             return;
@@ -359,12 +375,7 @@ void icount_start_warp_timer(void)
              * It is useful when we want a deterministic execution time,
              * isolated from host latencies.
              */
-            seqlock_write_lock(&timers_state.vm_clock_seqlock,
-                               &timers_state.vm_clock_lock);
-            qatomic_set_i64(&timers_state.qemu_icount_bias,
-                            timers_state.qemu_icount_bias + deadline);
-            seqlock_write_unlock(&timers_state.vm_clock_seqlock,
-                                 &timers_state.vm_clock_lock);
+            icount_add_bias(deadline);
             qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
         } else {
             /*
@@ -391,6 +402,18 @@ void icount_start_warp_timer(void)
     }
 }
 
+bool icount_warp_idle(void)
+{
+    int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                                  ~QEMU_TIMER_ATTR_EXTERNAL);
+
+    if (deadline < 0) {
+        return false;
+    }
+    icount_add_bias(deadline);
+    return true;
+}
+
 void icount_account_warp_timer(void)
 {
     if (!icount_sleep) {
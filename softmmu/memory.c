@@ -16,12 +16,14 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 #include "exec/memory.h"
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
@@ -1412,27 +1414,152 @@ bool memory_region_access_valid(MemoryRegion *mr,
     return true;
 }
 
+/*
+ * MMIO statistics.  While enabled, the calls to the read and write
+ * callbacks of each region are counted and timed.  A region joins
+ * mmio_stats_regions on its first counted access and leaves it when it
+ * is finalized.  When disabled, the cost is a test of mmio_stats_enabled
+ * per access.
+ */
+static bool mmio_stats_enabled;
+static QemuMutex mmio_stats_lock;
+static QTAILQ_HEAD(, MemoryRegion) mmio_stats_regions =
+    QTAILQ_HEAD_INITIALIZER(mmio_stats_regions);
+
+static inline int64_t mmio_stats_start(void)
+{
+    return unlikely(qatomic_read(&mmio_stats_enabled)) ? get_clock() : 0;
+}
+
+static void mmio_stats_account(MemoryRegion *mr, bool is_write, int64_t start)
+{
+    int64_t ns = get_clock() - start;
+
+    if (unlikely(!qatomic_read(&mr->stats_listed))) {
+        qemu_mutex_lock(&mmio_stats_lock);
+        if (!mr->stats_listed) {
+            QTAILQ_INSERT_TAIL(&mmio_stats_regions, mr, stats_link);
+            qatomic_set(&mr->stats_listed, true);
+        }
+        qemu_mutex_unlock(&mmio_stats_lock);
+    }
+
+    if (is_write) {
+        stat64_add(&mr->stats.writes, 1);
+        stat64_add(&mr->stats.write_ns, ns);
+    } else {
+        stat64_add(&mr->stats.reads, 1);
+        stat64_add(&mr->stats.read_ns, ns);
+    }
+}
+
+static void mmio_stats_unlist(MemoryRegion *mr)
+{
+    if (mr->stats_listed) {
+        qemu_mutex_lock(&mmio_stats_lock);
+        QTAILQ_REMOVE(&mmio_stats_regions, mr, stats_link);
+        qemu_mutex_unlock(&mmio_stats_lock);
+    }
+}
+
+void qmp_x_set_mmio_stats(bool enable, Error **errp)
+{
+    qatomic_set(&mmio_stats_enabled, enable);
+}
+
+static gint mmio_stats_cmp(gconstpointer a, gconstpointer b)
+{
+    const MmioStatsInfo *ia = *(MmioStatsInfo **)a;
+    const MmioStatsInfo *ib = *(MmioStatsInfo **)b;
+    uint64_t ta = ia->read_ns + ia->write_ns;
+    uint64_t tb = ib->read_ns + ib->write_ns;
+
+    return ta > tb ? -1 : ta < tb;
+}
+
+MmioStatsInfoList *qmp_x_query_mmio_stats(bool has_max, int64_t max,
+                                          bool has_reset, bool reset,
+                                          Error **errp)
+{
+    g_autoptr(GPtrArray) infos = g_ptr_array_new();
+    MmioStatsInfoList *head = NULL, **tail = &head;
+    MemoryRegion *mr;
+    int i;
+
+    if (!has_max) {
+        max = INT64_MAX;
+    } else if (max < 0) {
+        error_setg(errp, "Parameter 'max' must not be negative");
+        return NULL;
+    }
+
+    qemu_mutex_lock(&mmio_stats_lock);
+    QTAILQ_FOREACH(mr, &mmio_stats_regions, stats_link) {
+        MmioStatsInfo *info = g_new0(MmioStatsInfo, 1);
+
+        info->name = g_strdup(memory_region_name(mr));
+        if (mr->owner) {
+            info->owner = object_get_canonical_path(mr->owner);
+            info->has_owner = info->owner != NULL;
+        }
+        info->reads = stat64_get(&mr->stats.reads);
+        info->read_ns = stat64_get(&mr->stats.read_ns);
+        info->writes = stat64_get(&mr->stats.writes);
+        info->write_ns = stat64_get(&mr->stats.write_ns);
+        g_ptr_array_add(infos, info);
+
+        /* Accesses that race with the reset may be lost */
+        if (has_reset && reset) {
+            stat64_init(&mr->stats.reads, 0);
+            stat64_init(&mr->stats.read_ns, 0);
+            stat64_init(&mr->stats.writes, 0);
+            stat64_init(&mr->stats.write_ns, 0);
+        }
+    }
+    qemu_mutex_unlock(&mmio_stats_lock);
+
+    g_ptr_array_sort(infos, mmio_stats_cmp);
+    for (i = 0; i < infos->len; i++) {
+        MmioStatsInfo *info = g_ptr_array_index(infos, i);
+
+        if (i < max && (info->reads || info->writes)) {
+            QAPI_LIST_APPEND(tail, info);
+        } else {
+            qapi_free_MmioStatsInfo(info);
+        }
+    }
+    return head;
+}
+
 static MemTxResult memory_region_dispatch_read1(MemoryRegion *mr,
                                                 hwaddr addr,
                                                 uint64_t *pval,
                                                 unsigned size,
                                                 MemTxAttrs attrs)
 {
+    int64_t start = mmio_stats_start();
+    MemTxResult r;
+
     *pval = 0;
 
     if (mr->ops->read) {
-        return access_with_adjusted_size(addr, pval, size,
-                                         mr->ops->impl.min_access_size,
-                                         mr->ops->impl.max_access_size,
-                                         memory_region_read_accessor,
-                                         mr, attrs);
+        r = access_with_adjusted_size(addr, pval, size,
+                                      mr->ops->impl.min_access_size,
+                                      mr->ops->impl.max_access_size,
+                                      memory_region_read_accessor,
+                                      mr, attrs);
     } else {
-        return access_with_adjusted_size(addr, pval, size,
-                                         mr->ops->impl.min_access_size,
-                                         mr->ops->impl.max_access_size,
-                                         memory_region_read_with_attrs_accessor,
-                                         mr, attrs);
+        r = access_with_adjusted_size(addr, pval, size,
+                                      mr->ops->impl.min_access_size,
+                                      mr->ops->impl.max_access_size,
+                                      memory_region_read_with_attrs_accessor,
+                                      mr, attrs);
+    }
+
+    if (unlikely(start)) {
+        mmio_stats_account(mr, false, start);
     }
+    return r;
 }
 
 MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
@@ -1487,6 +1614,8 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          MemTxAttrs attrs)
 {
     unsigned size = memop_size(op);
+    int64_t start;
+    MemTxResult r;
 
     if (!memory_region_access_valid(mr, addr, size, true, attrs)) {
         unassigned_mem_write(mr, addr, data, size);
@@ -1500,20 +1629,25 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
         return MEMTX_OK;
     }
 
+    start = mmio_stats_start();
     if (mr->ops->write) {
-        return access_with_adjusted_size(addr, &data, size,
-                                         mr->ops->impl.min_access_size,
-                                         mr->ops->impl.max_access_size,
-                                         memory_region_write_accessor, mr,
-                                         attrs);
+        r = access_with_adjusted_size(addr, &data, size,
+                                      mr->ops->impl.min_access_size,
+                                      mr->ops->impl.max_access_size,
+                                      memory_region_write_accessor, mr,
+                                      attrs);
     } else {
-        return
-            access_with_adjusted_size(addr, &data, size,
+        r = access_with_adjusted_size(addr, &data, size,
                                       mr->ops->impl.min_access_size,
                                       mr->ops->impl.max_access_size,
                                       memory_region_write_with_attrs_accessor,
                                       mr, attrs);
     }
+
+    if (unlikely(start)) {
+        mmio_stats_account(mr, true, start);
+    }
+    return r;
 }
 
 void memory_region_init_io(MemoryRegion *mr,
@@ -1746,6 +1880,7 @@ static void memory_region_finalize(Object *obj)
      * and cause an infinite loop.
      */
     mr->enabled = false;
+    mmio_stats_unlist(mr);
     memory_region_transaction_begin();
     while (!QTAILQ_EMPTY(&mr->subregions)) {
         MemoryRegion *subregion = QTAILQ_FIRST(&mr->subregions);
@@ -3423,6 +3558,7 @@ static const TypeInfo ram_discard_manager_info = {
 
 static void memory_register_types(void)
 {
+    qemu_mutex_init(&mmio_stats_lock);
     type_register_static(&memory_region_info);
     type_register_static(&iommu_memory_region_info);
     type_register_static(&ram_discard_manager_info);
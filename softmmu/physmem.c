@@ -23,6 +23,7 @@
 
 #include "qemu/cutils.h"
 #include "qemu/cacheflush.h"
+#include "qemu/interval-index.h"
 
 #ifdef CONFIG_TCG
 #include "hw/core/tcg-cpu-ops.h"
@@ -766,6 +767,18 @@ AddressSpace *cpu_get_address_space(CPUState *cpu, int asidx)
     return cpu->cpu_ases[asidx].as;
 }
 
+/*
+ * Besides the list, the watchpoints of a CPU are kept in an interval
+ * index, so that the checks done on each TLB fill, and on each access
+ * to a watched page, stay cheap with many watchpoints of any length.
+ * The index is rebuilt on demand after the watchpoints change.
+ */
+static void cpu_watchpoint_index_invalidate(CPUState *cpu)
+{
+    interval_index_free(cpu->watchpoint_index);
+    cpu->watchpoint_index = NULL;
+}
+
 /* Add a watchpoint.  */
 int cpu_watchpoint_insert(CPUState *cpu, vaddr addr, vaddr len,
                           int flags, CPUWatchpoint **watchpoint)
@@ -791,6 +804,7 @@ int cpu_watchpoint_insert(CPUState *cpu, vaddr addr, vaddr len,
     } else {
         QTAILQ_INSERT_TAIL(&cpu->watchpoints, wp, entry);
     }
+    cpu_watchpoint_index_invalidate(cpu);
 
     in_page = -(addr | TARGET_PAGE_MASK);
     if (len <= in_page) {
@@ -824,6 +838,7 @@ int cpu_watchpoint_remove(CPUState *cpu, vaddr addr, vaddr len,
 void cpu_watchpoint_remove_by_ref(CPUState *cpu, CPUWatchpoint *watchpoint)
 {
     QTAILQ_REMOVE(&cpu->watchpoints, watchpoint, entry);
+    cpu_watchpoint_index_invalidate(cpu);
 
     tlb_flush_page(cpu, watchpoint->vaddr);
 
@@ -862,17 +877,37 @@ static inline bool watchpoint_address_matches(CPUWatchpoint *wp,
     return !(addr > wpend || wp->vaddr > addrend);
 }
 
+static IntervalIndex *cpu_watchpoint_index(CPUState *cpu)
+{
+    CPUWatchpoint *wp;
+
+    if (!cpu->watchpoint_index) {
+        cpu->watchpoint_index = interval_index_new();
+        QTAILQ_FOREACH(wp, &cpu->watchpoints, entry) {
+            interval_index_insert(cpu->watchpoint_index, wp->vaddr,
+                                  wp->vaddr + wp->len - 1,
+                                  wp->flags & ~BP_WATCHPOINT_HIT);
+        }
+    }
+    return cpu->watchpoint_index;
+}
+
+static void cpu_watchpoint_flags_or(uint64_t start, uint64_t last,
+                                    uint64_t value, void *opaque)
+{
+    *(int *)opaque |= value;
+}
+
 /* Return flags for watchpoints that match addr + prot.  */
 int cpu_watchpoint_address_matches(CPUState *cpu, vaddr addr, vaddr len)
 {
-    CPUWatchpoint *wp;
     int ret = 0;
 
-    QTAILQ_FOREACH(wp, &cpu->watchpoints, entry) {
-        if (watchpoint_address_matches(wp, addr, len)) {
-            ret |= wp->flags;
-        }
+    if (QTAILQ_EMPTY(&cpu->watchpoints)) {
+        return 0;
     }
+    interval_index_foreach(cpu_watchpoint_index(cpu), addr, addr + len - 1,
+                           cpu_watchpoint_flags_or, &ret);
     return ret;
 }
 
@@ -900,6 +935,15 @@ void cpu_check_watchpoint(CPUState *cpu, vaddr addr, vaddr len,
         /* this is currently used only by ARM BE32 */
         addr = cc->tcg_ops->adjust_watchpoint_address(cpu, addr, len);
     }
+
+    /*
+     * The whole page is flagged TLB_WATCHPOINT, so most accesses that
+     * get here miss the watchpoints; the index settles them quickly.
+     */
+    if (!(cpu_watchpoint_address_matches(cpu, addr, len) & flags)) {
+        return;
+    }
+
     QTAILQ_FOREACH(wp, &cpu->watchpoints, entry) {
         if (watchpoint_address_matches(wp, addr, len)
             && (wp->flags & flags)) {
@@ -3431,6 +3475,23 @@ int cpu_memory_rw_debug(CPUState *cpu, target_ulong addr,
         if (phys_addr == -1)
             return -1;
         l = (page + TARGET_PAGE_SIZE) - addr;
+        /*
+         * Extend the access over the following pages for as long as they
+         * are physically contiguous, so that large accesses (e.g. a
+         * debugger dumping a buffer) are done in a few address space
+         * accesses rather than in one per page.
+         */
+        while (l < len) {
+            MemTxAttrs next_attrs;
+            hwaddr next = cpu_get_phys_page_attrs_debug(cpu, addr + l,
+                                                        &next_attrs);
+
+            if (next != phys_addr + (addr + l - page) ||
+                memcmp(&next_attrs, &attrs, sizeof(attrs))) {
+                break;
+            }
+            l += TARGET_PAGE_SIZE;
+        }
         if (l > len)
             l = len;
         phys_addr += (addr & ~TARGET_PAGE_MASK);
@@ -5,6 +5,7 @@
 /* icount - Instruction Counter API */
 
 int use_icount;
+bool use_icount_quanta;
 
 void icount_update(CPUState *cpu)
 {
@@ -43,3 +44,9 @@ void icount_account_warp_timer(void)
 {
     abort();
 }
+
+bool icount_warp_idle(void)
+{
+    abort();
+    return false;
+}
@@ -971,6 +971,12 @@ struct ARMCPU {
     uint64_t reset_cbar;
     uint32_t reset_auxcr;
     bool reset_hivecs;
+    /*
+     * Set by uniprocessor boards whose bus masters never rely on
+     * exclusives: STREX only checks the local monitor address and then
+     * does a plain store.  Ignored when translating for parallel execution.
+     */
+    bool local_excl_monitor;
 
     /*
      * Intermediate values used during property parsing.
@@ -10441,6 +10441,11 @@ void arm_cpu_do_interrupt(CPUState *cs)
 
     arm_call_pre_el_change_hook(cpu);
 
+    if (cpu->local_excl_monitor) {
+        /* STREX does not compare values; an interrupted one must fail.  */
+        env->exclusive_addr = -1;
+    }
+
     assert(!excp_is_internal(cs->exception_index));
     if (arm_el_is_aa64(env, new_el)) {
         arm_cpu_do_interrupt_aarch64(cs);
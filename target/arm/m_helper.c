@@ -855,6 +855,11 @@ static void v7m_exception_taken(ARMCPU *cpu, uint32_t lr, bool dotailchain,
     qemu_log_mask(CPU_LOG_INT, "...taking pending %s exception %d\n",
                   targets_secure ? "secure" : "nonsecure", exc);
 
+    if (cpu->local_excl_monitor) {
+        /* ExceptionTaken() does ClearExclusiveLocal(); STREX relies on it */
+        env->exclusive_addr = -1;
+    }
+
     if (dotailchain) {
         /* Sanitize LR FType and PREFIX bits */
         if (!cpu_isar_feature(aa32_vfp_simd, cpu)) {
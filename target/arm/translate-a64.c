@@ -2398,6 +2398,9 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
     int idx = get_mem_index(s);
     MemOp memop = s->be_data;
 
+    /* Order exclusive loads like the store-exclusive that follows.  */
+    tcg_gen_quantum_serial();
+
     g_assert(size <= 3);
     if (is_pair) {
         g_assert(size >= 2);
@@ -2454,6 +2457,8 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     TCGLabel *done_label = gen_new_label();
     TCGv_i64 tmp;
 
+    /* The paired cmpxchg helpers are not covered by tcg-op.c.  */
+    tcg_gen_quantum_serial();
     tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
 
     tmp = tcg_temp_new_i64();
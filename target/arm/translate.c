@@ -4974,6 +4974,8 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
     TCGv_i32 tmp = tcg_temp_new_i32();
     MemOp opc = size | MO_ALIGN | s->be_data;
 
+    /* Order exclusive loads like the store-exclusive that follows.  */
+    tcg_gen_quantum_serial();
     s->is_ldex = true;
 
     if (size == 3) {
@@ -5041,7 +5043,30 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     taddr = gen_aa32_addr(s, addr, opc);
     t0 = tcg_temp_new_i32();
     t1 = load_reg(s, rt);
-    if (size == 3) {
+    if (s->local_excl) {
+        /*
+         * Nothing but this vCPU can write to memory while the monitor is
+         * open, and exception entry closes it, so the address check alone
+         * decides the outcome: no need to compare the value.
+         */
+        if (size == 3) {
+            TCGv_i64 n64 = tcg_temp_new_i64();
+
+            t2 = load_reg(s, rt2);
+            /* As below, the word at the lowest address is always Rt.  */
+            if (s->be_data == MO_BE) {
+                tcg_gen_concat_i32_i64(n64, t2, t1);
+            } else {
+                tcg_gen_concat_i32_i64(n64, t1, t2);
+            }
+            tcg_temp_free_i32(t2);
+            tcg_gen_qemu_st_i64(n64, taddr, get_mem_index(s), opc);
+            tcg_temp_free_i64(n64);
+        } else {
+            tcg_gen_qemu_st_i32(t1, taddr, get_mem_index(s), opc);
+        }
+        tcg_gen_movi_i32(t0, 0);
+    } else if (size == 3) {
         TCGv_i64 o64 = tcg_temp_new_i64();
         TCGv_i64 n64 = tcg_temp_new_i64();
 
@@ -8315,7 +8340,18 @@ static bool trans_CLRM(DisasContext *s, arg_CLRM *a)
 
 static bool trans_B(DisasContext *s, arg_i *a)
 {
-    gen_jmp(s, read_pc(s) + a->imm);
+    uint32_t dest = read_pc(s) + a->imm;
+
+    /*
+     * An unconditional branch outside an IT block need not end the TB;
+     * if allowed, just carry on translating at the destination.
+     */
+    if (!s->condjmp && !s->condexec_mask && !s->eci &&
+        !is_singlestepping(s) && translator_follow_branch(&s->base, dest)) {
+        s->base.pc_next = dest;
+        return true;
+    }
+    gen_jmp(s, dest);
     return true;
 }
 
@@ -9359,6 +9395,8 @@ static void arm_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     dc->ss_active = EX_TBFLAG_ANY(tb_flags, SS_ACTIVE);
     dc->pstate_ss = EX_TBFLAG_ANY(tb_flags, PSTATE__SS);
     dc->is_ldex = false;
+    dc->local_excl = cpu->local_excl_monitor &&
+                     !(tb_cflags(dc->base.tb) & CF_PARALLEL);
 
     dc->page_start = dc->base.pc_first & TARGET_PAGE_MASK;
 
@@ -9503,7 +9541,12 @@ static void arm_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     arm_post_translate_insn(dc);
 
     /* ARM is a fixed-length ISA.  We performed the cross-page check
-       in init_disas_context by adjusting max_insns.  */
+       in init_disas_context by adjusting max_insns, but that bound no
+       longer holds once trans_B has skipped ahead within the page.  */
+    if (dc->base.is_jmp == DISAS_NEXT && dc->base.num_followed
+        && dc->base.pc_next - dc->page_start >= TARGET_PAGE_SIZE) {
+        dc->base.is_jmp = DISAS_TOO_MANY;
+    }
 }
 
 static bool thumb_insn_is_unconditional(DisasContext *s, uint32_t insn)
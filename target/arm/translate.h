@@ -84,6 +84,11 @@ typedef struct DisasContext {
      * ie A64 LDX*, LDAX*, A32/T32 LDREX*, LDAEX*.
      */
     bool is_ldex;
+    /*
+     * True if store-exclusive may be lowered to an address check and a
+     * plain store, see ARMCPU::local_excl_monitor.
+     */
+    bool local_excl;
     /* True if AccType_UNPRIV should be used for LDTR et al */
     bool unpriv;
     /* True if v8.3-PAuth is active.  */
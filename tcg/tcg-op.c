@@ -3105,6 +3105,14 @@ static void * const table_cmpxchg[16] = {
     WITH_ATOMIC64([MO_64 | MO_BE] = gen_helper_atomic_cmpxchgq_be)
 };
 
+void tcg_gen_quantum_serial(void)
+{
+    if ((tcg_ctx->tb_cflags & (CF_QUANTUM | CF_PARALLEL)) ==
+        (CF_QUANTUM | CF_PARALLEL)) {
+        gen_helper_quantum_serial(cpu_env);
+    }
+}
+
 void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
                                 TCGv_i32 newv, TCGArg idx, MemOp memop)
 {
@@ -3131,6 +3139,7 @@ void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
         gen_atomic_cx_i32 gen;
         TCGMemOpIdx oi;
 
+        tcg_gen_quantum_serial();
         gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
         tcg_debug_assert(gen != NULL);
 
@@ -3170,6 +3179,7 @@ void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
         gen_atomic_cx_i64 gen;
         TCGMemOpIdx oi;
 
+        tcg_gen_quantum_serial();
         gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
         tcg_debug_assert(gen != NULL);
 
@@ -3228,6 +3238,7 @@ static void do_atomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
 
     memop = tcg_canonicalize_memop(memop, 0, 0);
 
+    tcg_gen_quantum_serial();
     gen = table[memop & (MO_SIZE | MO_BSWAP)];
     tcg_debug_assert(gen != NULL);
 
@@ -3268,6 +3279,7 @@ static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
         gen_atomic_op_i64 gen;
         TCGMemOpIdx oi;
 
+        tcg_gen_quantum_serial();
         gen = table[memop & (MO_SIZE | MO_BSWAP)];
         tcg_debug_assert(gen != NULL);
 
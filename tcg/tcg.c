@@ -59,6 +59,7 @@
 #include "elf.h"
 #include "exec/log.h"
 #include "tcg-internal.h"
+#include "accel/tcg/perf.h"
 
 #ifdef CONFIG_TCG_INTERPRETER
 #include <ffi.h>
@@ -750,6 +751,7 @@ void tcg_prologue_init(TCGContext *s)
 #ifndef CONFIG_TCG_INTERPRETER
     flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(s->code_buf),
                         (uintptr_t)s->code_buf, prologue_size);
+    perf_report_prologue(tcg_splitwx_to_rx(s->code_buf), prologue_size);
 #endif
 
 #ifdef DEBUG_DISAS
@@ -2225,6 +2227,13 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
+
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+        return op;
+    }
+#endif
     QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
     return op;
 }
@@ -2396,6 +2405,44 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/*
+ * liveness analysis: label only reached by falling through and by
+ * earlier conditional branches: globals are synced but may stay in
+ * registers, temps are as at the end of a basic block.  So are
+ * indirect globals: liveness_pass_2 expects them to be dead at every
+ * label and reloads them on their next use.
+ */
+static void la_bb_join(TCGContext *s, int ng, int nt)
+{
+    la_global_sync(s, ng);
+
+    for (int i = 0; i < ng; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->indirect_reg) {
+            ts->state = TS_DEAD | TS_MEM;
+            la_reset_pref(ts);
+        }
+    }
+
+    for (int i = ng; i < nt; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        switch (ts->kind) {
+        case TEMP_LOCAL:
+            ts->state = TS_DEAD | TS_MEM;
+            break;
+        case TEMP_NORMAL:
+        case TEMP_CONST:
+            ts->state = TS_DEAD;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        la_reset_pref(ts);
+    }
+}
+
 /*
  * liveness analysis: conditional branch: all temps are dead,
  * globals and local temps should be synced.
@@ -2461,6 +2508,46 @@ static void la_cross_call(TCGContext *s, int nt)
     }
 }
 
+static TCGLabel *branch_label(TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+    return arg_label(op->args[def->nb_oargs + def->nb_iargs
+                              + def->nb_cargs - 1]);
+}
+
+/*
+ * Find the labels whose only predecessors are the preceding op and
+ * conditional branches before the label.  The register allocator can
+ * keep globals in registers across those, see tcg_reg_alloc_label().
+ */
+static void label_join_pass(TCGContext *s)
+{
+    TCGLabel *l;
+    TCGOp *op;
+
+    QSIMPLEQ_FOREACH(l, &s->labels, next) {
+        l->join_globals = 1;
+        l->set_seen = 0;
+        l->reg_state = NULL;
+    }
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+        if (op->opc == INDEX_op_set_label) {
+            arg_label(op->args[0])->set_seen = 1;
+        } else if (def->flags & TCG_OPF_COND_BRANCH) {
+            l = branch_label(op);
+            if (l->set_seen) {
+                l->join_globals = 0;
+            }
+        } else if (op->opc == INDEX_op_br) {
+            arg_label(op->args[0])->join_globals = 0;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2472,6 +2559,8 @@ static void liveness_pass_1(TCGContext *s)
     TCGRegSet *prefs;
     int i;
 
+    label_join_pass(s);
+
     prefs = tcg_malloc(sizeof(TCGRegSet) * nb_temps);
     for (i = 0; i < nb_temps; ++i) {
         s->temps[i].state_ptr = prefs + i;
@@ -2706,6 +2795,9 @@ static void liveness_pass_1(TCGContext *s)
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
                 la_bb_sync(s, nb_globals, nb_temps);
+            } else if (opc == INDEX_op_set_label
+                       && arg_label(op->args[0])->join_globals) {
+                la_bb_join(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3332,8 +3424,8 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
 }
 
 /* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
-static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+   local temps are stored at their canonical location. */
+static void temps_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 {
     int i;
 
@@ -3357,17 +3449,80 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
             g_assert_not_reached();
         }
     }
+}
 
+/* at the end of a basic block, we assume all temporaries are dead and
+   all globals are stored at their canonical location. */
+static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+{
+    temps_bb_end(s, allocated_regs);
     save_globals(s, allocated_regs);
 }
 
+/*
+ * At a label reached only by falling through and by earlier conditional
+ * branches, globals are synced on every incoming edge.  A global may stay
+ * in its register if it was in that same register on all of the branches.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGLabel *l)
+{
+    TCGTemp **reg_state = l->reg_state;
+
+    if (!l->join_globals || !reg_state) {
+        tcg_reg_alloc_bb_end(s, s->reserved_regs);
+        return;
+    }
+
+    temps_bb_end(s, s->reserved_regs);
+
+    for (int i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind == TEMP_FIXED) {
+            continue;
+        }
+        if (ts->val_type == TEMP_VAL_REG && reg_state[ts->reg] == ts) {
+            tcg_debug_assert(ts->mem_coherent);
+            continue;
+        }
+        tcg_debug_assert(ts->val_type == TEMP_VAL_MEM || ts->mem_coherent);
+        temp_free_or_dead(s, ts, -1);
+    }
+}
+
+/* Record which globals are in registers on a branch to @l */
+static void tcg_reg_alloc_note_branch(TCGContext *s, TCGLabel *l)
+{
+    TCGTemp **reg_state = l->reg_state;
+    int i;
+
+    if (reg_state == NULL) {
+        reg_state = l->reg_state =
+            tcg_malloc(sizeof(TCGTemp *) * TCG_TARGET_NB_REGS);
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            TCGTemp *ts = s->reg_to_temp[i];
+            reg_state[i] = ts && ts->kind == TEMP_GLOBAL ? ts : NULL;
+        }
+    } else {
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            if (reg_state[i] != s->reg_to_temp[i]) {
+                reg_state[i] = NULL;
+            }
+        }
+    }
+}
+
 /*
  * At a conditional branch, we assume all temporaries are dead and
  * all globals and local temps are synced to their location.
  */
-static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs,
+                                  TCGLabel *l)
 {
     sync_globals(s, allocated_regs);
+    if (l->join_globals) {
+        tcg_reg_alloc_note_branch(s, l);
+    }
 
     for (int i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
@@ -3731,7 +3886,7 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
     }
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
-        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_cbranch(s, i_allocated_regs, branch_label(op));
     } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
@@ -4322,7 +4477,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
             temp_dead(s, arg_temp(op->args[0]));
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, arg_label(op->args[0]));
             tcg_out_label(s, arg_label(op->args[0]));
             break;
         case INDEX_op_call:
@@ -0,0 +1,32 @@
+/*
+ * Decodetree decoder benchmark: A32, T32 and T16, as in translate.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-a32.c.inc"
+#include "decode-a32-uncond.c.inc"
+#include "decode-t32.c.inc"
+#include "decode-t16.c.inc"
+
+bool decode_bench_a32(DisasContext *ctx, uint32_t insn)
+{
+    /* As disas_arm_insn(), for which the 0xf condition is separate.  */
+    if ((insn >> 28) == 0xf) {
+        return disas_a32_uncond(ctx, insn);
+    }
+    return disas_a32(ctx, insn);
+}
+
+bool decode_bench_t32(DisasContext *ctx, uint32_t insn)
+{
+    return disas_t32(ctx, insn);
+}
+
+bool decode_bench_t16(DisasContext *ctx, uint32_t insn)
+{
+    return disas_t16(ctx, insn);
+}
@@ -0,0 +1,16 @@
+/*
+ * Decodetree decoder benchmark: M-profile coprocessor space, as in
+ * translate-m-nocp.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-m-nocp.c.inc"
+
+bool decode_bench_m_nocp(DisasContext *ctx, uint32_t insn)
+{
+    return disas_m_nocp(ctx, insn);
+}
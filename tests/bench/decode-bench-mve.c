@@ -0,0 +1,15 @@
+/*
+ * Decodetree decoder benchmark: MVE, as in translate-mve.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-mve.c.inc"
+
+bool decode_bench_mve(DisasContext *ctx, uint32_t insn)
+{
+    return disas_mve(ctx, insn);
+}
@@ -0,0 +1,18 @@
+/*
+ * Decodetree decoder benchmark: Neon, as in translate-neon.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-neon-dp.c.inc"
+#include "decode-neon-ls.c.inc"
+#include "decode-neon-shared.c.inc"
+
+bool decode_bench_neon(DisasContext *ctx, uint32_t insn)
+{
+    return disas_neon_dp(ctx, insn) || disas_neon_ls(ctx, insn) ||
+           disas_neon_shared(ctx, insn);
+}
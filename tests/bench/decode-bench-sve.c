@@ -0,0 +1,15 @@
+/*
+ * Decodetree decoder benchmark: SVE, as in translate-sve.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-sve.c.inc"
+
+bool decode_bench_sve(DisasContext *ctx, uint32_t insn)
+{
+    return disas_sve(ctx, insn);
+}
@@ -0,0 +1,16 @@
+/*
+ * Decodetree decoder benchmark: VFP, as in translate-vfp.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "decode-bench.h"
+
+#include "decode-vfp.c.inc"
+#include "decode-vfp-uncond.c.inc"
+
+bool decode_bench_vfp(DisasContext *ctx, uint32_t insn)
+{
+    return disas_vfp_uncond(ctx, insn) || disas_vfp(ctx, insn);
+}
@@ -0,0 +1,191 @@
+/*
+ * Decodetree decoder benchmark.
+ *
+ * Run each Arm frontend's decoder over an instruction stream and report
+ * how many instructions per second it decodes.  The stream is either a
+ * raw little-endian code dump (e.g. from "objcopy -O binary" on guest
+ * firmware) or, by default, random words.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qemu/bswap.h"
+#include "decode-bench.h"
+
+typedef struct DecodeBench {
+    const char *name;
+    bool (*decode)(DisasContext *ctx, uint32_t insn);
+    bool thumb;
+} DecodeBench;
+
+static const DecodeBench benches[] = {
+    { "a32", decode_bench_a32 },
+    { "thumb", NULL, true },
+    { "vfp", decode_bench_vfp },
+    { "neon", decode_bench_neon },
+    { "mve", decode_bench_mve },
+    { "m-nocp", decode_bench_m_nocp },
+    { "sve", decode_bench_sve },
+};
+
+static uint8_t *code;
+static size_t n_insns = 1 << 20;
+static const char *input_file;
+static const char *only;
+static unsigned int repeat = 10;
+
+static const char commands_string[] =
+    " -f = raw little-endian instruction stream (default: random words)\n"
+    " -b = only run this decoder (a32, thumb, vfp, neon, mve, m-nocp, sve)\n"
+    " -n = number of random instructions\n"
+    " -r = number of passes over the stream";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void load_insns(void)
+{
+    size_t i;
+
+    if (input_file) {
+        GError *err = NULL;
+        gsize len;
+
+        if (!g_file_get_contents(input_file, (gchar **)&code, &len, &err)) {
+            fprintf(stderr, "%s\n", err->message);
+            exit(1);
+        }
+        n_insns = len / 4;
+        if (n_insns == 0) {
+            fprintf(stderr, "%s: no instructions\n", input_file);
+            exit(1);
+        }
+    } else {
+        uint64_t r = 1;
+
+        code = g_malloc(n_insns * 4);
+        for (i = 0; i < n_insns; i++) {
+            r = xorshift64star(r);
+            stl_le_p(code + i * 4, r >> 32);
+        }
+    }
+}
+
+/*
+ * Walk the stream as halfwords, as thumb_tr_translate_insn does: the
+ * top five bits of the first halfword select a 32-bit encoding.
+ */
+static size_t run_thumb(DisasContext *ctx)
+{
+    size_t n = n_insns * 2, i, count = 0;
+
+    for (i = 0; i < n; count++) {
+        uint32_t insn = lduw_le_p(code + 2 * i++);
+
+        if ((insn >> 11) >= 0x1d && i < n) {
+            insn = (insn << 16) | lduw_le_p(code + 2 * i++);
+            decode_bench_t32(ctx, insn);
+        } else {
+            decode_bench_t16(ctx, insn);
+        }
+    }
+    return count;
+}
+
+static size_t run_bench(const DecodeBench *b, DisasContext *ctx)
+{
+    size_t i;
+
+    if (b->thumb) {
+        return run_thumb(ctx);
+    }
+    for (i = 0; i < n_insns; i++) {
+        b->decode(ctx, ldl_le_p(code + i * 4));
+    }
+    return n_insns;
+}
+
+static void pr_stats(const DecodeBench *b)
+{
+    DisasContext ctx = { };
+    uint64_t total = 0;
+    int64_t start, ns;
+    unsigned int i;
+
+    start = get_clock();
+    for (i = 0; i < repeat; i++) {
+        total += run_bench(b, &ctx);
+    }
+    ns = get_clock() - start;
+
+    printf(" %-8s %10.2f Minsn/s  %5.1f%% matched\n", b->name,
+           ns ? total * 1e3 / ns : 0.0,
+           total ? ctx.matched * 100.0 / total : 0.0);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hf:b:n:r:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'f':
+            input_file = optarg;
+            break;
+        case 'b':
+            only = optarg;
+            break;
+        case 'n':
+            n_insns = atoi(optarg);
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+
+    parse_args(argc, argv);
+    load_insns();
+
+    printf("Parameters:\n");
+    printf(" stream:            %s\n", input_file ? input_file : "random");
+    printf(" # of insns:        %zu\n", n_insns);
+    printf(" passes:            %u\n", repeat);
+    printf("Results:\n");
+    for (i = 0; i < ARRAY_SIZE(benches); i++) {
+        if (!only || !strcmp(only, benches[i].name)) {
+            pr_stats(&benches[i]);
+        }
+    }
+    return 0;
+}
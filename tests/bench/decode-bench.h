@@ -0,0 +1,41 @@
+/*
+ * Decodetree decoder benchmark: shared definitions.
+ *
+ * The decoders are generated with --trans-stubs, so that every trans_*
+ * function only records the match and decoding can be timed without
+ * the translators.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef DECODE_BENCH_H
+#define DECODE_BENCH_H
+
+#include "qemu/bitops.h"
+
+typedef struct DisasContext {
+    uint64_t matched;
+    uint64_t sum;
+} DisasContext;
+
+static inline bool decode_stub_trans(DisasContext *ctx, const char *name,
+                                     const void *a, size_t size)
+{
+    ctx->matched++;
+    /* Consume the fields, or the compiler may not extract them.  */
+    if (size >= sizeof(int)) {
+        ctx->sum += *(const int *)a;
+    }
+    return true;
+}
+
+bool decode_bench_a32(DisasContext *ctx, uint32_t insn);
+bool decode_bench_t32(DisasContext *ctx, uint32_t insn);
+bool decode_bench_t16(DisasContext *ctx, uint32_t insn);
+bool decode_bench_vfp(DisasContext *ctx, uint32_t insn);
+bool decode_bench_neon(DisasContext *ctx, uint32_t insn);
+bool decode_bench_mve(DisasContext *ctx, uint32_t insn);
+bool decode_bench_m_nocp(DisasContext *ctx, uint32_t insn);
+bool decode_bench_sve(DisasContext *ctx, uint32_t insn);
+
+#endif /* DECODE_BENCH_H */
@@ -0,0 +1,192 @@
+/*
+ * Compare the interval index with the lookups it replaced for watchpoints
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-index.h"
+#include "qemu/timer.h"
+
+typedef struct Interval {
+    uint64_t start;
+    uint64_t last;
+    uint64_t max_last;  /* for the prefix scan: highest @last up to here */
+} Interval;
+
+static unsigned int n_intervals = 1000;
+static unsigned int n_queries = 1000000;
+static bool wide;
+
+static const char commands_string[] =
+    " -n = number of 4-byte intervals, 64 bytes apart\n"
+    " -q = number of 4-byte queries\n"
+    " -w = also add one interval that covers all the others";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/* See atomic64-bench.c */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Walk every interval, as the watchpoint list used to be walked.  */
+static unsigned int query_list(Interval *iv, unsigned int n,
+                               uint64_t start, uint64_t last)
+{
+    unsigned int i, hits = 0;
+
+    for (i = 0; i < n; i++) {
+        hits += !(iv[i].last < start || iv[i].start > last);
+    }
+    return hits;
+}
+
+/*
+ * Binary search, then scan back while the prefix maximum of the end
+ * addresses reaches the query, as the sorted watchpoint array did.
+ */
+static unsigned int query_prefix(Interval *iv, unsigned int n,
+                                 uint64_t start, uint64_t last)
+{
+    unsigned int lo = 0, hi = n, hits = 0;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (iv[mid].start <= last) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo-- > 0 && iv[lo].max_last >= start) {
+        hits += iv[lo].last >= start;
+    }
+    return hits;
+}
+
+static void count_hit(uint64_t start, uint64_t last, uint64_t value,
+                      void *opaque)
+{
+    (*(unsigned int *)opaque)++;
+}
+
+static unsigned int query_index(IntervalIndex *idx,
+                                uint64_t start, uint64_t last)
+{
+    unsigned int hits = 0;
+
+    interval_index_foreach(idx, start, last, count_hit, &hits);
+    return hits;
+}
+
+static void pr_result(const char *name, int64_t ns, unsigned long hits)
+{
+    printf(" %-16s %8.1f ns/query (%lu hits)\n",
+           name, (double)ns / n_queries, hits);
+}
+
+static void run_test(void)
+{
+    unsigned int n = n_intervals + wide;
+    Interval *iv = g_new(Interval, n);
+    IntervalIndex *idx = interval_index_new();
+    unsigned long hits;
+    uint64_t max_last = 0, r;
+    int64_t t;
+    unsigned int i;
+
+    /* Sorted by start: the wide interval, if any, comes first.  */
+    if (wide) {
+        iv[0].start = 0;
+        iv[0].last = (uint64_t)n_intervals * 64 + 63;
+    }
+    for (i = wide; i < n; i++) {
+        iv[i].start = (uint64_t)(i - wide) * 64 + 16;
+        iv[i].last = iv[i].start + 3;
+    }
+    for (i = 0; i < n; i++) {
+        max_last = MAX(max_last, iv[i].last);
+        iv[i].max_last = max_last;
+        interval_index_insert(idx, iv[i].start, iv[i].last, i);
+    }
+    /* The first query sorts the index; keep that out of the timing.  */
+    query_index(idx, 0, 0);
+
+    r = 1;
+    hits = 0;
+    t = get_clock();
+    for (i = 0; i < n_queries; i++) {
+        uint64_t start = (r = xorshift64star(r)) % (n_intervals * 64ull);
+        hits += query_list(iv, n, start, start + 3);
+    }
+    pr_result("list", get_clock() - t, hits);
+
+    r = 1;
+    hits = 0;
+    t = get_clock();
+    for (i = 0; i < n_queries; i++) {
+        uint64_t start = (r = xorshift64star(r)) % (n_intervals * 64ull);
+        hits += query_prefix(iv, n, start, start + 3);
+    }
+    pr_result("prefix scan", get_clock() - t, hits);
+
+    r = 1;
+    hits = 0;
+    t = get_clock();
+    for (i = 0; i < n_queries; i++) {
+        uint64_t start = (r = xorshift64star(r)) % (n_intervals * 64ull);
+        hits += query_index(idx, start, start + 3);
+    }
+    pr_result("interval index", get_clock() - t, hits);
+
+    interval_index_free(idx);
+    g_free(iv);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:q:w");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_intervals = MAX(atoi(optarg), 1);
+            break;
+        case 'q':
+            n_queries = MAX(atoi(optarg), 1);
+            break;
+        case 'w':
+            wide = true;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    printf("Parameters:\n");
+    printf(" intervals:         %u%s\n", n_intervals,
+           wide ? " + 1 wide" : "");
+    printf(" queries:           %u\n", n_queries);
+    printf("Results:\n");
+    run_test();
+    return 0;
+}
@@ -19,6 +19,10 @@ for i in succ_*.decode; do
     if ! $PYTHON $DECODETREE $i > /dev/null 2> /dev/null; then
         echo FAIL:$i 1>&2
     fi
+    if ! $PYTHON $DECODETREE --jump-table --trans-stubs $i \
+            > /dev/null 2> /dev/null; then
+        echo FAIL:$i --jump-table --trans-stubs 1>&2
+    fi
 done
 
 exit $E
@@ -34,6 +34,8 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_TO_INT,
+    OP_FROM_INT,
     OP_MAX_NR,
 };
 
@@ -45,6 +47,8 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_TO_INT] = "toint",
+    [OP_FROM_INT] = "fromint",
     [OP_MAX_NR] = NULL,
 };
 
@@ -225,6 +229,40 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
     }
 }
 
+/*
+ * OP_FROM_INT converts to fixed point with this many fractional bits, as
+ * e.g. Arm's VCVT.F32.S32 #fbits does, so that the scaled conversions are
+ * measured.
+ */
+#define FROM_INT_FRAC_BITS 10
+
+/*
+ * Operands of OP_TO_INT are kept within the range of int32_t, with a
+ * fractional part, so that we measure the conversion and not the
+ * handling of invalid inputs.
+ */
+static void fill_int_range(union fp *ops, int32_t n, enum precision prec)
+{
+    switch (prec) {
+    case PREC_SINGLE:
+    case PREC_FLOAT32:
+        ops[0].f = n / 1024.0f;
+        break;
+    case PREC_DOUBLE:
+    case PREC_FLOAT64:
+        ops[0].d = n / 1024.0;
+        break;
+    case PREC_QUAD:
+    case PREC_FLOAT128:
+        ops[0].f128 = float128_div(int32_to_float128(n, &soft_status),
+                                   int32_to_float128(1024, &soft_status),
+                                   &soft_status);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 /*
  * The main benchmark function. Instead of (ab)using macros, we rely
  * on the compiler to unfold this at compile-time.
@@ -235,13 +273,19 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
 
     while (get_clock() < tf) {
         union fp ops[MAX_OPERANDS];
+        int32_t n;
         int64_t t0;
         int i;
 
         update_random_ops(n_ops, prec);
+        n = prec == PREC_QUAD || prec == PREC_FLOAT128 ?
+            random_quad_ops[0].low : random_ops[0];
         switch (prec) {
         case PREC_SINGLE:
             fill_random(ops, n_ops, prec, no_neg);
+            if (op == OP_TO_INT) {
+                fill_int_range(ops, n, prec);
+            }
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float a = ops[0].f;
@@ -270,6 +314,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_TO_INT:
+                    res.u64 = (int32_t)a;
+                    break;
+                case OP_FROM_INT:
+                    res.f = ldexpf(n, -FROM_INT_FRAC_BITS);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -277,6 +327,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
             break;
         case PREC_DOUBLE:
             fill_random(ops, n_ops, prec, no_neg);
+            if (op == OP_TO_INT) {
+                fill_int_range(ops, n, prec);
+            }
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 double a = ops[0].d;
@@ -305,6 +358,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_TO_INT:
+                    res.u64 = (int32_t)a;
+                    break;
+                case OP_FROM_INT:
+                    res.d = ldexp(n, -FROM_INT_FRAC_BITS);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -312,6 +371,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
             break;
         case PREC_FLOAT32:
             fill_random(ops, n_ops, prec, no_neg);
+            if (op == OP_TO_INT) {
+                fill_int_range(ops, n, prec);
+            }
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float32 a = ops[0].f32;
@@ -340,6 +402,13 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_TO_INT:
+                    res.u64 = float32_to_int32_round_to_zero(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f32 = int32_to_float32_scalbn(n, -FROM_INT_FRAC_BITS,
+                                                      &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -347,6 +416,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
             break;
         case PREC_FLOAT64:
             fill_random(ops, n_ops, prec, no_neg);
+            if (op == OP_TO_INT) {
+                fill_int_range(ops, n, prec);
+            }
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float64 a = ops[0].f64;
@@ -375,6 +447,13 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_TO_INT:
+                    res.u64 = float64_to_int32_round_to_zero(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f64 = int32_to_float64_scalbn(n, -FROM_INT_FRAC_BITS,
+                                                      &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -382,6 +461,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
             break;
         case PREC_FLOAT128:
             fill_random(ops, n_ops, prec, no_neg);
+            if (op == OP_TO_INT) {
+                fill_int_range(ops, n, prec);
+            }
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float128 a = ops[0].f128;
@@ -410,6 +492,14 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float128_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_TO_INT:
+                    res.u64 = float128_to_int32_round_to_zero(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f128 = int32_to_float128(n, &soft_status);
+                    res.f128 = float128_scalbn(res.f128, -FROM_INT_FRAC_BITS,
+                                               &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -448,6 +538,8 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(toint, OP_TO_INT, 1)
+GEN_BENCH_ALL_TYPES(fromint, OP_FROM_INT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -480,6 +572,8 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(toint, OP_TO_INT),
+    GEN_BENCH_FUNCS(fromint, OP_FROM_INT),
 };
 
 #undef GEN_BENCH_FUNCS
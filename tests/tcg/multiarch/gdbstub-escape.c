@@ -0,0 +1,36 @@
+/*
+ * Data for the gdbstub binary memory read test
+ *
+ * Fill a buffer larger than the old 4 KiB packet size with the bytes
+ * that the remote protocol has to escape in binary replies, and stop
+ * in buffer_ready() so that gdb can read it.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+
+#define BUFFER_SIZE (8 * 1024 + 123)
+
+unsigned char buffer[BUFFER_SIZE];
+
+static const unsigned char escaped[] = { '#', '$', '*', '}' };
+
+void __attribute__((noinline)) buffer_ready(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+int main(void)
+{
+    unsigned int i;
+
+    /* Every other byte needs escaping; the others cover all values */
+    for (i = 0; i < BUFFER_SIZE; i++) {
+        buffer[i] = i & 1 ? escaped[(i >> 1) & 3] : (i >> 1) & 0xff;
+    }
+    buffer_ready();
+
+    printf("buffer of %u bytes ready\n", BUFFER_SIZE);
+    return 0;
+}
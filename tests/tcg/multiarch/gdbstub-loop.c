@@ -0,0 +1,35 @@
+/*
+ * Target for the gdbstub conditional breakpoint and tracepoint test
+ *
+ * visit() is called with 0 to 9; the test stops there on one value and
+ * traces some of the others, then stops in done().
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+
+int total;
+
+void __attribute__((noinline)) visit(int i)
+{
+    total += i;
+}
+
+void __attribute__((noinline)) done(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+int main(void)
+{
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        visit(i);
+    }
+    done();
+
+    printf("total %d\n", total);
+    return total != 45;
+}
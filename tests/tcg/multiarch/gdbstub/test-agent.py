@@ -0,0 +1,111 @@
+from __future__ import print_function
+#
+# Test breakpoint conditions and tracepoints evaluated by the gdbstub
+#
+# This is launched via tests/guest-debug/run-test.py
+#
+
+import gdb
+import sys
+import tempfile
+
+failcount = 0
+
+
+def report(cond, msg):
+    "Report success/fail of test"
+    if cond:
+        print("PASS: %s" % (msg))
+    else:
+        print("FAIL: %s" % (msg))
+        global failcount
+        failcount += 1
+
+
+def source(commands):
+    "Run gdb commands that read more lines, such as actions"
+    with tempfile.NamedTemporaryFile("w", suffix=".gdb") as f:
+        f.write(commands)
+        f.flush()
+        gdb.execute("source %s" % f.name)
+
+
+def trace_frames():
+    "Return the values of i and $pc in each collected trace frame"
+    values = []
+    pcs = []
+    try:
+        gdb.execute("tfind start")
+        while int(gdb.parse_and_eval("$trace_frame")) >= 0:
+            values.append(int(gdb.parse_and_eval("i")))
+            pcs.append(int(gdb.parse_and_eval("$pc")))
+            gdb.execute("tfind")
+    except gdb.error:
+        pass
+    gdb.execute("tfind none")
+    return values, pcs
+
+
+def run_test():
+    "Run through the tests one by one"
+
+    gdb.execute("set breakpoint condition-evaluation target")
+
+    # Trace the even values, with the condition and the collection both
+    # done by the stub
+    source("trace visit if i % 2 == 0\n"
+           "actions\n"
+           "collect i\n"
+           "end\n")
+    gdb.execute("tstart")
+
+    # A conditional breakpoint at the same address as the tracepoint
+    bp = gdb.Breakpoint("visit")
+    bp.condition = "i == 7"
+    gdb.execute("c")
+    report(int(gdb.parse_and_eval("i")) == 7, "conditional break on i == 7")
+    visit_pc = int(gdb.parse_and_eval("$pc"))
+    report(bp.hit_count == 1, "stopped once (%d hits)" % bp.hit_count)
+    bp.delete()
+
+    end = gdb.Breakpoint("done")
+    gdb.execute("c")
+    report(end.hit_count == 1, "reached done")
+    gdb.execute("tstop")
+
+    values, pcs = trace_frames()
+    report(values == [0, 2, 4, 6, 8],
+           "one trace frame per even value: %s" % values)
+    report(len(pcs) > 0 and all(pc == visit_pc for pc in pcs),
+           "trace frames have $pc at the tracepoint (%x): %s" %
+           (visit_pc, ["%x" % pc for pc in pcs]))
+
+#
+# This runs as the script it sourced (via -x, via run-test.py)
+#
+try:
+    inferior = gdb.selected_inferior()
+    arch = inferior.architecture()
+    print("ATTACHED: %s" % arch.name())
+except (gdb.error, AttributeError):
+    print("SKIPPING (not connected)", file=sys.stderr)
+    exit(0)
+
+if gdb.parse_and_eval('$pc') == 0:
+    print("SKIP: PC not set")
+    exit(0)
+
+try:
+    # These are not very useful in scripts
+    gdb.execute("set pagination off")
+    gdb.execute("set confirm off")
+
+    # Run the actual tests
+    run_test()
+except (gdb.error):
+    print("GDB Exception: %s" % (sys.exc_info()[0]))
+    failcount += 1
+    pass
+
+print("All tests complete: %d failures" % failcount)
+exit(failcount)
@@ -0,0 +1,126 @@
+from __future__ import print_function
+#
+# Read a buffer larger than 4 KiB, made of bytes that must be escaped,
+# with the binary 'x' packet and check it against the 'm' packet.
+#
+# This is launched via tests/guest-debug/run-test.py
+#
+
+import gdb
+import sys
+
+failcount = 0
+
+
+def report(cond, msg):
+    "Report success/fail of test"
+    if cond:
+        print("PASS: %s" % (msg))
+    else:
+        print("FAIL: %s" % (msg))
+        global failcount
+        failcount += 1
+
+
+def send_packet(conn, packet):
+    "Send a packet, returning the reply as bytes"
+    reply = conn.send_packet(packet)
+    if isinstance(reply, str):
+        reply = reply.encode("latin-1")
+    return reply
+
+
+def unescape(data):
+    "Undo the escaping of a binary reply"
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        if data[i] == ord("}"):
+            i += 1
+            out.append(data[i] ^ 0x20)
+        else:
+            out.append(data[i])
+        i += 1
+    return bytes(out)
+
+
+def read_x(conn, addr, length):
+    "Read memory with 'x' packets, which may return short replies"
+    data = b""
+    while len(data) < length:
+        reply = send_packet(conn, "x%x,%x" % (addr + len(data),
+                                              length - len(data)))
+        if not reply.startswith(b"b") or len(reply) == 1:
+            print("unexpected reply to x: %r" % reply[:16])
+            break
+        data += unescape(reply[1:])
+    return data
+
+
+def read_m(conn, addr, length):
+    "Read memory with 'm' packets of at most 1 KiB"
+    data = b""
+    while len(data) < length:
+        chunk = min(length - len(data), 1024)
+        reply = send_packet(conn, "m%x,%x" % (addr + len(data), chunk))
+        data += bytes.fromhex(reply.decode("ascii"))
+    return data
+
+
+def run_test(conn):
+    "Run through the tests one by one"
+
+    bp = gdb.Breakpoint("buffer_ready")
+    gdb.execute("c")
+    report(bp.hit_count == 1, "stopped in buffer_ready")
+
+    buf = gdb.parse_and_eval("buffer")
+    addr = int(buf.address)
+    length = buf.type.sizeof
+    report(length > 4096, "buffer of %d bytes is larger than 4 KiB" % length)
+
+    x_data = read_x(conn, addr, length)
+    m_data = read_m(conn, addr, length)
+
+    report(len(x_data) == length, "x read %d bytes" % len(x_data))
+    report(x_data == m_data, "x and m replies match")
+    report(all(c in x_data for c in b"#$*}"), "data has escaped bytes")
+
+    # The first reply alone should be larger than the old packet size
+    reply = send_packet(conn, "x%x,%x" % (addr, length))
+    report(len(unescape(reply[1:])) > 4096, "single x reply over 4 KiB")
+
+#
+# This runs as the script it sourced (via -x, via run-test.py)
+#
+try:
+    inferior = gdb.selected_inferior()
+    arch = inferior.architecture()
+    print("ATTACHED: %s" % arch.name())
+except (gdb.error, AttributeError):
+    print("SKIPPING (not connected)", file=sys.stderr)
+    exit(0)
+
+if gdb.parse_and_eval('$pc') == 0:
+    print("SKIP: PC not set")
+    exit(0)
+
+conn = getattr(inferior, "connection", None)
+if conn is None or not hasattr(conn, "send_packet"):
+    print("SKIP: gdb cannot send raw packets")
+    exit(0)
+
+try:
+    # These are not very useful in scripts
+    gdb.execute("set pagination off")
+    gdb.execute("set confirm off")
+
+    # Run the actual tests
+    run_test(conn)
+except (gdb.error):
+    print("GDB Exception: %s" % (sys.exc_info()[0]))
+    failcount += 1
+    pass
+
+print("All tests complete: %d failures" % failcount)
+exit(failcount)
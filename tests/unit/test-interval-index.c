@@ -0,0 +1,135 @@
+/*
+ * Test the interval index
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-index.h"
+
+typedef struct Interval {
+    uint64_t start;
+    uint64_t last;
+} Interval;
+
+typedef struct Visit {
+    GArray *values;
+    uint64_t prev_start;
+} Visit;
+
+static void visit(uint64_t start, uint64_t last, uint64_t value, void *opaque)
+{
+    Visit *v = opaque;
+
+    /* Overlapping intervals are reported in start order.  */
+    g_assert_cmpuint(start, >=, v->prev_start);
+    v->prev_start = start;
+    g_array_append_val(v->values, value);
+}
+
+static gint value_cmp(gconstpointer a, gconstpointer b)
+{
+    uint64_t va = *(const uint64_t *)a, vb = *(const uint64_t *)b;
+
+    return va < vb ? -1 : va > vb;
+}
+
+/* Check a query against a walk of every interval.  */
+static void check_query(IntervalIndex *idx, const Interval *iv, size_t n,
+                        uint64_t start, uint64_t last)
+{
+    Visit v = { .values = g_array_new(false, false, sizeof(uint64_t)) };
+    GArray *expected = g_array_new(false, false, sizeof(uint64_t));
+    uint64_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!(iv[i].last < start || iv[i].start > last)) {
+            g_array_append_val(expected, i);
+        }
+    }
+    interval_index_foreach(idx, start, last, visit, &v);
+
+    g_array_sort(v.values, value_cmp);
+    g_assert_cmpuint(v.values->len, ==, expected->len);
+    for (i = 0; i < expected->len; i++) {
+        g_assert_cmpuint(g_array_index(v.values, uint64_t, i), ==,
+                         g_array_index(expected, uint64_t, i));
+    }
+    g_array_free(v.values, true);
+    g_array_free(expected, true);
+}
+
+static void test_empty(void)
+{
+    IntervalIndex *idx = interval_index_new();
+
+    check_query(idx, NULL, 0, 0, UINT64_MAX);
+    interval_index_free(idx);
+}
+
+static void test_simple(void)
+{
+    static const Interval iv[] = {
+        { 0x1000, 0x1003 },
+        { 0x1002, 0x1002 },
+        { 0x0, 0xffff },            /* wide, and lowest */
+        { 0x2000, 0x2fff },
+        { UINT64_MAX - 3, UINT64_MAX },
+    };
+    IntervalIndex *idx = interval_index_new();
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(iv); i++) {
+        interval_index_insert(idx, iv[i].start, iv[i].last, i);
+    }
+
+    check_query(idx, iv, ARRAY_SIZE(iv), 0x1000, 0x1000);
+    check_query(idx, iv, ARRAY_SIZE(iv), 0x1002, 0x1002);
+    check_query(idx, iv, ARRAY_SIZE(iv), 0x1004, 0x1fff);
+    check_query(idx, iv, ARRAY_SIZE(iv), 0x10000, 0x1ffff);
+    check_query(idx, iv, ARRAY_SIZE(iv), UINT64_MAX, UINT64_MAX);
+    check_query(idx, iv, ARRAY_SIZE(iv), 0, UINT64_MAX);
+    interval_index_free(idx);
+}
+
+static void test_random(void)
+{
+    enum { N = 500, QUERIES = 2000 };
+    Interval *iv = g_new(Interval, N);
+    IntervalIndex *idx = interval_index_new();
+    size_t i;
+
+    for (i = 0; i < N; i++) {
+        uint64_t start = g_test_rand_int_range(0, 1 << 20);
+        /* Mostly short intervals, as with watchpoints, some long ones */
+        uint64_t len = i % 16 ? g_test_rand_int_range(1, 16)
+                              : g_test_rand_int_range(1, 1 << 18);
+
+        iv[i].start = start;
+        iv[i].last = start + len - 1;
+        interval_index_insert(idx, iv[i].start, iv[i].last, i);
+
+        /* Interleave queries with insertions, which forces rebuilds.  */
+        if (i % 50 == 0) {
+            check_query(idx, iv, i + 1, start, start);
+        }
+    }
+
+    for (i = 0; i < QUERIES; i++) {
+        uint64_t start = g_test_rand_int_range(0, 1 << 20);
+        uint64_t len = g_test_rand_int_range(1, 64);
+
+        check_query(idx, iv, N, start, start + len - 1);
+    }
+    interval_index_free(idx);
+    g_free(iv);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-index/empty", test_empty);
+    g_test_add_func("/interval-index/simple", test_simple);
+    g_test_add_func("/interval-index/random", test_random);
+    return g_test_run();
+}
@@ -0,0 +1,23 @@
+/*
+ * Run-time detection of 16-byte atomic operations.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic128.h"
+
+#ifdef HAVE_CMPXCHG16B_RUNTIME
+#include "qemu/cpuid.h"
+
+bool have_cmpxchg16b;
+
+static void __attribute__((constructor)) init_have_cmpxchg16b(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(1, &a, &b, &c, &d)) {
+        have_cmpxchg16b = (c & bit_CMPXCHG16B) != 0;
+    }
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Index of closed intervals, for stabbing and overlap queries.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-index.h"
+
+typedef struct IntervalIndexNode {
+    uint64_t start;
+    uint64_t last;
+    uint64_t subtree_last;  /* highest @last in the subtree rooted here */
+    uint64_t value;
+} IntervalIndexNode;
+
+struct IntervalIndex {
+    GArray *nodes;
+    bool built;
+};
+
+IntervalIndex *interval_index_new(void)
+{
+    IntervalIndex *idx = g_new0(IntervalIndex, 1);
+
+    idx->nodes = g_array_new(false, false, sizeof(IntervalIndexNode));
+    idx->built = true;
+    return idx;
+}
+
+void interval_index_free(IntervalIndex *idx)
+{
+    if (idx) {
+        g_array_free(idx->nodes, true);
+        g_free(idx);
+    }
+}
+
+void interval_index_insert(IntervalIndex *idx, uint64_t start, uint64_t last,
+                           uint64_t value)
+{
+    IntervalIndexNode n = {
+        .start = start,
+        .last = last,
+        .value = value,
+    };
+
+    g_assert(start <= last);
+    g_array_append_val(idx->nodes, n);
+    idx->built = false;
+}
+
+static gint interval_index_cmp(gconstpointer a, gconstpointer b)
+{
+    const IntervalIndexNode *na = a, *nb = b;
+
+    return na->start < nb->start ? -1 : na->start > nb->start;
+}
+
+/* Fill in @subtree_last for the subtree made of nodes [lo, hi).  */
+static uint64_t interval_index_build(IntervalIndexNode *n, guint lo, guint hi)
+{
+    guint mid = lo + (hi - lo) / 2;
+    uint64_t last = n[mid].last;
+
+    if (lo < mid) {
+        last = MAX(last, interval_index_build(n, lo, mid));
+    }
+    if (mid + 1 < hi) {
+        last = MAX(last, interval_index_build(n, mid + 1, hi));
+    }
+    n[mid].subtree_last = last;
+    return last;
+}
+
+static void interval_index_search(IntervalIndexNode *n, guint lo, guint hi,
+                                  uint64_t start, uint64_t last,
+                                  IntervalIndexFn *fn, void *opaque)
+{
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        IntervalIndexNode *node = &n[mid];
+
+        if (node->subtree_last < start) {
+            /* Everything below ends before the query.  */
+            return;
+        }
+        interval_index_search(n, lo, mid, start, last, fn, opaque);
+        if (node->start > last) {
+            /* This node and its right subtree start after the query.  */
+            return;
+        }
+        if (node->last >= start) {
+            fn(node->start, node->last, node->value, opaque);
+        }
+        lo = mid + 1;
+    }
+}
+
+void interval_index_foreach(IntervalIndex *idx, uint64_t start, uint64_t last,
+                            IntervalIndexFn *fn, void *opaque)
+{
+    IntervalIndexNode *n = (IntervalIndexNode *)idx->nodes->data;
+    guint len = idx->nodes->len;
+
+    if (len == 0) {
+        return;
+    }
+    if (!idx->built) {
+        g_array_sort(idx->nodes, interval_index_cmp);
+        interval_index_build(n, 0, len);
+        idx->built = true;
+    }
+    interval_index_search(n, 0, len, start, last, fn, opaque);
+}